@@ -0,0 +1,445 @@
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+
+#include <unistd.h>
+
+#include "utils/time.h"
+#include "events.h"
+#include "input_frame.h"
+#include "avr_sim.h"
+
+/** Driver benchmarks. 
+ 
+    Measures the pieces of the RPi driver that can be measured without the hardware. See the README for the results. 
+ */
+
+/** The original mutex & condition variable based event queue, kept here so that the lock-free EventQueue can be compared against it. 
+ */
+template<typename T> 
+class MutexEventQueue {
+public:
+    bool send(T && event) {
+        std::lock_guard<std::mutex> g{m_};
+        q_.push(std::move(event));
+        cv_.notify_all();
+        return true;
+    }
+
+    T waitReceive() {
+        std::unique_lock<std::mutex> g{m_};
+        cv_.wait(g, [this](){ return ! q_.empty(); });
+        auto x = std::move(q_.front());
+        q_.pop();
+        return x;
+    }
+
+    size_t overflows() const { return 0; }
+
+private:
+    std::queue<T> q_;
+    std::mutex m_;
+    std::condition_variable cv_;
+}; // MutexEventQueue
+
+static constexpr size_t THROUGHPUT_EVENTS = 1000000;
+static constexpr size_t LATENCY_SAMPLES = 2000;
+
+inline int64_t asNanos(Duration d) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+/** Sends the event, retrying while the queue is full so that no events are lost in the benchmark. 
+ */
+template<typename Q>
+void sendAll(Q & q, Event e) {
+    while (! q.send(std::move(e)))
+        std::this_thread::yield();
+}
+
+/** Flat out throughput with the UI queue's event mix: one thread pushes recording events, one pushes ticks and one pushes button events, the consumer blocks in waitReceive. 
+ */
+template<typename Q>
+void throughput(char const * name) {
+    Q q;
+    std::atomic<int64_t> remaining{THROUGHPUT_EVENTS};
+    auto producer = [&](Event e) {
+        while (remaining.fetch_sub(1) > 0)
+            sendAll(q, e);
+    };
+    Timepoint t = now();
+    std::thread consumer{[&](){
+        for (size_t i = 0; i < THROUGHPUT_EVENTS; ++i)
+            q.waitReceive();
+    }};
+    std::thread rec{producer, Event{RecordingEvent{}}};
+    std::thread ticks{producer, Event{SecondTick{}}};
+    std::thread buttons{producer, Event{ButtonEvent{Button::A, true}}};
+    rec.join();
+    ticks.join();
+    buttons.join();
+    consumer.join();
+    int64_t ns = asNanos(now() - t);
+    std::cout << name << " throughput: " << (THROUGHPUT_EVENTS * 1000 / (ns / 1000)) << " events/ms, " 
+              << (ns / THROUGHPUT_EVENTS) << " ns/event" << std::endl;
+}
+
+/** Latency of paced button events (one every 500us) while another thread floods the queue with recording events in bursts of 8 at the AVR's recording rate (one batch every 4ms). 
+
+    The button events carry their index in the joystick event payload, the send timestamps are kept in a side array.
+ */
+template<typename Q>
+void latency(char const * name) {
+    Q q;
+    std::vector<Timepoint> sent(LATENCY_SAMPLES);
+    std::vector<int64_t> lat;
+    lat.reserve(LATENCY_SAMPLES);
+    std::atomic<bool> done{false};
+    std::thread consumer{[&](){
+        while (lat.size() < LATENCY_SAMPLES) {
+            Event e = q.waitReceive();
+            if (std::holds_alternative<JoyEvent>(e)) {
+                JoyEvent & j = std::get<JoyEvent>(e);
+                size_t i = j.h * 256 + j.v;
+                lat.push_back(asNanos(now() - sent[i]));
+            }
+        }
+    }};
+    std::thread rec{[&](){
+        while (! done) {
+            for (int i = 0; i < 8; ++i)
+                sendAll(q, RecordingEvent{});
+            std::this_thread::sleep_for(std::chrono::milliseconds{4});
+        }
+    }};
+    for (size_t i = 0; i < LATENCY_SAMPLES; ++i) {
+        std::this_thread::sleep_for(std::chrono::microseconds{500});
+        sent[i] = now();
+        sendAll(q, JoyEvent{static_cast<uint8_t>(i / 256), static_cast<uint8_t>(i % 256)});
+    }
+    consumer.join();
+    done = true;
+    rec.join();
+    std::sort(lat.begin(), lat.end());
+    std::cout << std::fixed << std::setprecision(1) << name << " latency: p50 " << lat[lat.size() / 2] / 1000.0 
+              << " us, p99 " << lat[lat.size() * 99 / 100] / 1000.0 
+              << " us, max " << lat.back() / 1000.0 << " us" << std::endl;
+}
+
+/** A stand-in for the uinput device. 
+
+    Like libevdev_uinput_write_event, every event is a single write of struct input_event to a file descriptor, here a pipe. A reader thread plays the role of the evdev client and records when each synchronized report is complete. 
+ */
+class MockUinput {
+public:
+    MockUinput() {
+        if (pipe(fds_) != 0)
+            throw std::runtime_error("Unable to create pipe");
+        reader_ = std::thread{[this](){
+            input_event e;
+            while (read(fds_[0], & e, sizeof(e)) == sizeof(e)) {
+                if (e.type == EV_SYN) {
+                    lastReport_ = now();
+                    ++reports_;
+                }
+            }
+        }};
+    }
+
+    ~MockUinput() {
+        close(fds_[1]);
+        reader_.join();
+        close(fds_[0]);
+    }
+
+    void write(uint16_t type, uint16_t code, int32_t value) {
+        input_event e{};
+        e.type = type;
+        e.code = code;
+        e.value = value;
+        ::write(fds_[1], & e, sizeof(e));
+        ++events_;
+    }
+
+    /** Waits until the reader has seen the given number of reports and returns the time the last one was completed. 
+     */
+    Timepoint waitForReports(size_t n) {
+        while (reports_ < n)
+            std::this_thread::yield();
+        return lastReport_;
+    }
+
+    size_t events() const { return events_; }
+    size_t reports() const { return reports_; }
+
+private:
+    int fds_[2];
+    std::thread reader_;
+    std::atomic<size_t> reports_{0};
+    std::atomic<Timepoint> lastReport_;
+    size_t events_ = 0;
+}; // MockUinput
+
+static constexpr size_t EVDEV_FRAMES = 10000;
+
+/** Input frames as produced by a single AVR state read: D-pad diagonal together with a face button, pressed and then released in the next frame. 
+
+    Measures how many reports the emulator sees, how long it takes to write them and the latency from the start of the frame to the moment the whole frame is visible to the reader. 
+ */
+void evdevFrames(char const * name, bool batched) {
+    MockUinput sink;
+    InputFrame<> frame;
+    auto write = [&](uint16_t type, uint16_t code, int32_t value) { sink.write(type, code, value); };
+    std::vector<int64_t> lat;
+    lat.reserve(EVDEV_FRAMES);
+    int64_t total = 0;
+    for (size_t i = 0; i < EVDEV_FRAMES; ++i) {
+        int v = (i % 2 == 0) ? 1 : 0;
+        size_t before = sink.reports();
+        Timepoint t = now();
+        if (batched) {
+            frame.add(EV_ABS, ABS_HAT0X, -v, write);
+            frame.add(EV_ABS, ABS_HAT0Y, v, write);
+            frame.add(EV_KEY, BTN_EAST, v, write);
+            frame.flush(write);
+        } else {
+            write(EV_ABS, ABS_HAT0X, -v);
+            write(EV_SYN, SYN_REPORT, 0);
+            write(EV_ABS, ABS_HAT0Y, v);
+            write(EV_SYN, SYN_REPORT, 0);
+            write(EV_KEY, BTN_EAST, v);
+            write(EV_SYN, SYN_REPORT, 0);
+        }
+        total += asNanos(now() - t);
+        lat.push_back(asNanos(sink.waitForReports(batched ? before + 1 : before + 3) - t));
+    }
+    std::sort(lat.begin(), lat.end());
+    std::cout << std::fixed << std::setprecision(1) << name << " evdev: " 
+              << (double)sink.reports() / EVDEV_FRAMES << " reports/frame, " 
+              << (double)sink.events() / EVDEV_FRAMES << " writes/frame, " 
+              << total / EVDEV_FRAMES / 1000.0 << " us/frame, latency p50 " << lat[lat.size() / 2] / 1000.0 
+              << " us, p99 " << lat[lat.size() * 99 / 100] / 1000.0 << " us" << std::endl;
+}
+
+static constexpr size_t UI_PRESSES = 100;
+static constexpr int64_t UI_DRAW_US = 2000;
+
+/** Time to first pixel of button presses on an idle screen. 
+
+    The UI thread either polls the queue and sleeps for a frame when there is nothing to draw (the original loop), or blocks on the queue until an event arrives. Each press makes the widget redraw once, drawing is simulated by a busy wait. The presses come every 20 to 60ms. Also counts how many times per second the UI thread woke up.
+ */
+void uiLoop(char const * name, bool blocking) {
+    UIEventQueue<> q;
+    std::vector<int64_t> lat;
+    lat.reserve(UI_PRESSES);
+    size_t wakeups = 0;
+    Timepoint t = now();
+    std::thread ui{[&](){
+        while (lat.size() < UI_PRESSES) {
+            if (blocking)
+                q.waitFor(-1);
+            ++wakeups;
+            LatencyClock::time_point origin{};
+            while (true) {
+                std::optional<Event> e = q.receive();
+                if (! e.has_value())
+                    break;
+                if (std::holds_alternative<ButtonEvent>(e.value()))
+                    origin = std::get<ButtonEvent>(e.value()).origin;
+            }
+            if (origin != LatencyClock::time_point{}) {
+                Timepoint end = now() + std::chrono::microseconds{UI_DRAW_US};
+                while (now() < end) {}
+                lat.push_back(asNanos(LatencyClock::now() - origin));
+            } else if (! blocking) {
+                std::this_thread::sleep_for(std::chrono::milliseconds{16});
+            }
+        }
+    }};
+    srand(0);
+    for (size_t i = 0; i < UI_PRESSES; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{20 + rand() % 40});
+        q.send(ButtonEvent{Button::A, true, LatencyClock::now()});
+    }
+    ui.join();
+    int64_t ms = asMillis(now() - t);
+    std::sort(lat.begin(), lat.end());
+    std::cout << std::fixed << std::setprecision(1) << name << " ui loop: time to first pixel p50 " << lat[lat.size() / 2] / 1000000.0 
+              << " ms, p99 " << lat[lat.size() * 99 / 100] / 1000000.0 << " ms, " 
+              << wakeups * 1000 / ms << " wakeups/s" << std::endl;
+}
+
+static constexpr int64_t RECORDING_MS = 2000;
+
+static EventQueue<LatencyClock::time_point> * avrIrqs = nullptr;
+
+static void isrAvrIrq() { avrIrqs->send(LatencyClock::now()); }
+
+/** Audio recording against the simulated AVR. 
+
+    The driver side waits for the AVR_IRQ and reads the status and the batches over the simulated 400kHz I2C bus for each interrupt, the same as the driver's recording path: the AVR raises the interrupt when burst batches are available and the reader reads that many, or all that were left over from the previous read. Every 100ms the reader stalls for 5ms to simulate a busy driver thread. Reports how many of the recorded batches were read, the number of interrupts and transactions per second, the I2C bytes read per second of audio, how many reads found no complete batch and how many batches were overwritten before they could be read. 
+ */
+void recording(uint16_t sampleRate, uint8_t bits, uint8_t burst, comms::AudioEncoding encoding = comms::AudioEncoding::Raw) {
+    using namespace platform;
+    EventQueue<LatencyClock::time_point> irqs;
+    avrIrqs = & irqs;
+    AvrSimulator avr;
+    avr.start(AVR_I2C_ADDRESS, RPI_PIN_AVR_IRQ);
+    gpio::attachInterrupt(RPI_PIN_AVR_IRQ, gpio::Edge::Falling, & isrAvrIrq);
+    // the AVR starts in the PowerUp mode and only records when on
+    msg::PowerOn on{};
+    i2c::transmit(AVR_I2C_ADDRESS, reinterpret_cast<uint8_t *>(& on), sizeof(on), nullptr, 0);
+    msg::StartAudioRecording start{burst, encoding, sampleRate, bits};
+    i2c::transmit(AVR_I2C_ADDRESS, reinterpret_cast<uint8_t *>(& start), sizeof(start), nullptr, 0);
+    size_t skipped = 0;
+    size_t reads = 0;
+    size_t bytes = 0;
+    int last = -1;
+    uint8_t pending = 0;
+    Timepoint t = now();
+    Timepoint end = t + std::chrono::milliseconds{RECORDING_MS};
+    Timepoint stall = t + std::chrono::milliseconds{100};
+    while (now() < end) {
+        if (! irqs.waitFor(10))
+            continue;
+        while (irqs.receive().has_value()) {
+            uint8_t batches = std::max(burst, pending);
+            uint8_t buf[1 + 7 * 32];
+            i2c::transmit(AVR_I2C_ADDRESS, nullptr, 0, buf, 1 + batches * 32);
+            ++reads;
+            bytes += 1 + batches * 32;
+            comms::Status status = * reinterpret_cast<comms::Status *>(buf);
+            if (status.batchIncomplete())
+                continue;
+            uint8_t read = std::min(status.batchCount(), batches);
+            pending = status.batchCount() - read;
+            if (last >= 0)
+                skipped += (status.batchIndex() - last - 1) & 7;
+            last = (status.batchIndex() + read - 1) & 7;
+        }
+        if (now() >= stall) {
+            std::this_thread::sleep_for(std::chrono::milliseconds{5});
+            stall += std::chrono::milliseconds{100};
+        }
+    }
+    int64_t ms = asMillis(now() - t);
+    msg::StopAudioRecording stop{};
+    i2c::transmit(AVR_I2C_ADDRESS, reinterpret_cast<uint8_t *>(& stop), sizeof(stop), nullptr, 0);
+    gpio::attachInterrupt(RPI_PIN_AVR_IRQ, gpio::Edge::Falling, nullptr);
+    avr.stop();
+    size_t audioMs = std::max<size_t>(1, avr.batchesRead() * comms::samplesPerBatch(encoding, bits) * 1000 / sampleRate);
+    std::cout << sampleRate << " Hz " << (int)bits << "bit " << (encoding == comms::AudioEncoding::Raw ? "raw" : "adpcm") << " recording, burst " << (int)burst << ": " << avr.batchesRead() << "/" << avr.batchesRecorded() 
+              << " batches read, " << avr.irqs() * 1000 / ms << " irqs/s, " << reads * 1000 / ms << " reads/s, " << bytes * 1000 / audioMs << " bytes/s of audio, "
+              << avr.incompleteReads() << " incomplete reads, " << skipped << " skipped" << std::endl;
+}
+
+static constexpr int64_t JOYSTICK_MS = 2000;
+static constexpr int64_t JOYSTICK_STEP_US = 250;
+
+/** Thumbstick against the simulated AVR. 
+
+    A mover thread sweeps the thumbstick from one end to the other and back in 10bit steps every 250us (about a full sweep per quarter of a second, a quick flick) and remembers when the thumbstick first moved since the last report. The driver side waits for the AVR_IRQ, reads the state over the simulated 400kHz I2C bus and writes the horizontal axis to the mocked uinput device via an InputFrame, the same as the driver's controls path. Reports the number of evdev updates per second, the average change of the axis between them in 10bit units and the latency from the first movement not reflected by the previous report until the report was read by the evdev client. 
+ */
+void joystick(bool streaming) {
+    using namespace platform;
+    EventQueue<LatencyClock::time_point> irqs;
+    avrIrqs = & irqs;
+    AvrSimulator avr;
+    avr.start(AVR_I2C_ADDRESS, RPI_PIN_AVR_IRQ);
+    gpio::attachInterrupt(RPI_PIN_AVR_IRQ, gpio::Edge::Falling, & isrAvrIrq);
+    msg::PowerOn on{};
+    i2c::transmit(AVR_I2C_ADDRESS, reinterpret_cast<uint8_t *>(& on), sizeof(on), nullptr, 0);
+    msg::SetJoyStreaming stream{streaming};
+    i2c::transmit(AVR_I2C_ADDRESS, reinterpret_cast<uint8_t *>(& stream), sizeof(stream), nullptr, 0);
+    MockUinput sink;
+    InputFrame<> frame;
+    auto write = [&](uint16_t type, uint16_t code, int32_t value) { sink.write(type, code, value); };
+    Timepoint t = now();
+    Timepoint end = t + std::chrono::milliseconds{JOYSTICK_MS};
+    // time of the first movement since the last report (ns since start, -1 if none)
+    std::atomic<int64_t> moved{-1};
+    std::atomic<bool> done{false};
+    std::thread mover{[&](){
+        Timepoint next = now();
+        int pos = 512;
+        int dir = 1;
+        while (!done) {
+            if (pos + dir < 0 || pos + dir > 1023)
+                dir = -dir;
+            pos += dir;
+            int64_t none = -1;
+            moved.compare_exchange_strong(none, asNanos(now() - t));
+            avr.setJoyFull(pos, 512);
+            next += std::chrono::microseconds{JOYSTICK_STEP_US};
+            std::this_thread::sleep_until(next);
+        }
+    }};
+    std::vector<int64_t> lat;
+    size_t updates = 0;
+    size_t distance = 0;
+    uint16_t last = 512;
+    while (now() < end) {
+        if (! irqs.waitFor(10))
+            continue;
+        while (irqs.receive().has_value()) {
+            int64_t since = moved.exchange(-1);
+            comms::State state;
+            i2c::transmit(AVR_I2C_ADDRESS, nullptr, 0, reinterpret_cast<uint8_t *>(& state), sizeof(state));
+            uint16_t h = state.controls.joyHFull();
+            if (h == last) {
+                // the movements are reported later
+                int64_t none = -1;
+                if (since >= 0)
+                    moved.compare_exchange_strong(none, since);
+                continue;
+            }
+            size_t before = sink.reports();
+            frame.add(EV_ABS, ABS_X, h, write);
+            frame.flush(write);
+            Timepoint reported = sink.waitForReports(before + 1);
+            if (since >= 0)
+                lat.push_back(asNanos(reported - t) - since);
+            distance += (h > last) ? h - last : last - h;
+            last = h;
+            ++updates;
+        }
+    }
+    int64_t ms = asMillis(now() - t);
+    done = true;
+    mover.join();
+    gpio::attachInterrupt(RPI_PIN_AVR_IRQ, gpio::Edge::Falling, nullptr);
+    avr.stop();
+    std::sort(lat.begin(), lat.end());
+    std::cout << std::fixed << std::setprecision(1) << (streaming ? "streamed" : "ticked") << " thumbstick: " 
+              << updates * 1000 / ms << " updates/s, " << (double)distance / std::max<size_t>(1, updates) << " LSB/update, latency p50 " 
+              << lat[lat.size() / 2] / 1000000.0 << " ms, p99 " << lat[lat.size() * 99 / 100] / 1000000.0 << " ms" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    throughput<MutexEventQueue<Event>>("mutex");
+    throughput<EventQueue<Event, 1024>>("lockfree");
+    latency<MutexEventQueue<Event>>("mutex");
+    latency<EventQueue<Event, 1024>>("lockfree");
+    evdevFrames("per-event", false);
+    evdevFrames("batched", true);
+    uiLoop("polling", false);
+    uiLoop("blocking", true);
+    recording(8000, 8, 1);
+    recording(8000, 8, AUDIO_RECORDING_BURST);
+    recording(16000, 8, 2);
+    recording(16000, 12, 1);
+    recording(16000, 12, 2);
+    recording(8000, 8, AUDIO_RECORDING_BURST, comms::AudioEncoding::ADPCM);
+    recording(16000, 12, 1, comms::AudioEncoding::ADPCM);
+    recording(16000, 12, 2, comms::AudioEncoding::ADPCM);
+    joystick(false);
+    joystick(true);
+    return EXIT_SUCCESS;
+}
@@ -361,6 +361,13 @@ namespace platform {
 #endif
         }
 
+        /** Sets up the device's chip select pin and deselects the device. 
+         */
+        static void initializeDevice(Device device) {
+            gpio::output(device);
+            gpio::high(device);
+        }
+
         static void begin(Device device) {
             gpio::low(device);
 #if (defined ARCH_AVR_MEGATINY)
@@ -407,5 +414,29 @@ namespace platform {
                 *(data++) = transfer(0);
         }
 
+        /** A single command to the device, i.e. the bytes sent and received while the chip select is active. Either buffer can be nullptr. 
+         */
+        struct Transfer {
+            uint8_t const * tx;
+            uint8_t * rx;
+            size_t size;
+        };
+
+        /** Executes the transfers one after another, each of them delimited by the chip select. 
+         */
+        static bool transfer(Device device, Transfer const * transfers, size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                Transfer const & t = transfers[i];
+                begin(device);
+                for (size_t j = 0; j < t.size; ++j) {
+                    uint8_t x = transfer(t.tx == nullptr ? 0 : t.tx[j]);
+                    if (t.rx != nullptr)
+                        t.rx[j] = x;
+                }
+                end(device);
+            }
+            return true;
+        }
+
     }; // spi
 } // namespace platform
\ No newline at end of file
@@ -3,6 +3,8 @@
 #include <cstring>
 #include <thread>
 #include <chrono>
+#include <atomic>
+#include <functional>
 
 namespace platform {
 
@@ -44,15 +46,48 @@ namespace platform {
 
         static void input(Pin pin) {}
 
-        static void inputPullup(Pin pin) {}
+        static void inputPullup(Pin pin) { 
+            if (pin < NUM_PINS)
+                levels_[pin] = true; 
+        }
 
         static void high(Pin pin) {}
 
         static void low(Pin pin) {}
 
-        static bool read(Pin pin) { return false; }
+        static bool read(Pin pin) { return pin < NUM_PINS && levels_[pin]; }
+
+        static void attachInterrupt(Pin pin, Edge edge, void (*handler)()) {
+            if (pin >= NUM_PINS)
+                return;
+            edges_[pin] = edge;
+            handlers_[pin] = handler;
+        }
+
+        static int interruptFd(Pin pin, Edge edge) { return -1; }
+
+        static bool clearInterrupt(int fd) { return false; }
+
+        /** Drives the input pin externally, as a simulated device would. If the change matches the edge of the interrupt attached to the pin, the handler is called from the calling thread. 
+         */
+        static void simulate(Pin pin, bool value) {
+            if (pin >= NUM_PINS || levels_[pin].exchange(value) == value)
+                return;
+            void (*handler)() = handlers_[pin];
+            if (handler == nullptr)
+                return;
+            Edge edge = edges_[pin];
+            if (edge == Edge::Both || (edge == Edge::Rising) == value)
+                handler();
+        }
+
+    private:
 
-        static void attachInterrupt(Pin pin, Edge edge, void (*handler)()) {}
+        static constexpr Pin NUM_PINS = 64;
+
+        static inline std::atomic<bool> levels_[NUM_PINS] = {};
+        static inline std::atomic<void (*)()> handlers_[NUM_PINS] = {};
+        static inline std::atomic<Edge> edges_[NUM_PINS] = {};
 
     }; // gpio
 
@@ -63,10 +98,56 @@ namespace platform {
 
         static void initializeSlave(uint8_t address_) {}
 
+        struct Transfer {
+            uint8_t address;
+            uint8_t const * wb;
+            uint8_t wsize;
+            uint8_t * rb;
+            uint8_t rsize;
+        };
+
+        static constexpr size_t MAX_TRANSFERS = 16;
+
         static bool transmit(uint8_t address, uint8_t const * wb, uint8_t wsize, uint8_t * rb, uint8_t rsize) {
-            return false;
+            Slave * slave = slaves_[address & 0x7f];
+            bool result = slave != nullptr && (*slave)(wb, wsize, rb, rsize);
+            if (Observer o = observer_)
+                o(address, rb, rsize, result);
+            return result;
+        }
+
+        /** Executes the transfers one after another, stopping at the first failed one, like the bus would. More than MAX_TRANSFERS transfers fail without anything being transmitted, like on the RPi. 
+         */
+        static bool transmit(Transfer const * transfers, size_t n) {
+            if (n > MAX_TRANSFERS)
+                return false;
+            for (size_t i = 0; i < n; ++i)
+                if (!transmit(transfers[i].address, transfers[i].wb, transfers[i].wsize, transfers[i].rb, transfers[i].rsize))
+                    return false;
+            return true;
+        }
+
+        /** A simulated slave device. Takes the bytes written by the master and the buffer to be filled with the bytes read by the master and returns true if the transaction has been acknowledged. 
+         */
+        using Slave = std::function<bool(uint8_t const * wb, uint8_t wsize, uint8_t * rb, uint8_t rsize)>;
+
+        /** Attaches the simulated slave at given address, or detaches the slave at the address if nullptr. The slave must outlive the attachment. Transactions to addresses without slaves fail. 
+         */
+        static void attachSlave(uint8_t address, Slave * slave) {
+            slaves_[address & 0x7f] = slave;
         }
 
+        /** Called after each transaction with the bytes read and its result. Used by the RCKid driver to record traces. 
+         */
+        using Observer = void (*)(uint8_t address, uint8_t const * rb, uint8_t rsize, bool result);
+
+        static void setObserver(Observer observer) { observer_ = observer; }
+
+    private:
+
+        static inline std::atomic<Slave *> slaves_[128] = {};
+        static inline std::atomic<Observer> observer_{nullptr};
+
     }; // i2c
 
     class spi {
@@ -76,17 +157,69 @@ namespace platform {
 
         static bool initialize() { return true; }
 
+        static void initializeDevice(Device device) {}
+
         static void begin(Device device) {}
 
         static void end(Device device) {}
 
-        static uint8_t transfer(uint8_t value) { return 0; }
+        static uint8_t transfer(uint8_t value) { 
+            uint8_t result = 0;
+            transfer(& value, & result, 1);
+            return result;
+        }
+
+        static size_t transfer(uint8_t const * tx, uint8_t * rx, size_t numBytes) { 
+            Slave * slave = slave_;
+            if (slave != nullptr)
+                (*slave)(tx, rx, numBytes);
+            else if (rx != nullptr)
+                memset(rx, 0, numBytes);
+            if (rx != nullptr)
+                if (Observer o = observer_)
+                    o(rx, numBytes);
+            return numBytes; 
+        }
+
+        static void send(uint8_t const * data, size_t size) { transfer(data, nullptr, size); }
+
+        static void receive(uint8_t * data, size_t size) { transfer(nullptr, data, size); }
+
+        /** A single command to the device, i.e. the bytes sent and received while the chip select is active. Either buffer can be nullptr. 
+         */
+        struct Transfer {
+            uint8_t const * tx;
+            uint8_t * rx;
+            size_t size;
+        };
+
+        /** Executes the transfers one after another, each of them delimited by the chip select. 
+         */
+        static bool transfer(Device device, Transfer const * transfers, size_t n) {
+            for (size_t i = 0; i < n; ++i)
+                transfer(transfers[i].tx, transfers[i].rx, transfers[i].size);
+            return true;
+        }
+
+        /** A simulated device on the bus. Takes the bytes sent (nullptr if only receiving) and the buffer for the received bytes (nullptr if only sending). 
+         */
+        using Slave = std::function<void(uint8_t const * tx, uint8_t * rx, size_t numBytes)>;
+
+        /** Attaches the simulated device to the bus, or detaches it if nullptr. The device gets all transfers regardless of the chip select. 
+         */
+        static void attachSlave(Slave * slave) { slave_ = slave; }
+
+        /** Called after each transfer that receives data with the received bytes. Used by the RCKid driver to record traces. 
+         */
+        using Observer = void (*)(uint8_t const * rx, size_t numBytes);
+
+        static void setObserver(Observer observer) { observer_ = observer; }
 
-        static size_t transfer(uint8_t const * tx, uint8_t * rx, size_t numBytes) { return 0; }
+    private:
 
-        static void send(uint8_t const * data, size_t size) {}
+        static inline std::atomic<Slave *> slave_{nullptr};
+        static inline std::atomic<Observer> observer_{nullptr};
 
-        static void receive(uint8_t * data, size_t size) {}
     }; // spi
 
 } // namespace platform
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+
 #include "platform/platform.h"
 
 namespace platform { 
@@ -45,6 +47,8 @@ namespace platform {
         MPU6050(uint8_t address = 0x68):
             I2CDevice{address} {
         }
+
+        using I2CDevice::address;
         
         /** Returns the contents of the WHO_AM_I register. 
          
@@ -84,18 +88,130 @@ namespace platform {
             uint8_t cmd[] = { CMD_READ_TEMP };
             uint8_t buffer[2];
             i2c::transmit(address, cmd, 1, buffer, sizeof(buffer));
+            return temp(buffer);
+        }
+
+        /** Starts storing the acceleration samples, optionally followed by the angular velocity, in the on-chip FIFO at given sample rate (4..1000Hz). 
+
+            The digital low pass filter is set to 44Hz, which makes the internal rate 1kHz and filters out the noise above what a sample rate of 100Hz and more can capture. The gyroscope's range is set to 1000 degrees per second (GYRO_LSB_PER_DPS) so that it does not saturate when the device is shaken. The FIFO holds FIFO_SIZE bytes, i.e. 850ms of acceleration at 200Hz, or 425ms with the gyroscope, so that the samples can be read in bursts and a delayed read loses nothing. 
+         */
+        void enableFifo(unsigned sampleRate, bool gyro = false) {
+            writeRegister<uint8_t>(REG_CONFIG, DLPF_44HZ);
+            writeRegister<uint8_t>(REG_SMPLRT_DIV, static_cast<uint8_t>(1000 / std::clamp(sampleRate, 4u, 1000u) - 1));
+            writeRegister<uint8_t>(REG_GYRO_CONFIG, GYRO_FS_1000);
+            writeRegister<uint8_t>(REG_FIFO_EN, gyro ? FIFO_EN_ACCEL | FIFO_EN_GYRO : FIFO_EN_ACCEL);
+            writeRegister<uint8_t>(REG_PWR_MGMT_2, gyro ? 0 : STBY_GYRO);
+            fifoSampleSize_ = gyro ? FIFO_SAMPLE_SIZE + GYRO_SIZE : FIFO_SAMPLE_SIZE;
+            resetFifo();
+        }
+
+        /** Size of a sample stored in the FIFO, i.e. FIFO_SAMPLE_SIZE for acceleration only, or with the angular velocity following at GYRO_OFFSET. 
+         */
+        uint8_t fifoSampleSize() const { return fifoSampleSize_; }
+
+        /** Stops storing the samples in the FIFO and puts the gyroscope, which draws most of the sensor's power, in standby. 
+         */
+        void disableFifo() {
+            writeRegister<uint8_t>(REG_FIFO_EN, 0);
+            writeRegister<uint8_t>(REG_USER_CTRL, 0);
+            writeRegister<uint8_t>(REG_PWR_MGMT_2, STBY_GYRO);
+        }
+
+        /** Clears the FIFO and keeps it enabled. Must be done after the FIFO overflows as the FIFO size is not a multiple of the sample size and the samples would no longer be aligned. 
+         */
+        void resetFifo() {
+            i2c::transmit(address, CMD_FIFO_RESET, sizeof(CMD_FIFO_RESET), nullptr, 0);
+        }
+
+        /** Enables, or disables the data ready interrupt on the INT pin, which is then pulsed high for 50us each time a new sample is available. 
+         */
+        void enableDataReadyInterrupt(bool enable = true) {
+            writeRegister<uint8_t>(REG_INT_PIN_CFG, 0);
+            writeRegister<uint8_t>(REG_INT_ENABLE, enable ? INT_DATA_RDY : 0);
+        }
+
+        /** Returns the number of bytes in the FIFO. 
+         */
+        uint16_t fifoCount() {
+            uint8_t cmd[] = { REG_FIFO_COUNT };
+            uint8_t buffer[2] = { 0, 0 };
+            i2c::transmit(address, cmd, 1, buffer, sizeof(buffer));
+            return fifoCount(buffer);
+        }
+
+        /** Reads up to max samples from the FIFO and returns the number of samples read. The angular velocity is only stored if enabled in the FIFO and gyro is not null. 
+         */
+        size_t readFifo(AccelData * accel, AccelData * gyro, size_t max) {
+            size_t n = std::min<size_t>({static_cast<size_t>(fifoCount() / fifoSampleSize_), max, 255u / fifoSampleSize_});
+            if (n == 0)
+                return 0;
+            uint8_t cmd[] = { REG_FIFO_DATA };
+            uint8_t buffer[255];
+            i2c::transmit(address, cmd, 1, buffer, static_cast<uint8_t>(n * fifoSampleSize_));
+            for (size_t i = 0; i < n; ++i) {
+                uint8_t const * sample = buffer + i * fifoSampleSize_;
+                accel[i] = AccelData{sample};
+                if (gyro != nullptr && fifoSampleSize_ > FIFO_SAMPLE_SIZE)
+                    gyro[i] = AccelData{sample + GYRO_OFFSET};
+            }
+            return n;
+        }
+
+        /** Registers and sizes for the asynchronous FIFO reads: the two bytes of FIFO count (big endian) at REG_FIFO_COUNT and the samples of fifoSampleSize() bytes each read from REG_FIFO_DATA, the acceleration first and the angular velocity, if enabled, at GYRO_OFFSET. Only the samples already counted should be read as a sample stored while reading from an almost empty FIFO would break the alignment. CMD_FIFO_RESET is the write that resets the FIFO, and the temperature can be read from REG_TEMP. 
+         */
+        static constexpr uint8_t REG_FIFO_COUNT = 0x72;
+        static constexpr uint8_t REG_FIFO_DATA = 0x74;
+        static constexpr uint8_t FIFO_SAMPLE_SIZE = 6;
+        static constexpr uint8_t GYRO_OFFSET = 6;
+        static constexpr uint8_t GYRO_SIZE = 6;
+        static constexpr uint16_t FIFO_SIZE = 1024;
+        static constexpr uint8_t CMD_FIFO_RESET[] = { 0x6a, 0x44 };
+        static constexpr uint8_t REG_TEMP = 0x41;
+
+        /** Scale of the raw values, the acceleration has the default range of 2g, the angular velocity the range set by enableFifo(). 
+         */
+        static constexpr float ACCEL_LSB_PER_G = 16384.0f;
+        static constexpr float GYRO_LSB_PER_DPS = 32.8f;
+
+        static uint16_t fifoCount(uint8_t const * buffer) { return static_cast<uint16_t>((buffer[0] << 8) | buffer[1]); }
+
+        /** Decodes the acceleration from the 6 bytes read from the acceleration registers.
+         */
+        static AccelData accelData(uint8_t const * buffer) { return AccelData{buffer}; }
+
+        /** Decodes the temperature from the 2 bytes read from the temperature registers.
+         */
+        static int16_t temp(uint8_t const * buffer) {
             int16_t result = (buffer[0] << 8) | buffer[1];
             // from the datasheet this is TEMP_OUT / 340 + 36.53, we do not in tenths of degree only
             return result / 34 + 365;
         }
 
     private:
+        static constexpr uint8_t REG_SMPLRT_DIV = 0x19;
+        static constexpr uint8_t REG_CONFIG = 0x1a;
+        static constexpr uint8_t REG_GYRO_CONFIG = 0x1b;
+        static constexpr uint8_t REG_FIFO_EN = 0x23;
+        static constexpr uint8_t REG_INT_PIN_CFG = 0x37;
+        static constexpr uint8_t REG_INT_ENABLE = 0x38;
+        static constexpr uint8_t REG_USER_CTRL = 0x6a;
+        static constexpr uint8_t REG_PWR_MGMT_2 = 0x6c;
+
+        static constexpr uint8_t DLPF_44HZ = 3;
+        static constexpr uint8_t GYRO_FS_1000 = 0x10;
+        static constexpr uint8_t FIFO_EN_ACCEL = 0x08;
+        static constexpr uint8_t FIFO_EN_GYRO = 0x70;
+        static constexpr uint8_t INT_DATA_RDY = 0x01;
+        static constexpr uint8_t STBY_GYRO = 0x07;
+
         static constexpr uint8_t CMD_READ_ACCEL = 0x3b;
         static constexpr uint8_t CMD_READ_TEMP = 0x41;
         static constexpr uint8_t CMD_READ_GYRO = 0x43;
         static constexpr uint8_t CMD_RESET = 0x6b;
         static constexpr uint8_t REG_WHO_AM_I = 0x75;
 
+        uint8_t fifoSampleSize_ = FIFO_SAMPLE_SIZE;
+
     }; 
 
 } // namespace platform
\ No newline at end of file
@@ -108,8 +108,7 @@ namespace platform {
         bool initialize(char const * rxAddr, char const * txAddr, uint8_t ch = 86) {
             gpio::output(RXTX);
             gpio::low(RXTX);
-            gpio::output(CS);
-            gpio::high(CS);
+            spi::initializeDevice(CS);
             // set channel and rx & tx addresses
             setChannel(ch);
             setTxAddress(txAddr);
@@ -133,8 +132,7 @@ namespace platform {
         bool initializeESB(char const * rxAddr, char const * txAddr, uint8_t ch = 86) {
             gpio::output(RXTX);
             gpio::low(RXTX);
-            gpio::output(CS);
-            gpio::high(CS);
+            spi::initializeDevice(CS);
             // set channel and rx & tx addresses
             setChannel(ch);
             setTxAddress(txAddr);
@@ -214,11 +212,8 @@ namespace platform {
         }
 
         Status clearIrq() {
-            begin();
-            Status status = spi::transfer(WRITEREGISTER | STATUS);
-            spi::transfer(STATUS_MAX_RT | STATUS_RX_DR | STATUS_TX_DS); // clear the IRQs
-            end();
-            return status;
+            uint8_t value = STATUS_MAX_RT | STATUS_RX_DR | STATUS_TX_DS; // clear the IRQs
+            return command(WRITEREGISTER | STATUS, & value, nullptr, 1);
         }
 
 
@@ -227,28 +222,48 @@ namespace platform {
             Returns true if there are more packets ready in the rx fifo, false when no more data is available. 
         */
         bool clearDataReadyIrq() {
-            begin();
-            Status status = spi::transfer(WRITEREGISTER | STATUS);
-            spi::transfer(STATUS_RX_DR); // clear the IRQ
-            end();
-            return status.rxDataReady();
+            uint8_t value = STATUS_RX_DR; // clear the IRQ
+            return command(WRITEREGISTER | STATUS, & value, nullptr, 1).rxDataReady();
         }
 
         /** Receives a message. 
          
-            Receives a message. Returns true if the message has been stored in the buffer, false if there was no message ready on the chip. 
+            Receives a message. Returns true if the message has been stored in the buffer, false if there was no message ready on the chip. The payload is read regardless, the status clocked out with the command tells whether it was valid. 
         */
         bool receive(uint8_t * buffer, size_t payloadSize) {
-            begin();
-            Status status = spi::transfer(R_RX_PAYLOAD);
-            if (!status.rxDataReady()) {
-                end();
+            uint8_t rx[MAX_COMMAND_SIZE];
+            Status status = command(R_RX_PAYLOAD, nullptr, rx, payloadSize);
+            if (!status.rxDataReady())
                 return false;
-            } else {
-                spi::receive(buffer, payloadSize);
-                end();
-                return true;
-            }
+            memcpy(buffer, rx, payloadSize);
+            return true;
+        }
+
+        /** Result of the batched receive. 
+         */
+        struct Received {
+            /** Status register at the beginning of the batch, i.e. with the IRQ flags before they were cleared. */
+            Status status;
+            /** True if a message has been stored in the buffer. */
+            bool valid;
+            /** True if there are more messages in the rx fifo. */
+            bool more;
+        }; // Received
+
+        /** Clears all IRQs, receives a message and checks the rx fifo for more in a single SPI transaction. 
+         
+            This is the interrupt handler's sequence. Where the platform supports it (RPi), the three commands are a single ioctl instead of one per command. If more messages are ready, they should be read by receiveNext(). 
+         */
+        Received clearIrqAndReceive(uint8_t * buffer, size_t payloadSize) {
+            uint8_t clear[] = { WRITEREGISTER | STATUS, STATUS_MAX_RT | STATUS_RX_DR | STATUS_TX_DS };
+            uint8_t status[2];
+            return receiveBatch(clear, status, buffer, payloadSize);
+        }
+
+        /** Receives a message and checks the rx fifo for more in a single SPI transaction. 
+         */
+        Received receiveNext(uint8_t * buffer, size_t payloadSize) {
+            return receiveBatch(nullptr, nullptr, buffer, payloadSize);
         }
 
         /** Uploads the given message to the tx fifo. 
@@ -258,65 +273,42 @@ namespace platform {
             Note that calling this actually does not transmit the message. To do so, the startTransmitter() method must be called when the tx fifo is filled with messages to be sent. 
         */
         bool transmit(uint8_t const * buffer, size_t payloadSize) {
-            begin();
-            Status status = spi::transfer(W_TX_PAYLOAD);
-            if (status.txFifoFull()) {
-                end();
-                return false;
-            } else {
-                spi::send(buffer, payloadSize);
-                end();
-                return true;
-            }
+            // the chip ignores the payload when the fifo is full, which the status clocked out with the command tells
+            return !command(W_TX_PAYLOAD, buffer, nullptr, payloadSize).txFifoFull();
         }
 
         /** Uploads a message that should not be acked to the tx fifo. Otherwise works exactly as the transmit() method. 
          */
         bool transmitNoAck(uint8_t const * buffer, size_t payloadSize) {
-            begin();
-            Status status = spi::transfer(W_TX_PAYLOAD_NO_ACK);
-            if (status.txFifoFull()) {
-                end();
-                return false;
-            } else {
-                spi::send(buffer, payloadSize);
-                end();
-                return true;
-            }
+            return !command(W_TX_PAYLOAD_NO_ACK, buffer, nullptr, payloadSize).txFifoFull();
         }
 
         /** Clears the TX irqs (failure or sent). 
          */
         Status clearTxIrqs() {
-            begin();
-            Status status = spi::transfer(WRITEREGISTER | STATUS);
+            Status status = getStatus();
             uint8_t response = status & (STATUS_TX_DS | STATUS_MAX_RT);
             if (response != 0)
-                spi::transfer(response);
-            end();
+                writeRegister(STATUS, response);
             return status;
         }
 
         /** Checks the last transmission and returns its status.
          */
         TxStatus checkTransmitIrq(bool stopOnFailure = true) {
-            begin();
-            Status status = spi::transfer(WRITEREGISTER | STATUS);
+            Status status = getStatus();
             TxStatus result = TxStatus::InProgress;
             if (status.txDataSentIrq())
                 result = TxStatus::Ok;
             if (status.txDataFailIrq()) {
                 result = TxStatus::Fail;
                 if (stopOnFailure) {
-                    end();
                     standby();
                     return result;
                 }
             }
-            if (result != TxStatus::InProgress) {
-                spi::transfer(status); // this clears all IRQs
-            }
-            end();
+            if (result != TxStatus::InProgress)
+                writeRegister(STATUS, status); // this clears all IRQs
             return result;
         }
 
@@ -356,6 +348,30 @@ namespace platform {
             writeRegister(RF_CH, value);
         }
 
+        /** Number of channels, 1MHz apart from 2.400GHz. 
+         */
+        static constexpr uint8_t NUM_CHANNELS = 126;
+
+        /** Time the receiver needs after being enabled before the received power detector is valid (130us to settle and 40us for the AGC). 
+         */
+        static constexpr unsigned RPD_SETTLE_US = 170;
+
+        /** Returns true if a signal stronger than -64dBm has been received on the current channel. 
+         
+            The detector is only valid in receiver mode and RPD_SETTLE_US after the receiver was enabled. The original NRF24L01 has the carrier detect in the same register instead, which is good enough for a channel survey. 
+         */
+        bool receivedPowerDetected() {
+            return readRegister(RPD) & 1;
+        }
+
+        /** Switches the enabled receiver to the given channel. The received power detector is valid again after RPD_SETTLE_US. 
+         */
+        void tuneReceiver(uint8_t channel) {
+            gpio::low(RXTX);
+            setChannel(channel);
+            gpio::high(RXTX);
+        }
+
         /** Payload size. 
          */
         uint8_t payloadSize() {
@@ -372,37 +388,22 @@ namespace platform {
         */
 
         void txAddress(char * addr) {
-            begin();
-            spi::transfer(READREGISTER + TX_ADDR);
-            spi::receive(reinterpret_cast<uint8_t*>(addr), 5);
-            end();
+            command(READREGISTER | TX_ADDR, nullptr, reinterpret_cast<uint8_t*>(addr), 5);
         }
 
         void setTxAddress(const char * addr) {
-            begin();
-            spi::transfer(WRITEREGISTER | RX_ADDR_P0);
-            spi::send(reinterpret_cast<uint8_t const*>(addr), 5);
-            end();
-            begin();
-            spi::transfer(WRITEREGISTER | TX_ADDR);
-            spi::send(reinterpret_cast<uint8_t const*>(addr), 5);
-            end();
+            command(WRITEREGISTER | RX_ADDR_P0, reinterpret_cast<uint8_t const*>(addr), nullptr, 5);
+            command(WRITEREGISTER | TX_ADDR, reinterpret_cast<uint8_t const*>(addr), nullptr, 5);
         }
 
         /** Receiving address.
          */
         void rxAddress(char * addr) {
-            begin();
-            spi::transfer(READREGISTER | RX_ADDR_P1);
-            spi::receive(reinterpret_cast<uint8_t*>(addr), 5);
-            end();
+            command(READREGISTER | RX_ADDR_P1, nullptr, reinterpret_cast<uint8_t*>(addr), 5);
         }
 
         void setRxAddress(const char * addr) {
-            begin();
-            spi::transfer(WRITEREGISTER | RX_ADDR_P1);
-            spi::send(reinterpret_cast<uint8_t const*>(addr), 5);
-            end();
+            command(WRITEREGISTER | RX_ADDR_P1, reinterpret_cast<uint8_t const*>(addr), nullptr, 5);
         }
 
 
@@ -410,31 +411,61 @@ namespace platform {
 
     //private:
 
-        void begin() {
-            spi::begin(CS);
-            cpu::delayUs(2);
-        }
+        /** Longest command, i.e. the command byte and a full payload. 
+         */
+        static constexpr size_t MAX_COMMAND_SIZE = 33;
 
-        void end() {
-            spi::end(CS);
-            cpu::delayUs(2);
+        /** Sends the command followed by size bytes (zeros if tx is nullptr) as a single transfer and returns the status clocked out with the command. The bytes received after the status are stored in rx, unless nullptr. 
+         
+            All commands go through spi::transfer() so that each of them is delimited by the chip select on its own, which allows the RPi to batch them in a single ioctl where the kernel drives the chip select. If the transfer fails, the status reports no interrupts and an empty rx fifo, and rx is not touched. 
+         */
+        Status command(uint8_t cmd, uint8_t const * tx, uint8_t * rx, size_t size) {
+            uint8_t txBuf[MAX_COMMAND_SIZE];
+            uint8_t rxBuf[MAX_COMMAND_SIZE];
+            txBuf[0] = cmd;
+            if (tx != nullptr)
+                memcpy(txBuf + 1, tx, size);
+            else
+                memset(txBuf + 1, 0, size);
+            spi::Transfer t{txBuf, rxBuf, size + 1};
+            if (!spi::transfer(CS, & t, 1))
+                return Status{STATUS_RX_EMPTY};
+            if (rx != nullptr)
+                memcpy(rx, rxBuf + 1, size);
+            return rxBuf[0];
         }
 
-
         uint8_t readRegister(uint8_t reg) {
-            begin();
-            spi::transfer(READREGISTER | reg);
-            uint8_t result = spi::transfer(0);
-            end();
+            uint8_t result;
+            command(READREGISTER | reg, nullptr, & result, 1);
             return result;
         }
         
         void writeRegister(uint8_t reg, uint8_t value) {
             //printf("Writing register %u, value %u\n", reg, value);
-            begin();
-            spi::transfer(WRITEREGISTER | reg);
-            spi::transfer(value);
-            end();
+            command(WRITEREGISTER | reg, & value, nullptr, 1);
+        }
+
+        /** Optionally sends the clear command (2 bytes, receiving the status to clear), then reads a payload and the fifo status, all in a single spi::transfer() call. Nothing is received if the transfer fails. 
+         */
+        Received receiveBatch(uint8_t const * clear, uint8_t * clearRx, uint8_t * buffer, size_t payloadSize) {
+            uint8_t txBuf[MAX_COMMAND_SIZE] = { R_RX_PAYLOAD };
+            uint8_t rxBuf[MAX_COMMAND_SIZE];
+            uint8_t fifoTx[] = { READREGISTER | FIFO_STATUS, 0 };
+            uint8_t fifoRx[2];
+            spi::Transfer t[] = {
+                { clear, clearRx, 2 },
+                { txBuf, rxBuf, payloadSize + 1 },
+                { fifoTx, fifoRx, 2 },
+            };
+            if (!(clear != nullptr ? spi::transfer(CS, t, 3) : spi::transfer(CS, t + 1, 2)))
+                return Received{Status{STATUS_RX_EMPTY}, false, false};
+            Status payloadStatus{rxBuf[0]};
+            Received result{clear != nullptr ? Status{clearRx[0]} : payloadStatus, payloadStatus.rxDataReady(), false};
+            if (result.valid)
+                memcpy(buffer, rxBuf + 1, payloadSize);
+            result.more = ! FifoStatus{fifoRx[1]}.rxEmpty();
+            return result;
         }
 
         void initializeEnhancedShockBurst() {
@@ -457,17 +488,13 @@ namespace platform {
         /** Flushes the trasmitter's buffer. 
          */
         void flushTx() {
-            begin();
-            spi::transfer(FLUSH_TX);
-            end();
+            command(FLUSH_TX, nullptr, nullptr, 0);
         }
         
         /** Flushes the receiver's buffer. 
          */
         void flushRx() {
-            begin();
-            spi::transfer(FLUSH_RX);
-            end();
+            command(FLUSH_RX, nullptr, nullptr, 0);
         }
 
 
@@ -111,6 +111,13 @@ namespace platform {
             bi_decl(bi_3pins_with_func(miso, mosi, sck, GPIO_FUNC_SPI));        
         }
 
+        /** Sets up the device's chip select pin and deselects the device. 
+         */
+        static void initializeDevice(Device device) {
+            gpio::output(device);
+            gpio::high(device);
+        }
+
         static void begin(Device device) {
     //        asm volatile("nop \n nop \n nop");
             gpio::low(device);
@@ -143,6 +150,30 @@ namespace platform {
                 *(data++) = transfer(0);
         }
 
+        /** A single command to the device, i.e. the bytes sent and received while the chip select is active. Either buffer can be nullptr. 
+         */
+        struct Transfer {
+            uint8_t const * tx;
+            uint8_t * rx;
+            size_t size;
+        };
+
+        /** Executes the transfers one after another, each of them delimited by the chip select. 
+         */
+        static bool transfer(Device device, Transfer const * transfers, size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                Transfer const & t = transfers[i];
+                begin(device);
+                for (size_t j = 0; j < t.size; ++j) {
+                    uint8_t x = transfer(t.tx == nullptr ? 0 : t.tx[j]);
+                    if (t.rx != nullptr)
+                        t.rx[j] = x;
+                }
+                end(device);
+            }
+            return true;
+        }
+
     }; // spi
 
     class pio {
@@ -1,11 +1,15 @@
 #pragma once
 #include <cstdint>
 #include <cstring>
+#include <algorithm>
+#include <string>
+#include <fstream>
 #include <wiringPi.h>
 #include <wiringPiI2C.h>
 #include <wiringPiSPI.h>
 #include <thread>
 #include <chrono>
+#include <atomic>
 #include <unistd.h>
 #include <fcntl.h>
 #include <linux/i2c-dev.h>
@@ -82,6 +86,68 @@ namespace platform {
         static void attachInterrupt(Pin pin, Edge edge, void(*handler)()) {
             wiringPiISR(pin, (int) edge, handler);
         } 
+
+        /** Configures the pin to generate interrupts on given edge and returns a file descriptor that can be polled for them (POLLPRI, or EPOLLPRI), or -1 if the interrupt can't be configured. 
+         
+            This is what wiringPi's ISRs do internally, but without spawning a thread for each pin so that the interrupts can be waited for together with other file descriptors. After each interrupt, clearInterrupt() must be called on the descriptor. 
+         */
+        static int interruptFd(Pin pin, Edge edge) {
+            std::string gpio{std::to_string(sysfsBase() + pin)};
+            // exporting an already exported pin fails, which is fine
+            writeSysfs("/sys/class/gpio/export", gpio);
+            std::string path{"/sys/class/gpio/gpio" + gpio};
+            char const * edgeStr = edge == Edge::Rising ? "rising" : (edge == Edge::Falling ? "falling" : "both");
+            // udev may need some time to set the permissions of the freshly exported pin
+            for (int i = 0; i < 10; ++i) {
+                if (writeSysfs(path + "/edge", edgeStr)) {
+                    int fd = open((path + "/value").c_str(), O_RDONLY | O_CLOEXEC);
+                    if (fd >= 0) {
+                        clearInterrupt(fd);
+                        return fd;
+                    }
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            return -1;
+        }
+
+        /** Clears the interrupt on a descriptor obtained from interruptFd() and returns the current value of the pin. 
+         */
+        static bool clearInterrupt(int fd) {
+            char c = '0';
+            lseek(fd, 0, SEEK_SET);
+            ::read(fd, & c, 1);
+            return c == '1';
+        }
+
+    private:
+
+        static bool writeSysfs(std::string const & path, std::string const & value) {
+            int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+            if (fd < 0)
+                return false;
+            bool result = write(fd, value.c_str(), value.size()) == static_cast<ssize_t>(value.size());
+            close(fd);
+            return result;
+        }
+
+        /** Newer kernels no longer number the sysfs gpios from 0, so find the first gpio of the SoC's gpio chip. 
+         */
+        static unsigned sysfsBase() {
+            static int base = -1;
+            if (base < 0) {
+                base = 0;
+                for (int i = 0; i < 1024; i += 32) {
+                    std::ifstream label{"/sys/class/gpio/gpiochip" + std::to_string(i) + "/label"};
+                    std::string l;
+                    if (label >> l && l.find("pinctrl-bcm") == 0) {
+                        base = i;
+                        break;
+                    }
+                }
+            }
+            return static_cast<unsigned>(base);
+        }
     }; // gpio
 
     // https://stackoverflow.com/questions/75246900/sending-i2c-command-from-c-application
@@ -100,33 +166,63 @@ namespace platform {
 
         // static void initializeSlave(uint8_t address_) {}
 
+        /** A write followed by a read from the same device, either of which can be empty. 
+         */
+        struct Transfer {
+            uint8_t address;
+            uint8_t const * wb;
+            uint8_t wsize;
+            uint8_t * rb;
+            uint8_t rsize;
+        };
+
+        /** Maximum number of transfers in a single transmit call. Each transfer takes up to two of the 42 messages the kernel allows in a single I2C_RDWR ioctl. 
+         */
+        static constexpr size_t MAX_TRANSFERS = 16;
+
         static bool transmit(uint8_t address, uint8_t const * wb, uint8_t wsize, uint8_t * rb, uint8_t rsize) {
-            i2c_msg msgs[2];
+            Transfer t{address, wb, wsize, rb, rsize};
+            return transmit(& t, 1);
+        }
+
+        /** Executes the transfers in a single I2C_RDWR ioctl, i.e. separated by repeated starts with a single stop condition at the end. If any of the transfers fails, the whole transmission fails. More than MAX_TRANSFERS transfers fail without anything being transmitted. 
+         */
+        static bool transmit(Transfer const * transfers, size_t n) {
+            if (n > MAX_TRANSFERS)
+                return false;
+            i2c_msg msgs[MAX_TRANSFERS * 2];
             memset(msgs, 0, sizeof(msgs));
             unsigned nmsgs = 0;
-            if (wsize > 0) {
-                msgs[nmsgs].addr = static_cast<uint16_t>(address);
-                msgs[nmsgs].buf = const_cast<uint8_t*>(wb);
-                msgs[nmsgs].len = static_cast<uint16_t>(wsize);
-                ++nmsgs;
-            }
-            if (rsize > 0) {
-                msgs[nmsgs].addr = static_cast<uint16_t>(address);
-                msgs[nmsgs].buf = rb;
-                msgs[nmsgs].len = static_cast<uint16_t>(rsize);
-                msgs[nmsgs].flags = I2C_M_RD;
-                ++nmsgs;
-            }
-            // fake zero writes for checking if the chip exists
-            if (nmsgs == 0) {
-                msgs[nmsgs].addr = static_cast<uint16_t>(address);
-                msgs[nmsgs].len = 0;
-                ++nmsgs;
+            for (size_t i = 0; i < n; ++i) {
+                Transfer const & t = transfers[i];
+                if (t.wsize > 0) {
+                    msgs[nmsgs].addr = static_cast<uint16_t>(t.address);
+                    msgs[nmsgs].buf = const_cast<uint8_t*>(t.wb);
+                    msgs[nmsgs].len = static_cast<uint16_t>(t.wsize);
+                    ++nmsgs;
+                }
+                if (t.rsize > 0) {
+                    msgs[nmsgs].addr = static_cast<uint16_t>(t.address);
+                    msgs[nmsgs].buf = t.rb;
+                    msgs[nmsgs].len = static_cast<uint16_t>(t.rsize);
+                    msgs[nmsgs].flags = I2C_M_RD;
+                    ++nmsgs;
+                }
+                // fake zero writes for checking if the chip exists
+                if (t.wsize == 0 && t.rsize == 0) {
+                    msgs[nmsgs].addr = static_cast<uint16_t>(t.address);
+                    msgs[nmsgs].len = 0;
+                    ++nmsgs;
+                }
             }
             i2c_rdwr_ioctl_data wrapper = {
                 .msgs = msgs,
                 .nmsgs = nmsgs};
-            return ioctl(handle_, I2C_RDWR, &wrapper) >= 0;
+            bool result = ioctl(handle_, I2C_RDWR, &wrapper) >= 0;
+            if (Observer o = observer_)
+                for (size_t i = 0; i < n; ++i)
+                    o(transfers[i].address, transfers[i].rb, transfers[i].rsize, result);
+            return result;
             /* // old code with pigpio
             int h = i2cOpen(1, address, 0);
             if (h < 0)
@@ -145,8 +241,16 @@ namespace platform {
             */
         }
 
+        /** Called after each transaction with the bytes read and its result. Used by the RCKid driver to record traces. 
+         */
+        using Observer = void (*)(uint8_t address, uint8_t const * rb, uint8_t rsize, bool result);
+
+        static void setObserver(Observer observer) { observer_ = observer; }
+
         static inline int handle_ = -1; 
 
+        static inline std::atomic<Observer> observer_{nullptr};
+
     }; // i2c
 
 
@@ -157,29 +261,33 @@ namespace platform {
 
         using Device = gpio::Pin;
 
+        /** Opens and configures the spidev device. The device stays open for the lifetime of the program so that the transfers do not pay for the open, configuration and close syscalls each time. 
+         */
         static bool initialize(unsigned baudrate = 5000000) {
             baudrate_ = baudrate;
-            handle_ = open("/dev/spidev1.0", O_RDWR);
-            if (handle_ >= 0) {
-                close(handle_);
-                return true;
-            } else {
+            if (handle_ < 0)
+                handle_ = open("/dev/spidev1.0", O_RDWR);
+            if (handle_ < 0)
                 return false;
-            }
-        }
-
-        /** Starts the transmission to given device. 
-         */
-        static void begin(Device device) {
-            handle_ = open("/dev/spidev1.0", O_RDWR);
             int mode = SPI_MODE_0;
             uint8_t bpw = 8;
-
-
             ioctl(handle_, SPI_IOC_WR_MODE, & mode);
             ioctl(handle_, SPI_IOC_WR_BITS_PER_WORD, & bpw);
             ioctl(handle_, SPI_IOC_WR_MAX_SPEED_HZ, & baudrate_);
+            return true;
+        }
+
+        /** Sets up the device's chip select pin. 
+         
+            Does nothing for the device on the spidev's own chip select (GPIO16, see sd/config.txt), which belongs to the kernel. The pins of other devices are set up by begin(). 
+         */
+        static void initializeDevice(Device device) {}
 
+        /** Starts the transmission to given device. 
+         
+            The chip select is driven manually, which is only meant for devices other than the one on the spidev's own chip select (GPIO16, see sd/config.txt). The kernel toggles that one with each ioctl, so its device must use the batched transfer() below. 
+         */
+        static void begin(Device device) {
             gpio::output(device);
             gpio::low(device);
 
@@ -193,7 +301,6 @@ namespace platform {
          */
         static void end(Device device) {
             gpio::high(device);
-            close(handle_);
             /*
             spiClose(handle_);
             gpio::high(device);
@@ -223,6 +330,9 @@ namespace platform {
             spi.speed_hz = baudrate_;
             spi.bits_per_word = 8;
             ioctl(handle_, SPI_IOC_MESSAGE(1), &spi);
+            if (rx != nullptr)
+                if (Observer o = observer_)
+                    o(rx, numBytes);
             return numBytes;
             /*
             spiXfer(handle_, reinterpret_cast<char*>(const_cast<uint8_t*>(tx)), reinterpret_cast<char*>(rx), numBytes);
@@ -243,6 +353,51 @@ namespace platform {
             //spiRead(handle_, reinterpret_cast<char*>(data), size);
         }
 
+        /** A single command to the device, i.e. the bytes sent and received while the chip select is active. Either buffer can be nullptr. 
+         */
+        struct Transfer {
+            uint8_t const * tx;
+            uint8_t * rx;
+            size_t size;
+        };
+
+        /** Maximum number of transfers executed by a single call. 
+         */
+        static constexpr size_t MAX_TRANSFERS = 8;
+
+        /** Executes the transfers in a single SPI_IOC_MESSAGE ioctl. 
+         
+            The kernel asserts the chip select for each transfer and releases it between them (cs_change), so the device must be the one on the spidev's chip select and the device argument is only for the API's sake. Returns false if the ioctl failed, or if there are more than MAX_TRANSFERS transfers, in which case nothing is transferred. 
+         */
+        static bool transfer(Device device, Transfer const * transfers, size_t n) {
+            if (n > MAX_TRANSFERS)
+                return false;
+            spi_ioc_transfer msgs[MAX_TRANSFERS];
+            memset(msgs, 0, sizeof(spi_ioc_transfer) * n);
+            for (size_t i = 0; i < n; ++i) {
+                msgs[i].tx_buf = (unsigned long) transfers[i].tx;
+                msgs[i].rx_buf = (unsigned long) transfers[i].rx;
+                msgs[i].len = transfers[i].size;
+                msgs[i].speed_hz = baudrate_;
+                msgs[i].bits_per_word = 8;
+                // deselect the chip between the transfers, the last one is deselected by the end of the message
+                msgs[i].cs_change = (i + 1 < n) ? 1 : 0;
+            }
+            // SPI_IOC_MESSAGE(n) expands to an array type, which must have a constant size
+            bool result = ioctl(handle_, _IOC(_IOC_WRITE, SPI_IOC_MAGIC, 0, SPI_MSGSIZE(n)), msgs) >= 0;
+            if (Observer o = observer_)
+                for (size_t i = 0; i < n; ++i)
+                    if (transfers[i].rx != nullptr)
+                        o(transfers[i].rx, transfers[i].size);
+            return result;
+        }
+
+        /** Called after each transfer that receives data with the received bytes. Used by the RCKid driver to record traces. 
+         */
+        using Observer = void (*)(uint8_t const * rx, size_t numBytes);
+
+        static void setObserver(Observer observer) { observer_ = observer; }
+
 
     private:
 
@@ -254,6 +409,8 @@ namespace platform {
         static inline unsigned baudrate_;
 
         static inline int handle_ = -1; 
+
+        static inline std::atomic<Observer> observer_{nullptr};
         
     }; // spi
 
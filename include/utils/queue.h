@@ -0,0 +1,341 @@
+#pragma once
+
+#include <atomic>
+#include <algorithm>
+#include <optional>
+#include <new>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "utils.h"
+#include "tests.h"
+
+namespace utils {
+
+    /** A bounded, allocation-free, lock-free queue.
+
+        The queue is a ring of CAPACITY cells where each cell carries its own sequence number that tells producers and consumers whether the cell is free to be written, or holds a value ready to be read (the classic Vyukov design). Any number of producers and consumers can use the queue concurrently, no locks are ever taken and no memory is allocated after construction, which makes it usable from ISR threads.
+
+        When the queue is full, push() fails immediately and it is up to the caller to decide what to do with the value.
+     */
+    template<typename T, size_t CAPACITY>
+    class BoundedQueue {
+    public:
+        static_assert(CAPACITY >= 2 && (CAPACITY & (CAPACITY - 1)) == 0, "Capacity must be a power of two");
+
+        BoundedQueue() {
+            for (size_t i = 0; i < CAPACITY; ++i)
+                cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+
+        ~BoundedQueue() {
+            while (pop().has_value()) {}
+        }
+
+        BoundedQueue(BoundedQueue const &) = delete;
+        BoundedQueue & operator = (BoundedQueue const &) = delete;
+
+        static constexpr size_t capacity() { return CAPACITY; }
+
+        /** Appends the value to the queue. Returns false if the queue is full, in which case the value is left untouched.
+         */
+        bool push(T && value) {
+            Cell * c = reserve(tail_, 0);
+            if (c == nullptr)
+                return false;
+            new (c->storage) T(std::move(value));
+            c->seq.store(c->pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        /** Removes the oldest value from the queue and returns it, or returns nothing if the queue is empty.
+         */
+        std::optional<T> pop() {
+            Cell * c = reserve(head_, 1);
+            if (c == nullptr)
+                return std::nullopt;
+            T * x = reinterpret_cast<T*>(c->storage);
+            std::optional<T> result{std::move(*x)};
+            x->~T();
+            c->seq.store(c->pos + CAPACITY, std::memory_order_release);
+            return result;
+        }
+
+        /** Returns the number of values in the queue.
+
+            Only an approximation when other threads are pushing or popping at the same time.
+        */
+        size_t size() const {
+            size_t t = tail_.load(std::memory_order_relaxed);
+            size_t h = head_.load(std::memory_order_relaxed);
+            return t >= h ? t - h : 0;
+        }
+
+        bool empty() const { return size() == 0; }
+
+    private:
+
+        struct Cell {
+            std::atomic<size_t> seq;
+            // position the cell was reserved for, only valid between reserve and the seq store
+            size_t pos;
+            alignas(T) unsigned char storage[sizeof(T)];
+        };
+
+        /** Claims the next cell for either writing (offset 0, idx is tail) or reading (offset 1, idx is head). Returns nullptr if the queue is full, or empty respectively.
+         */
+        Cell * reserve(std::atomic<size_t> & idx, size_t offset) {
+            size_t pos = idx.load(std::memory_order_relaxed);
+            while (true) {
+                Cell * c = & cells_[pos & (CAPACITY - 1)];
+                size_t seq = c->seq.load(std::memory_order_acquire);
+                intptr_t d = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + offset);
+                if (d == 0) {
+                    if (idx.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        c->pos = pos;
+                        return c;
+                    }
+                } else if (d < 0) {
+                    return nullptr;
+                } else {
+                    pos = idx.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        Cell cells_[CAPACITY];
+        // producers and consumers live on different cache lines so that they do not fight over them
+        alignas(64) std::atomic<size_t> tail_{0};
+        alignas(64) std::atomic<size_t> head_{0};
+
+    }; // utils::BoundedQueue
+
+    /** A single-producer single-consumer ring of fixed slots that are written and read in place.
+
+        Where the BoundedQueue moves values in and out of its cells, here the producer reserves the next free slot, fills it directly and then commits it, and the consumer reads the oldest committed slot in place via front() and releases it with pop(). There is no copying besides what the producer writes into the slot, no locks and no allocation, which suits fixed size buffers such as radio packets. Exactly one thread may produce and exactly one thread may consume.
+
+        The producer may also discard everything that has been committed so far via clear(). The ring remembers the deepest it has been and how many reservations failed because it was full.
+     */
+    template<typename T, size_t CAPACITY>
+    class SpscRing {
+    public:
+        static_assert(CAPACITY >= 2 && (CAPACITY & (CAPACITY - 1)) == 0, "Capacity must be a power of two");
+
+        SpscRing() = default;
+
+        SpscRing(SpscRing const &) = delete;
+        SpscRing & operator = (SpscRing const &) = delete;
+
+        static constexpr size_t capacity() { return CAPACITY; }
+
+        /** Returns the next free slot for the producer to fill, or nullptr if the ring is full. The slot is not visible to the consumer until committed. Reserving again without a commit returns the same slot.
+         */
+        T * reserve() {
+            size_t t = tail_.load(std::memory_order_relaxed);
+            if (t - head_.load(std::memory_order_acquire) >= CAPACITY) {
+                overflows_.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            return & slots_[t & (CAPACITY - 1)];
+        }
+
+        /** Publishes the reserved slot to the consumer and returns the number of slots in the ring including it. 
+         */
+        size_t commit() {
+            size_t t = tail_.load(std::memory_order_relaxed) + 1;
+            tail_.store(t, std::memory_order_seq_cst);
+            size_t result = t - std::max(head_.load(std::memory_order_seq_cst), discard_.load(std::memory_order_relaxed));
+            if (result > maxSize_.load(std::memory_order_relaxed))
+                maxSize_.store(result, std::memory_order_relaxed);
+            return result;
+        }
+
+        /** Discards all committed slots. Called by the producer, the consumer drops them on its next front() call.
+         */
+        void clear() {
+            discard_.store(tail_.load(std::memory_order_relaxed), std::memory_order_release);
+        }
+
+        /** Returns the oldest committed slot, or nullptr if there is none. The slot stays valid until pop().
+         */
+        T const * front() {
+            size_t h = head_.load(std::memory_order_relaxed);
+            size_t d = discard_.load(std::memory_order_acquire);
+            if (d > h) {
+                h = d;
+                head_.store(h, std::memory_order_seq_cst);
+            }
+            if (tail_.load(std::memory_order_seq_cst) == h)
+                return nullptr;
+            return & slots_[h & (CAPACITY - 1)];
+        }
+
+        /** Releases the slot returned by front() back to the producer.
+         */
+        void pop() {
+            head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_seq_cst);
+        }
+
+        /** Number of committed slots. Only an approximation when the other thread is using the ring at the same time.
+         */
+        size_t size() const {
+            size_t t = tail_.load(std::memory_order_relaxed);
+            size_t h = std::max(head_.load(std::memory_order_relaxed), discard_.load(std::memory_order_relaxed));
+            return t >= h ? t - h : 0;
+        }
+
+        bool empty() const { return size() == 0; }
+
+        /** The largest number of committed slots seen so far. 
+         */
+        size_t maxSize() const { return maxSize_.load(std::memory_order_relaxed); }
+
+        /** Number of reservations that failed because the ring was full. 
+         */
+        size_t overflows() const { return overflows_.load(std::memory_order_relaxed); }
+
+    private:
+
+        T slots_[CAPACITY];
+        // written by the producer
+        alignas(64) std::atomic<size_t> tail_{0};
+        std::atomic<size_t> discard_{0};
+        std::atomic<size_t> maxSize_{0};
+        std::atomic<size_t> overflows_{0};
+        // written by the consumer
+        alignas(64) std::atomic<size_t> head_{0};
+
+    }; // utils::SpscRing
+
+} // namespace utils
+
+#ifdef TESTS
+
+TEST(queue, fifo) {
+    utils::BoundedQueue<int, 4> q;
+    EXPECT(q.empty());
+    EXPECT(q.push(1));
+    EXPECT(q.push(2));
+    EXPECT_EQ(q.size(), 2);
+    EXPECT_EQ(q.pop().value(), 1);
+    EXPECT(q.push(3));
+    EXPECT_EQ(q.pop().value(), 2);
+    EXPECT_EQ(q.pop().value(), 3);
+    EXPECT(! q.pop().has_value());
+}
+
+TEST(queue, full) {
+    utils::BoundedQueue<std::string, 2> q;
+    EXPECT(q.push("a"));
+    EXPECT(q.push("b"));
+    std::string c{"c"};
+    EXPECT(! q.push(std::move(c)));
+    // a failed push must leave the value intact
+    EXPECT_EQ(c, "c");
+    EXPECT_EQ(q.pop().value(), "a");
+    EXPECT(q.push(std::move(c)));
+    EXPECT_EQ(q.pop().value(), "b");
+    EXPECT_EQ(q.pop().value(), "c");
+    EXPECT(q.empty());
+}
+
+TEST(queue, multipleProducers) {
+    static constexpr int PRODUCERS = 4;
+    static constexpr int N = 10000;
+    utils::BoundedQueue<int, 64> q;
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCERS; ++p)
+        producers.emplace_back([&q, p](){
+            for (int i = 0; i < N; ++i)
+                while (! q.push(p * N + i))
+                    std::this_thread::yield();
+        });
+    // values from the same producer must arrive in order and none may be lost
+    std::vector<int> last(PRODUCERS, -1);
+    int received = 0;
+    bool ordered = true;
+    while (received < PRODUCERS * N) {
+        auto x = q.pop();
+        if (! x.has_value()) {
+            std::this_thread::yield();
+            continue;
+        }
+        int p = x.value() / N;
+        int i = x.value() % N;
+        ordered = ordered && (i == last[p] + 1);
+        last[p] = i;
+        ++received;
+    }
+    for (auto & t : producers)
+        t.join();
+    EXPECT(ordered);
+    EXPECT(q.empty());
+}
+
+TEST(queue, ringReserveCommit) {
+    utils::SpscRing<int, 4> r;
+    EXPECT(r.front() == nullptr);
+    * r.reserve() = 1;
+    // not visible until committed
+    EXPECT(r.front() == nullptr);
+    EXPECT_EQ(r.commit(), 1);
+    * r.reserve() = 2;
+    EXPECT_EQ(r.commit(), 2);
+    EXPECT_EQ(* r.front(), 1);
+    r.pop();
+    EXPECT_EQ(* r.front(), 2);
+    r.pop();
+    EXPECT(r.front() == nullptr);
+    EXPECT_EQ(r.maxSize(), 2);
+}
+
+TEST(queue, ringFullAndClear) {
+    utils::SpscRing<int, 2> r;
+    * r.reserve() = 1;
+    r.commit();
+    * r.reserve() = 2;
+    r.commit();
+    EXPECT(r.reserve() == nullptr);
+    EXPECT_EQ(r.overflows(), 1);
+    r.clear();
+    EXPECT(r.empty());
+    EXPECT(r.front() == nullptr);
+    * r.reserve() = 3;
+    r.commit();
+    EXPECT_EQ(* r.front(), 3);
+    r.pop();
+    EXPECT(r.empty());
+}
+
+TEST(queue, ringThreads) {
+    static constexpr int N = 100000;
+    utils::SpscRing<int, 16> r;
+    std::thread producer{[&r](){
+        for (int i = 0; i < N; ++i) {
+            int * x;
+            while ((x = r.reserve()) == nullptr)
+                std::this_thread::yield();
+            * x = i;
+            r.commit();
+        }
+    }};
+    // the slots must arrive in order and none may be lost
+    int expected = 0;
+    bool ordered = true;
+    while (expected < N) {
+        int const * x = r.front();
+        if (x == nullptr) {
+            std::this_thread::yield();
+            continue;
+        }
+        ordered = ordered && (* x == expected);
+        ++expected;
+        r.pop();
+    }
+    producer.join();
+    EXPECT(ordered);
+    EXPECT(r.empty());
+}
+
+#endif
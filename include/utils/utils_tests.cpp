@@ -3,6 +3,7 @@
 #include "json.h"
 #include "locks.h"
 #include "process.h"
+#include "queue.h"
 
 #ifdef TESTS
 
@@ -5,6 +5,7 @@
 
 #include "common/comms.h"
 #include "common/config.h"
+#include "common/adpcm.h"
 
 
 using namespace platform;
@@ -34,7 +35,7 @@ using namespace comms;
 
     `ADC0` is used to capture the analog controls (JOY_H, JOY_V, BTNS_1, BTNS_2), power information (VBATT, CHARGE) and internally the VCC and temperature on AVR. ADC also generates a rough estimate of a tick when all measurements are cycled though. 
 
-    `ADC1` is reserved for the microphone input at 8kHz. The ADC is left in a free running mode to accumulate as many results as possible, and `TCB0` is used to generate a precise 8kHz signal to average and capture the signal. 
+    `ADC1` is reserved for the microphone input at 8 or 16kHz. The ADC is left in a free running mode to accumulate as many results as possible, and `TCB0` is used to generate a precise 8 or 16kHz signal to average and capture the signal. 
 
     `TCA0` is used in split mode to generate PWM signals for the rumbler and screen backlight. 
 
@@ -88,6 +89,8 @@ public:
         bool btnHome : 1;
         /// Critical battery has been reached - reset by charging above certain threshold 
         bool batteryCritical : 1;
+        /// The thumbstick is streamed to the RPi (msg::SetJoyStreaming)
+        bool joyStreaming : 1;
     } flags_;
 
     //@}
@@ -153,7 +156,7 @@ public:
         RTC.PITINTCTRL |= RTC_PI_bm; // enable the interrupt
         while (RTC.PITSTATUS & RTC_CTRLBUSY_bm);
         RTC.PITCTRLA = RTC_PERIOD_CYC32768_gc | RTC_PITEN_bm;
-        // configure the TCB0 timer to 8kHz and enable it SYNCCH0 
+        // configure the TCB0 timer to 8kHz (16kHz is set when the recording starts) and enable it SYNCCH0 
         EVSYS.SYNCCH0 = EVSYS_SYNCCH0_TCB0_gc;
         TCB0.CTRLB = TCB_CNTMODE_INT_gc;
         TCB0.CCMP = 1250; // for 8kHz
@@ -197,6 +200,8 @@ public:
         setMode(Mode::PowerUp);
         // reset the uptime clock
         state_.uptime = 0;
+        // the RPi knows nothing yet
+        state_.changes.set(Changes::ALL);
     }
 
 
@@ -296,7 +301,7 @@ public:
                     state_.controls.setButtonHome(false);
                     setTimeout(0);
                 }
-                flags_.irq = true;
+                controlsChanged();
                 break;
             default:
                 // don't do anything
@@ -431,6 +436,7 @@ public:
                 // clear flags so that there are no leftovers from previous run
                 flags_.irq = false;
                 flags_.i2cReady = false;
+                flags_.joyStreaming = false;
                 // turn rpi on
                 gpio::input(RPI_EN);
                 setTimeout(BTN_HOME_POWERON_PRESS);
@@ -491,10 +497,12 @@ public:
             // in powerup mode, this indicates RPi failed to power up in time, we'll go to sleep
             case Mode::PowerUp:
                 state_.dinfo.setErrorCode(ErrorCode::RPiBootTimeout);
+                state_.changes.set(Changes::DINFO);
                 break;
             // in powerdown, this means that RPi failed to indicate safe power off in time, go to sleep
             case Mode::PowerDown:
                 state_.dinfo.setErrorCode(ErrorCode::RPiPowerDownTimeout);
+                state_.changes.set(Changes::DINFO);
                 break;
             // timeout in mode::on is HOME button long press - give RPI chance to turn itself off nicely first
             case Mode::On:
@@ -541,6 +549,8 @@ public:
 
         Master read always reads the first status byte first giving information about the most basic device state. This first byte is then followed by the bytes read from the `i2cTxAddress`. By default, this will continue reading the rest of the state, but depending on the commands and state can be redirected to other addresses such as the command buffer itself, or the audio buffer. When not in recording mode, after each master read the `i2cTxAddress` is reset to the default value sending more state.  
 
+        The default state starts with the changes mask, which tells the RPi which parts of the state (controls, extended info and debug info) have changed since it last read them. The flag of a part is cleared when its last byte is sent, so the RPi can read the mask and then only as much of the state as it needs. Changes to the controls raise the IRQ, as do the power status changes, while the extended info is left for the RPi to pick up. 
+
         When recording, the AVR will be sending the recording buffer data preceded by the state byte. However, in recording mode the mode bits of the status are used to 
      */
     //@{
@@ -553,6 +563,10 @@ public:
 
     static inline uint8_t * i2cTxAddress_ = nullptr;
     static inline uint8_t i2cNumTxBytes_ = TX_START;
+    /// The status byte sent in the current read
+    static inline uint8_t txStatus_ = 0;
+    /// Number of complete recording batches available at the beginning of the current read
+    static inline uint8_t txBatches_ = 0;
 
     /** Pulls the AVR_IRQ pin low indicating to the RPI to talk to the AVR. Cleared automatically by the I2C interrupt vector. 
      */
@@ -564,7 +578,11 @@ public:
     /** Sets the default tx address when the initial status byte is followed by the rest of the state. To do so, the tx address is set to the state's address + 1 to account for the already sent status byte.
      */
     static void setDefaultTxAddress() {
-        i2cTxAddress_ = ((uint8_t *) (& state_)) + 1;
+        i2cTxAddress_ = defaultTxAddress();
+    }
+
+    static uint8_t * defaultTxAddress() {
+        return ((uint8_t *) (& state_)) + 1;
     }
 
     /** Sets the tx address to given value meaning that next buffer read from the device will start here. 
@@ -608,7 +626,10 @@ public:
             // starts the audio recording 
             case msg::StartAudioRecording::ID: {
                 if (state_.status.mode() == Mode::On && state_.status.recording() == false)
-                    startRecording();
+                {
+                    auto & m = msg::StartAudioRecording::fromBuffer(i2cBuffer_);
+                    startRecording(m.irqBatches, m.encoding, m.sampleRate, m.bits);
+                }
                 break;
             }
             // stops the recording
@@ -681,8 +702,14 @@ public:
                 break;
             }
             case DInfoClear::ID: {
-                if (state_.dinfo.clear());
-                    rgbOff();
+                if (state_.dinfo.clear())
+                    state_.changes.set(Changes::DINFO);
+                rgbOff();
+                break;
+            }
+            case SetJoyStreaming::ID: {
+                auto & m = SetJoyStreaming::fromBuffer(i2cBuffer_);
+                flags_.joyStreaming = m.enabled;
                 break;
             }
         }
@@ -705,9 +732,15 @@ public:
         // sending data to accepting master is on our fastpath and is checked first. For the first byte we always send the status, followed by the data located at the txAddress. It is the responsibility of the master to ensure that only valid data sizes are reqested. 
         if ((status & I2C_DATA_MASK) == I2C_DATA_TX) {
             if (i2cNumTxBytes_ == TX_START)
-                TWI0.SDATA = * (uint8_t*) (& state_.status);
-            else
+                TWI0.SDATA = txStatus_;
+            else if (state_.status.recording())
+                TWI0.SDATA = recBuffer_[recTxIndex_++];
+            else {
+                // the parts whose sending starts are no longer changed for the RPi, unless written again
+                if (i2cTxAddress_ == defaultTxAddress())
+                    state_.changes.loaded(i2cNumTxBytes_ + 1);
                 TWI0.SDATA = i2cTxAddress_[i2cNumTxBytes_];
+            }
             TWI0.SCTRLB = TWI_SCMD_RESPONSE_gc;
             ++i2cNumTxBytes_;
         // a byte has been received from master. Store it and send either ACK if we can store more, or NACK if we can't store more
@@ -718,8 +751,16 @@ public:
         } else if ((status & I2C_START_MASK) == I2C_START_TX) {
             gpio::input(AVR_IRQ);
             TWI0.SCTRLB = TWI_ACKACT_ACK_gc + TWI_SCMD_RESPONSE_gc;
-            if (state_.status.recording())
-                state_.status.setBatchIncomplete((wrIndex_ >> 5) == state_.status.batchIndex());
+            // when recording, the status byte tells the number of complete batches that follow, which is fixed at the beginning of the read
+            if (state_.status.recording()) {
+                Status s = state_.status;
+                txBatches_ = availableBatches();
+                s.setBatchCount(txBatches_);
+                txStatus_ = * reinterpret_cast<uint8_t *>(& s);
+                recTxIndex_ = state_.status.batchIndex() << 5;
+            } else {
+                txStatus_ = * reinterpret_cast<uint8_t *>(& state_.status);
+            }
             // reset the num tx bytes
             i2cNumTxBytes_ = TX_START;
         // master requests to write data itself. ACK if there is no pending I2C message, NACK otherwise. The buffer is reset to 
@@ -730,13 +771,18 @@ public:
             TWI0.SCTRLB = TWI_SCMD_COMPTRANS_gc;
             if (! state_.status.recording()) {
                 setDefaultTxAddress();
-            } else if (i2cNumTxBytes_ >= 32 && !state_.status.batchIncomplete()) {
-                uint8_t nextBatch = (state_.status.batchIndex() + 1) & 7;
-                state_.status.setBatchIndex(nextBatch);
-                setTxAddress(recBuffer_ + (nextBatch << 5));
-                // if the next batch is already available, set the IRQ, otherwise it will be sent when it becomes available by the ADC reader
-                if (nextBatch != (wrIndex_ >> 5)) 
-                    setIrq();
+            // a master that stopped before any data byte was sent has read no batches (and TX_START would count as 7)
+            } else if (i2cNumTxBytes_ != TX_START) {
+                // all batches the master read in full and that were complete at the beginning of the read are done
+                uint8_t read = i2cNumTxBytes_ / 32;
+                if (read > txBatches_)
+                    read = txBatches_;
+                if (read > 0) {
+                    state_.status.setBatchIndex(state_.status.batchIndex() + read);
+                    // if enough batches are already available, set the IRQ, otherwise it will be set by the ADC reader
+                    if (availableBatches() >= irqBatches_) 
+                        setIrq();
+                }
             }
         // receiving finished, inform main loop we have message waiting if we have received at laast one byte (0 bytes received is just I2C ping)
         } else if ((status & I2C_STOP_MASK) == I2C_STOP_RX) {
@@ -766,12 +812,26 @@ public:
         - JOY_H
         - JOY_V  
 
+        When the thumbstick is streamed, JOY_V and JOY_H are also measured after each of the other measurements, accumulating only 16 samples each so that the tick is only about 50% longer, and the IRQ is raised as soon as the thumbstick moves instead of at the end of the tick. This gives the RPi close to 1000 thumbstick readings per second while it moves.
+
         `BTNS_1` and `BTNS_2` are connected to a custom voltage divider that allows us to sample multiple presses of 3 buttons using a single pin. The ladder assumes a 8k2 resistor fro VCC to common junction that is beaing read and is connected via the three buttons and three different resistors (8k2, 15k, 27k) to ground.  
      */
     //@{
 
     static inline uint8_t batteryDebounceTimer_ = 0;
 
+    /** The measurement interrupted by the streamed thumbstick (0 if none) and its ADC settings. */
+    static inline uint8_t adcResumeMuxpos_ = 0;
+    static inline uint8_t adcResumeCtrlC_ = 0;
+    static inline uint8_t adcResumeSampCtrl_ = 0;
+
+    /** Marks the controls as changed for the RPi and requests the IRQ at the end of the tick. 
+     */
+    static void controlsChanged() {
+        state_.changes.set(Changes::CONTROLS);
+        flags_.irq = true;
+    }
+
     /** Starts the measurements on ADC0. 
     */
     static void adcStart() {
@@ -784,6 +844,7 @@ public:
         ADC0.CTRLC = ADC_PRESC_DIV8_gc | ADC_REFSEL_VDDREF_gc; // | ADC_SAMPCAP_bm; // use VDD as reference for VCC sensing, 1.25MHz
         ADC0.CTRLD = ADC_INITDLY_DLY32_gc;
         ADC0.CTRLA = ADC_ENABLE_bm | ADC_RESSEL_10BIT_gc;
+        adcResumeMuxpos_ = 0;
          // start new conversion
         ADC0.COMMAND = ADC_STCONV_bm;
     }
@@ -792,8 +853,10 @@ public:
         // if ADC is not ready, return immediately without a tick
         if (! (ADC0.INTFLAGS & ADC_RESRDY_bm))
             return false;
-        uint16_t value = ADC0.RES / 64;
+        uint16_t value = (ADC0.CTRLB == ADC_SAMPNUM_ACC16_gc) ? ADC0.RES / 16 : ADC0.RES / 64;
         uint8_t muxpos = ADC0.MUXPOS;
+        // true if this is the streamed thumbstick measured in between the other measurements
+        bool interleaved = adcResumeMuxpos_ != 0;
         // do stuff depending on what the ADC was doing, first move to the next ADC read and start the conversion, then process the current one
         switch (muxpos) {
             // VCC
@@ -837,6 +900,22 @@ public:
                 ADC0.SAMPCTRL = 0;
                 break;
         }
+        // when streaming, the thumbstick is measured after each of the other measurements, then the round robin resumes where it was interrupted
+        if (interleaved && muxpos == ADC_MUXPOS_AIN9_gc) {
+            ADC0.MUXPOS = adcResumeMuxpos_;
+            ADC0.CTRLC = adcResumeCtrlC_;
+            ADC0.SAMPCTRL = adcResumeSampCtrl_;
+            ADC0.CTRLB = ADC_SAMPNUM_ACC64_gc;
+            adcResumeMuxpos_ = 0;
+        } else if (flags_.joyStreaming && muxpos != ADC_MUXPOS_AIN8_gc && muxpos != ADC_MUXPOS_AIN9_gc && ADC0.MUXPOS != ADC_MUXPOS_AIN8_gc) {
+            adcResumeMuxpos_ = ADC0.MUXPOS;
+            adcResumeCtrlC_ = ADC0.CTRLC;
+            adcResumeSampCtrl_ = ADC0.SAMPCTRL;
+            ADC0.MUXPOS = ADC_MUXPOS_AIN8_gc;
+            ADC0.CTRLC = ADC_PRESC_DIV8_gc | ADC_REFSEL_VDDREF_gc | ADC_SAMPCAP_bm;
+            ADC0.SAMPCTRL = 0;
+            ADC0.CTRLB = ADC_SAMPNUM_ACC16_gc;
+        }
         // start the next conversion
         ADC0.COMMAND = ADC_STCONV_bm;
         // process the last measurement while reading the next measurement
@@ -845,7 +924,8 @@ public:
             case ADC_MUXPOS_INTREF_gc: {
                 value = 110 * 512 / value;
                 value = value * 2;
-                state_.einfo.setVcc(value);
+                if (state_.einfo.setVcc(value))
+                    state_.changes.set(Changes::EINFO);
                 // if we have critical battery threshold go to powerdown mode immediately, set the battery critical flag
                 if (value <= BATTERY_THRESHOLD_CRITICAL && ! flags_.batteryCritical) {
                     if (batteryDebounceTimer_-- == 0) {
@@ -869,7 +949,8 @@ public:
                 t -= 69926;
                 // and now loose precision to 0.5C (x10, i.e. -15 = -1.5C)
                 value = (t >>= 7) * 5;
-                state_.einfo.setTemp(value);
+                if (state_.einfo.setTemp(value))
+                    state_.changes.set(Changes::EINFO);
                 break;
             }
             // VBATT
@@ -880,7 +961,8 @@ public:
                 // but 500 * 255 is too high to fit in uint16, so we divide VCC by 2 and then divide by 128 instead
                 value >>= 2; // go for 8bit precision, which should be enough
                 value = (state_.einfo.vcc() / 2 * value)  / 128; 
-                state_.einfo.setVBatt(value);
+                if (state_.einfo.setVBatt(value))
+                    state_.changes.set(Changes::EINFO);
                 break;
             }
             // CHARGE - sent by the charger chip via a pull-up and pull-down resistors. Only works if VUSB is present. Close to 0 means charging, close to 1 means charging complete and around 0.5 means no battery present (which we for all purposes ignore)
@@ -899,23 +981,33 @@ public:
             }
             // BTNS_1 
             case ADC_MUXPOS_AIN6_gc:
-                flags_.irq = state_.controls.setButtons1(decodeAnalogButtons((value >> 2) & 0xff)) | flags_.irq;
+                if (state_.controls.setButtons1(decodeAnalogButtons((value >> 2) & 0xff)))
+                    controlsChanged();
                 break;
             // BTNS_2 
             case ADC_MUXPOS_AIN7_gc:
-                flags_.irq = state_.controls.setButtons2(decodeAnalogButtons((value >> 2) & 0xff)) | flags_.irq;
-                flags_.irq = state_.controls.setButtonHome(gpio::read(BTN_HOME)) | flags_.irq;
+                if (state_.controls.setButtons2(decodeAnalogButtons((value >> 2) & 0xff)))
+                    controlsChanged();
+                if (state_.controls.setButtonHome(gpio::read(BTN_HOME)))
+                    controlsChanged();
                 break;
             // JOY_V 
             case ADC_MUXPOS_AIN8_gc:
                 value = adjustJoystickValue(value, pState_.joyVMin, pState_.joyVMax);
-                flags_.irq = state_.controls.setJoyV(value) | flags_.irq;
+                if (state_.controls.setJoyVFull(value, flags_.joyStreaming ? JOY_STREAM_THRESHOLD : JOY_THRESHOLD))
+                    controlsChanged();
                 break;
             // JOY_H 
             case ADC_MUXPOS_AIN9_gc:
                 value = adjustJoystickValue(value, pState_.joyHMin, pState_.joyHMax);
-                flags_.irq = state_.controls.setJoyH(value) | flags_.irq;
-                return true;
+                if (state_.controls.setJoyHFull(value, flags_.joyStreaming ? JOY_STREAM_THRESHOLD : JOY_THRESHOLD))
+                    controlsChanged();
+                // the streamed thumbstick is reported right away, other changes wait for the end of the tick
+                if (flags_.joyStreaming && flags_.irq && !state_.status.recording()) {
+                    setIrq();
+                    flags_.irq = false;
+                }
+                return !interleaved;
         }
         return false;
     }
@@ -938,28 +1030,30 @@ public:
         return 0;
     }
 
-    /** Adjusts the joystick axis value - since the joystick is powered by 3V3, but measured using the VCC, its value needs to be scaled appropriately. 
+    /** Adjusts the joystick axis value - since the joystick is powered by 3V3, but measured using the VCC, its value needs to be scaled appropriately. Returns the 10bit position. 
      */
-    static uint8_t adjustJoystickValue(uint32_t value, uint8_t min, uint8_t max) {
+    static uint16_t adjustJoystickValue(uint32_t value, uint8_t min, uint8_t max) {
         value = value * state_.einfo.vcc() / 132;
         value = (value > min * 10) ? value - min * 10 : 0;
         uint16_t scale = (max - min) * 10;
         value = (value > scale) ? scale : value;
-        value = value * 255 / scale; 
-        return value > 255 ? 255 : static_cast<uint8_t>(value);
+        value = value * 1023 / scale; 
+        return value > 1023 ? 1023 : static_cast<uint16_t>(value);
     }
 
     //@}
 
     /** \name Audio Recording
       
-        When audio recording is enabled, the ADC1 runs at 5MHz speed in 8bit mode and 32x sample accumulation. The ADC is triggered by TCB0 running at 8kHz and when its measurement is done, it is appended in a circular buffer. The buffer is divided into 8 32byte long batches. Each time there is 32 sampled bytes available, the AVR_IRQ is set informing the RPi to read the batch.  
+        When audio recording is enabled, the ADC1 runs at 5MHz speed in 8bit mode (10bit for 12bit samples) and 32x sample accumulation at 8kHz, 16x at 16kHz so that the accumulation fits in the sample period. The accumulated result is scaled to a signed 16bit sample of which only the requested number of bits is kept. The ADC is triggered by TCB0 running at the sample rate and when its measurement is done, it is appended in a circular buffer, as a single byte for 8bit samples and as two bytes (little endian) otherwise. The buffer is divided into 8 32byte long batches. Each time there is 32 sampled bytes available, the AVR_IRQ is set informing the RPi to read the batch.  
 
-        While in recording mode, when RPi starts reading, a status byte is sent first, followed by the recording buffer contents. The status byte contains a flag that the AVR is in recording mode and a batch index that will be returned. Each time a recording data is being downloaded, the status byte's incompleteBatch is set if the batch to be sent has not been finished (i.e. we are writing to it while transmitting). Such batches are to be ignored. 
+        While in recording mode, when RPi starts reading, a status byte is sent first, followed by the recording buffer contents starting at the batch index, wrapping around the buffer. The status byte contains a flag that the AVR is in recording mode, the batch index that will be returned and the number of complete batches available (0..7) at the beginning of the read, which replaces the power status bits. The RPi may read any number of them in a single burst, bytes past the complete batches are not valid and should be ignored. 0 available batches means the batch to be sent has not been finished (i.e. we are writing to it while transmitting). 
         
-        When 32 bytes after the status byte are read and the batch currently being read has been valid at the beginning of the read sequence (i.e. the whole batch was sent), the batch index is incremented. If the next batch is also available in full, the AVR_IRQ is set, otherwise it will be set when the recorder crosses the batch boundary.  
+        When the read is over, the batch index is advanced by the number of complete batches read in full. The RPi tells in the StartAudioRecording message how many batches it wants to read in one burst and the AVR_IRQ is only raised when at least that many batches are available, either immediately after the read, or when the recorder crosses the batch boundary.  
 
         The 8 batches and AVR_IRQ combined should allow enough time for the RPi to be able to read and buffer the data as needed without skipping any batches - but if a skip occurs the batch index in the status byte should be enough to detect it. 
+
+        When ADPCM encoding is requested, each batch is an IMA-ADPCM block of 61 samples instead, encoded as the samples arrive. The block header (step index and the first sample) is written with the first sample of the batch and the codes are written a byte, i.e. two samples, at a time so that a batch is complete when its last byte is written, the same as with raw samples. 
     */
     //@{
 
@@ -967,17 +1061,50 @@ public:
     static inline uint8_t recBuffer_[256];
     /// Write index to the circular buffer
     static inline volatile uint8_t wrIndex_ = 0;
+    /// Read index to the circular buffer while sending to the RPi
+    static inline uint8_t recTxIndex_ = 0;
+    /// Number of available batches at which the IRQ is raised
+    static inline uint8_t irqBatches_ = 1;
+    /// ADPCM encoder state when recording compressed audio
+    static inline adpcm::Codec adpcm_;
+    static inline bool recAdpcm_ = false;
+    /// True if the samples are stored as 16bit, shift and mask converting the accumulated ADC result to the 16bit sample of given resolution
+    static inline bool recWide_ = false;
+    static inline uint8_t recShift_ = 3;
+    static inline uint16_t recMask_ = 0xff00;
+    /// True if the low nibble of the byte at the write index has been written already
+    static inline bool recHalf_ = false;
+
+    /** Returns the number of complete batches that have not been read yet. 
+     */
+    static uint8_t availableBatches() {
+        return ((wrIndex_ >> 5) - state_.status.batchIndex()) & 7;
+    }
 
-    static void startRecording() {
+    static void startRecording(uint8_t irqBatches, AudioEncoding encoding, uint16_t sampleRate, uint8_t bits) {
+        bool fast = sampleRate > 8000;
+        bool precise = bits > 10;
+        // 10bit ADC for 12bit samples, fewer accumulated conversions at 16kHz so that they fit in the sample period
+        ADC1.CTRLA = (precise ? ADC_RESSEL_10BIT_gc : ADC_RESSEL_8BIT_gc) | ADC_ENABLE_bm;
+        ADC1.CTRLB = fast ? ADC_SAMPNUM_ACC16_gc : ADC_SAMPNUM_ACC32_gc;
+        // the accumulated value has 13 (8bit, 32x), 12 (8bit, 16x), 15 (10bit, 32x), or 14 (10bit, 16x) bits
+        recShift_ = (precise ? 1 : 3) + (fast ? 1 : 0);
+        recMask_ = ~((1 << (16 - bits)) - 1);
+        TCB0.CCMP = fast ? 625 : 1250;
         cli();
+        recWide_ = bits > 8;
         wrIndex_ = 0;
+        irqBatches_ = (irqBatches < 1) ? 1 : (irqBatches > 7) ? 7 : irqBatches;
+        recAdpcm_ = (encoding == AudioEncoding::ADPCM);
+        recHalf_ = false;
+        adpcm_.reset(128, 0);
         state_.status.setRecording(true);
         state_.status.setBatchIndex(0);
         setTxAddress(recBuffer_);
         sei();
         // connect the eventsystem 
         EVSYS.ASYNCUSER12 = EVSYS_ASYNCUSER12_SYNCCH0_gc;
-        // start the 8kHz timer on TCB0. The timer overflow will trigger ADC start
+        // start the timer on TCB0. The timer overflow will trigger ADC start
         TCB0.CTRLA |= TCB_ENABLE_bm;
     }
 
@@ -988,7 +1115,6 @@ public:
         cli();
         state_.status.setMode(Mode::On);
         state_.status.setRecording(false);
-        state_.status.setBatchIncomplete(false);
         setDefaultTxAddress();
         sei();
     }
@@ -997,9 +1123,31 @@ public:
      */
     static inline void ADC1_RESRDY_vect(void) __attribute__((always_inline)) {
         ENTER_IRQ;
-        // we are using 32x oversampling
-        recBuffer_[wrIndex_++] = (ADC1.RES / 32) & 0xff;
-        if (wrIndex_ % 32 == 0)
+        // scale the accumulated value to 16 bits and keep only the requested resolution
+        int16_t sample = static_cast<int16_t>(static_cast<uint16_t>((ADC1.RES << recShift_) - 32768) & recMask_);
+        if (!recAdpcm_) {
+            if (recWide_) {
+                recBuffer_[wrIndex_++] = sample & 0xff;
+                recBuffer_[wrIndex_++] = (sample >> 8) & 0xff;
+            } else {
+                recBuffer_[wrIndex_++] = adpcm::Codec::headerSample(sample);
+            }
+        // first sample of an ADPCM batch goes to the block header, together with the step index
+        } else if (wrIndex_ % 32 == 0) {
+            uint8_t first = adpcm::Codec::headerSample(sample);
+            recBuffer_[wrIndex_] = adpcm_.index();
+            recBuffer_[wrIndex_ + 1] = first;
+            adpcm_.reset(first, adpcm_.index());
+            wrIndex_ += 2;
+        } else if (!recHalf_) {
+            recBuffer_[wrIndex_] = adpcm_.encode(sample);
+            recHalf_ = true;
+        } else {
+            recBuffer_[wrIndex_++] |= adpcm_.encode(sample) << 4;
+            recHalf_ = false;
+        }
+        // the batch is complete when its last byte has been written (a half written byte never ends the batch)
+        if (wrIndex_ % 32 == 0 && !recHalf_ && availableBatches() >= irqBatches_)
             setIrq();
         LEAVE_IRQ;
     }
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace adpcm {
+
+    /** IMA-ADPCM codec for the 16bit signed audio samples.
+
+        The samples are encoded as 4bit codes in blocks that can be decoded independently so that a lost block does not break the rest of the stream. A block starts with the step index and the first sample in 8 bits (unsigned, 128 being 0), followed by the codes of the remaining samples, two per byte, low nibble first. The coarse first sample only costs precision until the first code of the block corrects the predictor. 
+
+        The encoder only uses the decoder's state update after choosing the code, which keeps the encoder and decoder in sync by definition. The codec is small and cheap enough to run in the AVR's ADC interrupt.
+     */
+    class Codec {
+    public:
+
+        /** Resets the codec at the beginning of a block.
+         */
+        void reset(uint8_t sample, uint8_t index) {
+            predictor_ = (static_cast<int16_t>(sample) - 128) * 256;
+            index_ = (index > 88) ? 88 : index;
+        }
+
+        uint8_t index() const { return index_; }
+
+        /** Returns the 4bit code of the sample and updates the state.
+         */
+        uint8_t encode(int16_t sample) {
+            int32_t diff = static_cast<int32_t>(sample) - predictor_;
+            uint8_t code = 0;
+            if (diff < 0) {
+                code = 8;
+                diff = -diff;
+            }
+            int32_t step = STEPS[index_];
+            if (diff >= step) {
+                code |= 4;
+                diff -= step;
+            }
+            step >>= 1;
+            if (diff >= step) {
+                code |= 2;
+                diff -= step;
+            }
+            step >>= 1;
+            if (diff >= step)
+                code |= 1;
+            decode(code);
+            return code;
+        }
+
+        /** Updates the state with the 4bit code and returns the decoded sample.
+         */
+        int16_t decode(uint8_t code) {
+            int32_t step = STEPS[index_];
+            int32_t delta = step >> 3;
+            if (code & 4)
+                delta += step;
+            if (code & 2)
+                delta += step >> 1;
+            if (code & 1)
+                delta += step >> 2;
+            int32_t p = (code & 8) ? predictor_ - delta : predictor_ + delta;
+            predictor_ = static_cast<int16_t>((p < -32768) ? -32768 : (p > 32767) ? 32767 : p);
+            int8_t index = static_cast<int8_t>(index_) + INDEX_ADJUST[code & 7];
+            index_ = (index < 0) ? 0 : (index > 88) ? 88 : index;
+            return predictor_;
+        }
+
+        /** Converts the sample to the 8bit unsigned value stored in the block header. 
+         */
+        static uint8_t headerSample(int16_t sample) {
+            return static_cast<uint8_t>((sample >> 8) + 128);
+        }
+
+    private:
+
+        static constexpr int16_t STEPS[89] = {
+            7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+            50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+            337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+            2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+            15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+        };
+
+        static constexpr int8_t INDEX_ADJUST[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+        int16_t predictor_ = 0;
+        uint8_t index_ = 0;
+
+    }; // adpcm::Codec
+
+    /** Number of samples in a block of given size in bytes.
+     */
+    constexpr unsigned samplesPerBlock(unsigned blockSize) { return (blockSize - 2) * 2 + 1; }
+
+    /** Decodes the block of given size, writing samplesPerBlock(blockSize) samples.
+     */
+    inline void decodeBlock(uint8_t const * block, unsigned blockSize, int16_t * samples) {
+        Codec c;
+        c.reset(block[1], block[0]);
+        *samples++ = (static_cast<int16_t>(block[1]) - 128) * 256;
+        for (unsigned i = 2; i < blockSize; ++i) {
+            *samples++ = c.decode(block[i] & 0xf);
+            *samples++ = c.decode(block[i] >> 4);
+        }
+    }
+
+} // namespace adpcm
@@ -4,11 +4,14 @@
     #include <iostream>
 #endif
 
+#include <stddef.h>
+
 #include "platform/platform.h"
 #include "platform/color.h"
 #include "platform/time.h"
 
 #include "config.h"
+#include "adpcm.h"
 #include "../avr-i2c-bootloader/src/bootloader_config.h"
 
 namespace comms {
@@ -41,6 +44,21 @@ namespace comms {
         USB = 192,
     }; // comms::PowerStatus
 
+    /** Encoding of the recorded audio batches. 
+     
+        Raw batches contain 32 8bit unsigned samples, or 16 16bit signed little endian samples if the resolution is more than 8 bits. ADPCM batches are IMA-ADPCM blocks (see adpcm.h) of 61 samples of any resolution, which halves the I2C traffic per second of audio (and quarters it for the higher resolutions). 
+     */
+    enum class AudioEncoding : uint8_t {
+        Raw = 0, 
+        ADPCM = 1,
+    }; // comms::AudioEncoding
+
+    /** Returns the number of samples in a recording batch of given encoding and sample resolution. 
+     */
+    constexpr unsigned samplesPerBatch(AudioEncoding encoding, uint8_t bits) {
+        return (encoding == AudioEncoding::ADPCM) ? adpcm::samplesPerBlock(32) : (bits > 8) ? 16 : 32;
+    }
+
     /** Error codes. 
      
         The extended state also contains an information about the error state the RCKid is in. While not all states are really errors (such as initial power on), they should all be inspected, reported and logged by the RPi appropriately. Depending on the error state. For some states, the RGB LED also illustrates what is going on. 
@@ -101,17 +119,27 @@ namespace comms {
             status_ |= (index & MODE);
         }
 
-        bool batchIncomplete() const {
-            return status_ & BATCH_INCOMPLETE;
+        /** In recording mode, returns the number of complete batches (0..7) that follow the status byte in the read, starting with the batch index. 
+         
+            The batch count is only sent over I2C and occupies the bits of the power status, which is not reported while recording. 
+         */
+        uint8_t batchCount() const {
+            return (status_ & BATCH_COUNT_MASK) >> 5;
         }
 
-        bool setBatchIncomplete(bool value) {
-            if (value == batchIncomplete())
-                return false;
-            value ? (status_ |= BATCH_INCOMPLETE) : (status_ &= ~BATCH_INCOMPLETE);
-            return true;
+        void setBatchCount(uint8_t count) {
+            status_ &= ~BATCH_COUNT_MASK;
+            status_ |= (count << 5) & BATCH_COUNT_MASK;
+        }
+
+        /** True if there are no complete batches to be read, i.e. the batch at the batch index is still being recorded, or if the recorder has wrapped around the whole buffer. 
+         */
+        bool batchIncomplete() const {
+            return recording() && batchCount() == 0;
         }
 
+        /** Returns the power status. Not valid in the status read from the AVR while recording, see batchCount(). 
+         */
         PowerStatus powerStatus() const { 
             return static_cast<PowerStatus>(status_ & POWER_MASK); 
         }
@@ -129,18 +157,18 @@ namespace comms {
         static constexpr uint8_t MODE = 7; // 0..7
         static constexpr uint8_t ALARM = 1 << 3; // 8
         static constexpr uint8_t RECORDING = 1 << 4; // 16
-        static constexpr uint8_t BATCH_INCOMPLETE = 1 << 5; // 32
         static constexpr uint8_t POWER_MASK = 3 << 6; // 64 + 128
+        static constexpr uint8_t BATCH_COUNT_MASK = 7 << 5; // 32 + 64 + 128, recording only
         uint8_t status_ = 0;
 
 
 #if (defined ARCH_RPI || defined ARCH_MOCK)
         friend std::ostream & operator << (std::ostream & s, Status const & status) {
             if (status.recording())
-                s << "mode : recording, batch index: " << (int)status.batchIndex();
+                s << "mode : recording, batch index: " << (int)status.batchIndex() << ", batches: " << (int)status.batchCount();
             else
                 s << "mode " << (int) status.mode();
-            s  << ", batch incomplete:" << status.batchIncomplete() << ", alarm: " << status.alarm() << ", low batt: ";
+            s  << ", alarm: " << status.alarm() << ", low batt: ";
             return s;
         }
 #endif
@@ -186,6 +214,7 @@ namespace comms {
             if (value == joyH_)
                 return false;
             joyH_ = value;
+            joyLow_ &= ~JOY_H_LOW;
             return true;
         }
 
@@ -195,12 +224,42 @@ namespace comms {
             if (value == joyV_)
                 return false;
             joyV_ = value;
+            joyLow_ &= ~JOY_V_LOW;
             return true;
         }
 
+        /** \name Full precision thumbstick
+         
+            The thumbstick position with its full 10bit precision. The 8bit values above are its most significant bits. The setters only change the position if it moved by at least threshold so that the ADC noise does not flood the RPi with changes.
+         */
+        //@{
+        uint16_t joyHFull() const { return (joyH_ << 2) | (joyLow_ & JOY_H_LOW); }
+
+        bool setJoyHFull(uint16_t value, uint16_t threshold = 1) {
+            if (!moved(joyHFull(), value, threshold))
+                return false;
+            joyH_ = value >> 2;
+            joyLow_ = (joyLow_ & ~JOY_H_LOW) | (value & JOY_H_LOW);
+            return true;
+        }
+
+        uint16_t joyVFull() const { return (joyV_ << 2) | ((joyLow_ & JOY_V_LOW) >> 2); }
+
+        bool setJoyVFull(uint16_t value, uint16_t threshold = 1) {
+            if (!moved(joyVFull(), value, threshold))
+                return false;
+            joyV_ = value >> 2;
+            joyLow_ = (joyLow_ & ~JOY_V_LOW) | ((value << 2) & JOY_V_LOW);
+            return true;
+        }
+        //@}
  
     private:
 
+        static bool moved(uint16_t from, uint16_t to, uint16_t threshold) {
+            return (from > to ? from - to : to - from) >= threshold;
+        }
+
         bool setButtonsRaw(uint8_t value, uint8_t mask) {
             uint8_t btns = (buttons_ & ~mask) | value;
             if (btns == buttons_)
@@ -214,10 +273,14 @@ namespace comms {
         static constexpr uint8_t START = 1 << 2;
         static constexpr uint8_t TRIGGER_RIGHT = 1 << 3;
         static constexpr uint8_t HOME = 1 << 4;
+        static constexpr uint8_t JOY_H_LOW = 3;
+        static constexpr uint8_t JOY_V_LOW = 3 << 2;
 
         uint8_t buttons_;
         uint8_t joyH_;
         uint8_t joyV_;
+        /** The two least significant bits of the horizontal and vertical thumbstick position. */
+        uint8_t joyLow_;
     } __attribute__((packed)); // comms::Controls 
 
     class ExtendedInfo {
@@ -230,13 +293,8 @@ namespace comms {
         //@{
         uint16_t vcc() const { return (vcc_ == 0) ? 0 : (vcc_ + 245); }
 
-        void setVcc(uint16_t vx100) {
-            if (vx100 < 250)
-                vcc_ = 0;
-            else if (vx100 >= 500)
-                vcc_ = 255;
-            else 
-                vcc_ = (vx100 - 245) & 0xff;
+        bool setVcc(uint16_t vx100) {
+            return update(vcc_, (vx100 < 250) ? 0 : (vx100 >= 500) ? 255 : ((vx100 - 245) & 0xff));
         }
         //@}
 
@@ -247,13 +305,8 @@ namespace comms {
         //@{
         uint16_t vBatt() const { return (vbatt_ == 0) ? 0 : vbatt_ + 165; }
 
-        void setVBatt(uint16_t vx100) {
-            if (vx100 >= 420)
-                vbatt_ = 255;
-            else if (vx100 < 170)
-                vbatt_ = 0;
-            else 
-                vbatt_ = (vx100 - 165) & 0xff;
+        bool setVBatt(uint16_t vx100) {
+            return update(vbatt_, (vx100 >= 420) ? 255 : (vx100 < 170) ? 0 : ((vx100 - 165) & 0xff));
         }
         //@}
 
@@ -264,30 +317,95 @@ namespace comms {
         //@{
         int16_t temp() const { return -200 + (temp_ * 5); }
 
-        void setTemp(int32_t tempx10) {
-            if (tempx10 <= -200)
-                temp_ = 0;
-            else if (tempx10 >= 1080)
-                temp_ = 255;
-            else 
-                temp_ = (tempx10 + 200) / 5;
+        bool setTemp(int32_t tempx10) {
+            return update(temp_, (tempx10 <= -200) ? 0 : (tempx10 >= 1080) ? 255 : (tempx10 + 200) / 5);
         }
         //@}
 
     private:
+
+        static bool update(uint8_t & field, uint8_t value) {
+            if (field == value)
+                return false;
+            field = value;
+            return true;
+        }
+
         uint8_t vcc_;
         uint8_t vbatt_;
         uint8_t temp_;
     } __attribute__((packed)); // comms::ExtendedInfo;
 
-    /** State consists  */
+    /** Parts of the extended state that have changed since the RPi last read them. 
+
+        The AVR sends the changes right after the status byte and clears the flag of a part when it loads its first byte for sending, so that any write to the part after that marks it changed again for the next read, and so that the RPi can read the changes first and then only read the state as far as the last changed part. The status itself is not tracked as it is sent first in every read. 
+     */
+    class Changes {
+    public:
+        static constexpr uint8_t CONTROLS = 1 << 0;
+        static constexpr uint8_t EINFO = 1 << 1;
+        static constexpr uint8_t DINFO = 1 << 2;
+        static constexpr uint8_t ALL = CONTROLS | EINFO | DINFO;
+
+        /** Offsets of the first and last bytes of the tracked parts in the extended state. */
+        static constexpr uint8_t CONTROLS_START = 2;
+        static constexpr uint8_t EINFO_START = 6;
+        static constexpr uint8_t DINFO_START = 9;
+        static constexpr uint8_t CONTROLS_END = 5;
+        static constexpr uint8_t EINFO_END = 8;
+        static constexpr uint8_t DINFO_END = 9;
+
+        bool controls() const { return raw_ & CONTROLS; }
+        bool einfo() const { return raw_ & EINFO; }
+        bool dinfo() const { return raw_ & DINFO; }
+
+        bool any() const { return raw_ != 0; }
+
+        void set(uint8_t parts) { raw_ |= parts; }
+
+        /** Clears the flag of the part whose first byte is at given offset in the extended state, if any. Called by the AVR as it loads the state's bytes for sending. 
+         */
+        void loaded(uint8_t offset) {
+            switch (offset) {
+                case CONTROLS_START:
+                    raw_ &= ~CONTROLS;
+                    break;
+                case EINFO_START:
+                    raw_ &= ~EINFO;
+                    break;
+                case DINFO_START:
+                    raw_ &= ~DINFO;
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        /** Number of bytes, including the status, the RPi has to read to get all of the changed parts. 
+         */
+        uint8_t readSize() const {
+            if (dinfo())
+                return DINFO_END + 1;
+            if (einfo())
+                return EINFO_END + 1;
+            if (controls())
+                return CONTROLS_END + 1;
+            return 2;
+        }
+
+    private:
+        uint8_t raw_ = 0;
+    } __attribute__((packed)); // comms::Changes
+
+    /** State read by the RPi when the AVR raises the IRQ, the beginning of the extended state.  */
     class State {
     public:
        Status status;
+       Changes changes;
        Controls controls;
     } __attribute__((packed)); // comms::State
 
-    static_assert(sizeof(State) == 4);
+    static_assert(sizeof(State) == 6);
 
 
     class DebugInfo {
@@ -318,6 +436,7 @@ namespace comms {
     class ExtendedState {
     public:
         Status status;
+        Changes changes;
         Controls controls;
         ExtendedInfo einfo;
         DebugInfo dinfo;
@@ -326,6 +445,12 @@ namespace comms {
     } __attribute__((packed));// comms::ExtendedState
 
     static_assert(sizeof(ExtendedState) <= 32);
+    static_assert(offsetof(ExtendedState, controls) == Changes::CONTROLS_START);
+    static_assert(offsetof(ExtendedState, einfo) == Changes::EINFO_START);
+    static_assert(offsetof(ExtendedState, dinfo) == Changes::DINFO_START);
+    static_assert(offsetof(ExtendedState, controls) + sizeof(Controls) - 1 == Changes::CONTROLS_END);
+    static_assert(offsetof(ExtendedState, einfo) + sizeof(ExtendedInfo) - 1 == Changes::EINFO_END);
+    static_assert(offsetof(ExtendedState, dinfo) + sizeof(DebugInfo) - 1 == Changes::DINFO_END);
 
     /** Persistent data that we back up in the AVR between RPi runs, but which the RPi itself is in charge of wrt changes. 
      */
@@ -400,8 +525,16 @@ namespace msg {
     static_assert(Info::ID == 2);
 
     /** Starts the audio recording. 
+     
+        The AVR_IRQ is raised when at least given number of complete batches (1..7) is available so that the RPi can read them in a single burst. The batches are either raw samples, or ADPCM compressed. The sample rate is 8000 or 16000Hz and the samples have 8, 10 or 12 significant bits. 
     */
-    MESSAGE(StartAudioRecording);
+    MESSAGE(StartAudioRecording,
+        uint8_t irqBatches;
+        comms::AudioEncoding encoding;
+        uint16_t sampleRate;
+        uint8_t bits;
+        StartAudioRecording(uint8_t irqBatches = 1, comms::AudioEncoding encoding = comms::AudioEncoding::Raw, uint16_t sampleRate = 8000, uint8_t bits = 8): irqBatches{irqBatches}, encoding{encoding}, sampleRate{sampleRate}, bits{bits} {}
+    );
     /** Stops the audio recording.
      */
     MESSAGE(StopAudioRecording);
@@ -459,6 +592,15 @@ namespace msg {
      */
     MESSAGE(DInfoClear);
 
+    /** Starts, or stops streaming the thumbstick. 
+     
+        When streaming, the AVR samples the thumbstick between each of its other analog measurements, i.e. about five times as often, and raises the AVR_IRQ as soon as the position moves by JOY_STREAM_THRESHOLD (in 10bit units) instead of waiting for the end of its tick. Otherwise the thumbstick is only reported at the end of the tick when it moved by at least one 8bit step. 
+     */
+    MESSAGE(SetJoyStreaming,
+        bool enabled;
+        SetJoyStreaming(bool enabled): enabled{enabled} {}
+    );
+
 } // namespace msg
 
 #undef MESSAGE
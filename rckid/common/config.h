@@ -11,6 +11,10 @@
 // note this is also in retroarch directory
 #define SCREENSHOT_TMP_DIRECTORY "/rckid/.rckid/tmp/screenshots"
 
+/** File the input latency statistics are written to when leaving the debug view. 
+ */
+#define INPUT_LATENCY_FILE "/rckid/input-latency.txt"
+
 /** \section Input Controls
  
     
@@ -28,9 +32,27 @@
 
 #define ANALOG_BUTTON_THRESHOLD 48
 
-/** Debounce interval for the buttons on RPI side in ticks (10ms). 
+/** Duration of the RPI driver's tick in microseconds. The tick is only running when there is something to do (polling the accelerometer).
  */
-#define BTN_DEBOUNCE_DURATION_TICKS 2
+#define RPI_TICK_US 10000
+
+/** Sample rate of the accelerometer in Hz. The samples are stored in the accelerometer's FIFO and read in bursts every ACCEL_READ_TICKS ticks. 
+ */
+#define ACCEL_SAMPLE_RATE 200
+#define ACCEL_READ_TICKS 4
+
+/** Tilt controls of the accelerometer. The time constant of the orientation filter in milliseconds, the dead zone of the tilt axes and the tilts at which the virtual dpad buttons are pressed and released in 1/128 g like the axis values, and the linear accelerations that make a tap and a shake gesture in 1/100 g. 
+ */
+#define ACCEL_FILTER_TAU_MS 250
+#define ACCEL_DEAD_ZONE 8
+#define ACCEL_BUTTON_PRESS ANALOG_BUTTON_THRESHOLD
+#define ACCEL_BUTTON_RELEASE 32
+#define ACCEL_TAP_THRESHOLD 80
+#define ACCEL_SHAKE_THRESHOLD 120
+
+/** Default debounce interval for the buttons on RPI side in microseconds. Can be changed for each button at runtime.
+ */
+#define BTN_DEBOUNCE_US 20000
 
 /** \section UI 
  */
@@ -46,6 +68,14 @@
 
 #define WIDGET_FADE_TIME 250
 
+/** Duration of a single UI frame in milliseconds while something is animating. When nothing is animating, the UI thread only wakes up for events. 
+ */
+#define UI_FRAME_MS 16
+
+/** How often widgets that poll something in their tick() while not redrawing (such as the game player waiting for the emulator to exit) are ticked, in milliseconds.
+ */
+#define UI_IDLE_TICK_MS 100
+
 /** \section Audio 
 
     Audio volume can be set in range from 0 to 100%, which is recalculated to log/exp scale via the amixer. Min value is always 0 (mute). Max value and the step, as well as the initial power-on value can be set here.  
@@ -56,6 +86,36 @@
 
 #define AUDIO_MUSIC_ARTWORK_DIR "/rckid/images/music artwork"
 
+/** Number of 32 byte batches (4ms each of 8bit raw audio at 8kHz, 1ms of 16bit raw audio at 16kHz) the AVR accumulates before it asks the RPi to read the recording. The batches are then read in a single I2C transaction. Higher values mean fewer interrupts and transactions, but more latency and less slack before the AVR's 8 batch buffer overflows (1..7). 
+ */
+#define AUDIO_RECORDING_BURST 2
+
+/** Encoding of the recorded audio sent by the AVR. ADPCM halves the I2C traffic for the price of some quantization noise (a quarter of it for 16bit raw samples), which the bus needs at 16kHz with more than 8 bits (see the dbench recording results). The driver always decodes the recording to 16bit samples. 
+ */
+#define AUDIO_RECORDING_ENCODING comms::AudioEncoding::ADPCM
+
+/** Sample rate of the audio recording (8000 or 16000Hz) and the number of significant bits of the samples (8, 10 or 12). The opus encoder used by the walkie-talkie runs at the same rate, i.e. in wideband at 16kHz. 
+ */
+#define AUDIO_RECORDING_SAMPLE_RATE 16000
+#define AUDIO_RECORDING_BITS 12
+
+/** Shares of the I2C bus time (in percent) the periodic polls of the accelerometer and of the AVR extended state may use. The audio recording, AVR input reads and commands are never limited. 
+ */
+#define I2C_BUDGET_ACCEL 15
+#define I2C_BUDGET_AVR_EXTENDED_STATE 5
+
+/** The RPi advances the time and uptime with its own second timer and reads them from the AVR, together with the rest of the extended state, every this many seconds so that they follow the AVR's RTC. 
+ */
+#define AVR_TIME_SYNC_SECONDS 60
+
+/** The budgeted I2C polls are deferred while the bus was busier than this percentage recently so that the rest of the bus is left to the audio recording and input. 
+ */
+#define I2C_MAX_UTILIZATION 60
+
+/** Window over which the I2C bus load is measured and the budgets can be accumulated, in microseconds. 
+ */
+#define I2C_BUDGET_WINDOW_US 100000
+
 /** \section Device Build Configuration 
  
     The following settings can enable or disable certain features based on the option RCKid hardware being present or not. 
@@ -99,6 +159,11 @@
  */
 #define RPI_PING_TIMEOUT 10000
 
+/** Minimal movement of the thumbstick in 10bit units that the AVR reports to the RPi. JOY_THRESHOLD applies normally, JOY_STREAM_THRESHOLD when the thumbstick is streamed (see msg::SetJoyStreaming), where the position is reported right away and in full precision. 
+ */
+#define JOY_THRESHOLD 4
+#define JOY_STREAM_THRESHOLD 2
+
 /** \section Power & Voltage 
   
  */
@@ -118,10 +183,25 @@
 /** When VCC is above this value (set to be greater than that produced by Li-Ion battery, but lower than 5V to account for voltage drop) we can assume that we are running from the USB power. */
 #define VCC_THRESHOLD_VUSB 440
 
+/** \section Radio
+ */
+
+/** Number of 32 byte packets the NRF transmit queue holds (power of two). Packets sent to a full queue are dropped. The walkie-talkie sends one opus packet per 40ms frame, i.e. 25 packets per second, so this gives about 2.5 seconds of slack.
+ */
+#define NRF_TX_QUEUE_SIZE 64
 
 /** \section Walkie-Talkie
 */
 
 #define WALKIE_TALKIE_HEARTBEAT_INTERVAL_MIN 300
 #define WALKIE_TALKIE_HEARTBEAT_INTERVAL_MAX 500
+
+/** Number of sweeps of the channel scan (some 30ms each) the walkie-talkie surveys the channels for before moving to the quietest one. 
+ */
+#define WALKIE_TALKIE_SCAN_SWEEPS 32
+
+/** How many times the channel change is announced on the old channel and how long after the first announcement the announcing device follows its peers. 
+ */
+#define WALKIE_TALKIE_HOP_REPEATS 3
+#define WALKIE_TALKIE_HOP_DELAY_MS 200
 #define WALKIE_TALKIE_STORE_PTT 
\ No newline at end of file
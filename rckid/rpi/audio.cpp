@@ -7,10 +7,10 @@ void AudioVisualizer::draw(Canvas & c, int left, int top, int width, int height)
     int barWidth = width / numBars_;
     left += (width - barWidth * numBars_) / 2; // center
     for (size_t i = 0; i < numBars_; ++i) {
-        int t = (top + height) - (maxs_[p]) * height / 255;
+        int t = (top + height) - (maxs_[p] + 32768) * height / 65535;
         int d = (maxs_[p] - mins_[p]);
-        int h = d * height / 255;
-        DrawRectangle(left + barWidth * i, t, barWidth, h, ColorAlpha(c.accentColor(), 0.5 + d/512.0));
+        int h = d * height / 65535;
+        DrawRectangle(left + barWidth * i, t, barWidth, h, ColorAlpha(c.accentColor(), 0.5 + d/131072.0));
         p = (p + 1) % numBars_;             
     }
 }
@@ -7,6 +7,8 @@
 #include "platform/platform.h"
 #include "utils/utils.h"
 
+#include "common/config.h"
+
 
 class Window;
 
@@ -19,8 +21,8 @@ class AudioVisualizer {
 public:
 
     AudioVisualizer(size_t sampleRate, size_t numBars = 30, float time = 1):
-        mins_{ new uint8_t[numBars]},
-        maxs_{ new uint8_t[numBars]},
+        mins_{ new int16_t[numBars]},
+        maxs_{ new int16_t[numBars]},
         pos_{0},
         numBars_{numBars},
         maxBufferSize_{static_cast<size_t>(sampleRate * time / numBars)} {
@@ -31,18 +33,18 @@ public:
      */
     void reset() {
         for (size_t i = 0; i < numBars_; ++i) {
-            mins_[i] = 128;
-            maxs_[i] = 128;
+            mins_[i] = 0;
+            maxs_[i] = 0;
         }
-        bufferMin_ = 255;
-        bufferMax_ = 0;
+        bufferMin_ = INT16_MAX;
+        bufferMax_ = INT16_MIN;
         bufferSize_ = 0;
         pos_ = 0;
     }
 
     /** Adds the given data to the analyzer. 
      */
-    void addData(uint8_t * data, size_t length) {
+    void addData(int16_t const * data, size_t length) {
         while (length-- != 0) {
             if (*data < bufferMin_)
                 bufferMin_ = *data;
@@ -54,8 +56,8 @@ public:
                 mins_[pos_] = bufferMin_;
                 maxs_[pos_] = bufferMax_;
                 pos_ = (pos_ + 1) % numBars_;
-                bufferMin_ = 255;
-                bufferMax_ = 0;
+                bufferMin_ = INT16_MAX;
+                bufferMax_ = INT16_MIN;
                 bufferSize_ = 0;
             }
         }
@@ -68,15 +70,15 @@ public:
 private:
 
     // ring of min and max values representing the bars
-    uint8_t * mins_;
-    uint8_t * maxs_;
+    int16_t * mins_;
+    int16_t * maxs_;
     // the next position in the ring
     size_t pos_;
     // total number of bars (and the length of the ring)
     size_t numBars_; 
 
-    uint8_t bufferMin_;
-    uint8_t bufferMax_;
+    int16_t bufferMin_;
+    int16_t bufferMax_;
     size_t bufferSize_;
     size_t maxBufferSize_; 
 
@@ -92,6 +94,7 @@ namespace opus {
     enum class SampleRate : opus_int32 {
         khz8000 = 8000, 
         khz12000 = 12000, 
+        khz16000 = 16000, 
         khz24000 = 24000, 
         khz48000 = 48000,
     }; // opus::SampleRate
@@ -112,18 +115,18 @@ namespace opus {
     /** Raw Opus Encoder
      
         The raw encoder is a specialzed direct opus codec encoder tuned for transmitting voice over the NRF packets. It wraps the opus packets of max 30 bytes with 2 bytes of extra information - the length of the opus packet and a packet index that can be used to detect multiple sends of the same packet as well as packet loss.
+
+        The encoder runs at 8kHz (narrowband), or 16kHz, in which case wideband is forced as opus would pick narrowband at this bitrate on its own. The bitrate, and hence the packet size, stays the same. 
      */
     class RawEncoder {
     public:
         /** Creates new encoder. 
          
          */
-        RawEncoder() {
-            int err;
-            encoder_ = opus_encoder_create(8000, 1, OPUS_APPLICATION_VOIP, &err);
-            if (err != OPUS_OK)
-                throw OpusError{STR("Unable to create opus encoder, code: " << err)};
-            opus_encoder_ctl(encoder_, OPUS_SET_BITRATE(6000));                
+        RawEncoder(SampleRate sampleRate = static_cast<SampleRate>(AUDIO_RECORDING_SAMPLE_RATE)):
+            sampleRate_{sampleRate},
+            frameLength_{static_cast<size_t>(sampleRate) / static_cast<size_t>(FrameSize::ms40)} {
+            create();
             frame_[0] = 0;
             frame_[1] = 0;
         }
@@ -135,11 +138,7 @@ namespace opus {
 
         void reset() {
             opus_encoder_destroy(encoder_);
-            int err;
-            encoder_ = opus_encoder_create(8000, 1, OPUS_APPLICATION_VOIP, &err);
-            if (err != OPUS_OK)
-                throw OpusError{STR("Unable to create opus encoder, code: " << err)};
-            opus_encoder_ctl(encoder_, OPUS_SET_BITRATE(6000));                
+            create();
             frame_[0] = 0;
             frame_[1] = 0;
             buffer_.clear();
@@ -149,11 +148,11 @@ namespace opus {
          
             Returns true if there has been a new encoded frame created during the recording, in which case the call should be followed by sending the frame packet. 
          */
-        bool encode(uint8_t const * data, size_t len) {
+        bool encode(int16_t const * data, size_t len) {
             bool newFrame = false;
             while (len-- > 0) {
-                buffer_.push_back((static_cast<opus_int16>(*(data++)) - 128) * 256);
-                if (buffer_.size() == RAW_FRAME_LENGTH) {
+                buffer_.push_back(*(data++));
+                if (buffer_.size() == frameLength_) {
                     ++frame_[1];
                     int result = opus_encode(encoder_, buffer_.data(), buffer_.size(), frame_ + 2, sizeof(frame_) - 2);
                     if (result > 0) {
@@ -190,10 +189,26 @@ namespace opus {
             return frame_[1];
         }
 
+        /** Returns the number of samples in the unencoded frame. 
+         */
+        size_t frameLength() const { return frameLength_; }
+
     private:
-        /** Number of samples in the unencoded frame. Corresponds to 8000Hz sample rate and 40ms window time, which at 6kbps gives us 30 bytes length encoded frame. 
+
+        void create() {
+            int err;
+            encoder_ = opus_encoder_create(static_cast<opus_int32>(sampleRate_), 1, OPUS_APPLICATION_VOIP, &err);
+            if (err != OPUS_OK)
+                throw OpusError{STR("Unable to create opus encoder, code: " << err)};
+            opus_encoder_ctl(encoder_, OPUS_SET_BITRATE(6000));
+            opus_encoder_ctl(encoder_, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+            opus_encoder_ctl(encoder_, OPUS_SET_BANDWIDTH(sampleRate_ == SampleRate::khz8000 ? OPUS_BANDWIDTH_NARROWBAND : OPUS_BANDWIDTH_WIDEBAND));
+        }
+
+        SampleRate sampleRate_;
+        /** Number of samples in the unencoded frame. Corresponds to the sample rate and 40ms window time, which at 6kbps gives us 30 bytes length encoded frame. 
          */
-        static constexpr size_t RAW_FRAME_LENGTH = 320;
+        size_t frameLength_;
         OpusEncoder * encoder_;
 
         std::vector<opus_int16> buffer_;
@@ -207,9 +222,11 @@ namespace opus {
      */
     class RawDecoder {
     public:
-        RawDecoder() {
+        RawDecoder(SampleRate sampleRate = static_cast<SampleRate>(AUDIO_RECORDING_SAMPLE_RATE)):
+            sampleRate_{sampleRate},
+            frameLength_{static_cast<size_t>(sampleRate) / static_cast<size_t>(FrameSize::ms40)} {
             int err;
-            decoder_ = opus_decoder_create(8000, 1, &err);
+            decoder_ = opus_decoder_create(static_cast<opus_int32>(sampleRate_), 1, &err);
             if (err != OPUS_OK)
                 throw OpusError{STR("Unable to create opus decoder, code: " << err)};
         }
@@ -221,7 +238,7 @@ namespace opus {
         void reset() {
             opus_decoder_destroy(decoder_);
             int err;
-            decoder_ = opus_decoder_create(8000, 1, &err);
+            decoder_ = opus_decoder_create(static_cast<opus_int32>(sampleRate_), 1, &err);
             if (err != OPUS_OK)
                 throw OpusError{STR("Unable to create opus decoder, code: " << err)};
             lastIndex_ = 0xff;
@@ -237,7 +254,7 @@ namespace opus {
             while (++lastIndex_ != rawPacket[1])
                 reportPacketLoss();
             // decode the packet and return the decoded size
-            int result = opus_decode(decoder_, rawPacket + 2, rawPacket[0], buffer_, 320, false);
+            int result = opus_decode(decoder_, rawPacket + 2, rawPacket[0], buffer_, frameLength_, false);
             if (result < 0)
                 throw OpusError{STR("Unable to decode packet, code: " << result)};
             ++packets_;
@@ -246,6 +263,10 @@ namespace opus {
 
         opus_int16 const * buffer() const { return buffer_; }
 
+        /** Returns the number of samples in a decoded frame. 
+         */
+        size_t frameLength() const { return frameLength_; }
+
         size_t missingPackets() const { return missingPackets_; }
         size_t packets() const { return packets_; }
 
@@ -253,15 +274,18 @@ namespace opus {
 
         void reportPacketLoss() {
             ++missingPackets_;
-            int result = opus_decode(decoder_, nullptr, 0, buffer_, 320, false);
+            int result = opus_decode(decoder_, nullptr, 0, buffer_, frameLength_, false);
             if (result < 0)
                 throw OpusError{STR("Unable to decode missing packet, code: " << result)};
         }
 
+        SampleRate sampleRate_;
+        size_t frameLength_;
         OpusDecoder * decoder_;
         size_t missingPackets_{0};
         size_t packets_{0};
-        opus_int16 buffer_[320];
+        /** Large enough for 40ms frame at 16kHz. */
+        opus_int16 buffer_[640];
         uint8_t lastIndex_{0xff};
     }; 
 
@@ -0,0 +1,753 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+
+#include "platform/platform.h"
+#include "utils/utils.h"
+
+#include "common/config.h"
+#include "common/comms.h"
+#include "common/adpcm.h"
+
+/** In-process AVR simulator for the ARCH_MOCK builds.
+
+    Attaches itself to the mock I2C bus as the AVR and speaks the same protocol as the AVR firmware (rckid/avr/src/avr.cpp): every read starts with the status byte followed by the changes mask and the rest of the state, or the buffer selected by the last command (chip info, persistent state), and the msg:: commands are processed as they arrive. When recording, the samples are written to the same 8 x 32 bytes circular buffer at the recording sample rate, the AVR_IRQ is raised when the requested number of batches is available and reads return the batch index and the number of complete batches followed by the batches exactly as the AVR does, so the driver's recording path, including skipped batches, can be exercised and profiled on a dev box.
+
+    The AVR_IRQ line is simulated by the mock gpio, so the driver gets the falling edges via its usual interrupt handler. Control changes raise the IRQ at the next AVR tick (200Hz) when not recording. When the thumbstick is streamed (msg::SetJoyStreaming), its moves raise the IRQ at the next thumbstick sample (1kHz) instead. The I2C transfers take the time they would take on a bus of given speed.
+
+    The simulator is driven by a simple line based script, which runs in its own thread:
+
+        # comments and empty lines are ignored
+        wait MS             pauses the script for given number of milliseconds
+        press BUTTON        presses one of the AVR buttons (select, start, home, l, r)
+        release BUTTON      releases the button
+        joy H V             sets the raw thumbstick position (0..255, 128 is center)
+        vcc V               sets VCC in 0.01V
+        vbatt V             sets the battery voltage in 0.01V
+        temp T              sets the temperature in 0.1C
+        power MODE          sets the power status (battery, low, charging, usb)
+        alarm on|off        sets, or clears the alarm flag
+        rate HZ             overrides the recording sample rate requested by the driver, higher rates can be used for stress tests
+        i2c HZ              I2C bus speed (400000 by default), 0 makes the transfers instant
+        loop                restarts the script from the beginning
+ */
+class AvrSimulator {
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    enum class Button {
+        Select,
+        Start,
+        Home,
+        L,
+        R,
+    };
+
+    AvrSimulator() {
+        // the AVR has just powered the RPi on
+        state_.status.setMode(comms::Mode::PowerUp);
+        state_.einfo.setVcc(500);
+        state_.einfo.setVBatt(380);
+        state_.einfo.setTemp(250);
+        state_.controls.setJoyH(128);
+        state_.controls.setJoyV(128);
+        state_.changes.set(comms::Changes::ALL);
+        memset(recBuffer_, 128, sizeof(recBuffer_));
+    }
+
+    ~AvrSimulator() {
+        stop();
+    }
+
+    AvrSimulator(AvrSimulator const &) = delete;
+    AvrSimulator & operator = (AvrSimulator const &) = delete;
+
+    /** Attaches the simulator to the mock I2C bus at given address and the AVR_IRQ pin, and starts running the script.
+     */
+    void start(uint8_t address, platform::gpio::Pin irqPin) {
+        std::lock_guard<std::mutex> g{m_};
+        if (running_)
+            return;
+        address_ = address;
+        irqPin_ = irqPin;
+        started_ = Clock::now();
+        nextTick_ = started_;
+        scriptTime_ = started_;
+        // the IRQ line is pulled up by the RPi
+        platform::gpio::inputPullup(irqPin_);
+        platform::i2c::attachSlave(address_, & slave_);
+        running_ = true;
+        thread_ = std::thread{[this](){ loop(); }};
+    }
+
+    /** Detaches the simulator from the bus and stops the script.
+     */
+    void stop() {
+        {
+            std::lock_guard<std::mutex> g{m_};
+            if (!running_)
+                return;
+            running_ = false;
+            platform::i2c::attachSlave(address_, nullptr);
+        }
+        cv_.notify_all();
+        thread_.join();
+    }
+
+    /** Parses the script and starts executing it from the beginning. Returns false and leaves the current script running if there is an error, in which case the error is described in the error argument, if given.
+     */
+    bool setScript(std::string const & script, std::string * error = nullptr) {
+        std::vector<Step> steps;
+        std::istringstream s{script};
+        std::string line;
+        size_t lineNo = 0;
+        while (std::getline(s, line)) {
+            ++lineNo;
+            std::istringstream l{line};
+            std::string cmd;
+            if (!(l >> cmd) || cmd[0] == '#')
+                continue;
+            Step step;
+            if (!parseStep(cmd, l, step)) {
+                if (error != nullptr)
+                    *error = STR("line " << lineNo << ": invalid command " << line);
+                return false;
+            }
+            steps.push_back(step);
+        }
+        {
+            std::lock_guard<std::mutex> g{m_};
+            script_ = std::move(steps);
+            pc_ = 0;
+            scriptTime_ = Clock::now();
+        }
+        cv_.notify_all();
+        return true;
+    }
+
+    /** Loads the script from given file.
+     */
+    bool loadScript(std::string const & filename, std::string * error = nullptr) {
+        std::ifstream f{filename};
+        if (!f.good()) {
+            if (error != nullptr)
+                *error = STR("unable to open " << filename);
+            return false;
+        }
+        std::stringstream s;
+        s << f.rdbuf();
+        return setScript(s.str(), error);
+    }
+
+    /** Loads the samples that will be returned by the recording. When there are no samples, the recording returns silence.
+     */
+    bool loadSamples(std::string const & filename) {
+        std::ifstream f{filename, std::ios::binary};
+        if (!f.good())
+            return false;
+        std::vector<uint8_t> samples{std::istreambuf_iterator<char>{f}, std::istreambuf_iterator<char>{}};
+        std::lock_guard<std::mutex> g{m_};
+        samples_ = std::move(samples);
+        sampleIndex_ = 0;
+        return true;
+    }
+
+    /** Presses, or releases the button as if it was done on the device.
+     */
+    void setButton(Button btn, bool value) {
+        {
+            std::lock_guard<std::mutex> g{m_};
+            changeButton(btn, value);
+        }
+        cv_.notify_all();
+    }
+
+    /** Moves the thumbstick.
+     */
+    void setJoy(uint8_t h, uint8_t v) { setJoyFull(h << 2, v << 2); }
+
+    /** Moves the thumbstick, the position is in the full 10bit precision (0..1023, 512 is center). 
+     */
+    void setJoyFull(uint16_t h, uint16_t v) {
+        {
+            std::lock_guard<std::mutex> g{m_};
+            changeJoy(h, v);
+        }
+        cv_.notify_all();
+    }
+
+    /** Recording sample rate in Hz.
+     */
+    void setSampleRate(unsigned hz) {
+        std::lock_guard<std::mutex> g{m_};
+        sampleRate_ = std::max(1u, hz);
+        rateOverride_ = true;
+        if (state_.status.recording()) {
+            // keep the samples recorded so far
+            recStart_ = Clock::now() - std::chrono::microseconds{samplesRecorded_ * 1000000 / sampleRate_};
+        }
+    }
+
+    /** I2C bus speed in Hz, 0 for instant transfers.
+     */
+    void setI2CSpeed(unsigned hz) {
+        std::lock_guard<std::mutex> g{m_};
+        i2cHz_ = hz;
+    }
+
+    /** \name Statistics
+     */
+    //@{
+    /** Number of times the AVR_IRQ has been raised. */
+    size_t irqs() const { return irqs_.load(); }
+    /** Number of I2C reads. */
+    size_t reads() const { return reads_.load(); }
+    /** Number of recording batches filled by the recorder. */
+    size_t batchesRecorded() const { return batchesRecorded_.load(); }
+    /** Number of complete recording batches read by the master. */
+    size_t batchesRead() const { return batchesRead_.load(); }
+    /** Number of recording reads that returned at least one complete batch. */
+    size_t bursts() const { return bursts_.load(); }
+    /** Number of recording reads that returned an incomplete batch. */
+    size_t incompleteReads() const { return incompleteReads_.load(); }
+    /** Number of commands with given id received. */
+    size_t commands(uint8_t id) const { std::lock_guard<std::mutex> g{m_}; return commands_[id]; }
+    //@}
+
+private:
+
+    enum class Tx {
+        State,
+        Info,
+        PersistentState,
+        Recording,
+    };
+
+    enum class Op {
+        Wait,
+        Button,
+        Joy,
+        Vcc,
+        VBatt,
+        Temp,
+        Power,
+        Alarm,
+        Rate,
+        I2C,
+        Loop,
+    };
+
+    struct Step {
+        Op op;
+        unsigned a = 0;
+        unsigned b = 0;
+    };
+
+    static constexpr unsigned TICK_US = 5000;
+    /** Period of the thumbstick samples when streaming. */
+    static constexpr unsigned JOY_SAMPLE_US = 1000;
+
+    static bool parseStep(std::string const & cmd, std::istream & args, Step & step) {
+        if (cmd == "wait") {
+            step.op = Op::Wait;
+            return static_cast<bool>(args >> step.a);
+        } else if (cmd == "press" || cmd == "release") {
+            step.op = Op::Button;
+            step.b = (cmd == "press");
+            std::string btn;
+            args >> btn;
+            if (btn == "select")
+                step.a = static_cast<unsigned>(Button::Select);
+            else if (btn == "start")
+                step.a = static_cast<unsigned>(Button::Start);
+            else if (btn == "home")
+                step.a = static_cast<unsigned>(Button::Home);
+            else if (btn == "l")
+                step.a = static_cast<unsigned>(Button::L);
+            else if (btn == "r")
+                step.a = static_cast<unsigned>(Button::R);
+            else
+                return false;
+            return true;
+        } else if (cmd == "joy") {
+            step.op = Op::Joy;
+            return (args >> step.a >> step.b) && step.a < 256 && step.b < 256;
+        } else if (cmd == "vcc") {
+            step.op = Op::Vcc;
+            return static_cast<bool>(args >> step.a);
+        } else if (cmd == "vbatt") {
+            step.op = Op::VBatt;
+            return static_cast<bool>(args >> step.a);
+        } else if (cmd == "temp") {
+            step.op = Op::Temp;
+            return static_cast<bool>(args >> step.a);
+        } else if (cmd == "power") {
+            step.op = Op::Power;
+            std::string mode;
+            args >> mode;
+            if (mode == "battery")
+                step.a = static_cast<unsigned>(comms::PowerStatus::Battery);
+            else if (mode == "low")
+                step.a = static_cast<unsigned>(comms::PowerStatus::LowBattery);
+            else if (mode == "charging")
+                step.a = static_cast<unsigned>(comms::PowerStatus::Charging);
+            else if (mode == "usb")
+                step.a = static_cast<unsigned>(comms::PowerStatus::USB);
+            else
+                return false;
+            return true;
+        } else if (cmd == "alarm") {
+            step.op = Op::Alarm;
+            std::string value;
+            args >> value;
+            step.a = (value == "on");
+            return value == "on" || value == "off";
+        } else if (cmd == "rate") {
+            step.op = Op::Rate;
+            return (args >> step.a) && step.a > 0;
+        } else if (cmd == "i2c") {
+            step.op = Op::I2C;
+            return static_cast<bool>(args >> step.a);
+        } else if (cmd == "loop") {
+            step.op = Op::Loop;
+            return true;
+        }
+        return false;
+    }
+
+    /** The simulator's thread. Executes the script, fills the recording buffer and runs the AVR ticks.
+     */
+    void loop() {
+        std::unique_lock<std::mutex> g{m_};
+        while (running_) {
+            Clock::time_point t = Clock::now();
+            runScript(t);
+            if (state_.status.recording())
+                record(t);
+            // the AVR tick raises the IRQ if there was a change in the state, unless recording
+            if (t >= nextTick_) {
+                nextTick_ += std::chrono::microseconds{TICK_US};
+                if (nextTick_ < t)
+                    nextTick_ = t + std::chrono::microseconds{TICK_US};
+                if (changed_ && !state_.status.recording())
+                    setIrq();
+                changed_ = false;
+            }
+            // the streamed thumbstick raises the IRQ at its next sample
+            if (joyStreaming_ && t >= nextJoy_) {
+                nextJoy_ += std::chrono::microseconds{JOY_SAMPLE_US};
+                if (nextJoy_ < t)
+                    nextJoy_ = t + std::chrono::microseconds{JOY_SAMPLE_US};
+                if (joyChanged_ && !state_.status.recording()) {
+                    setIrq();
+                    changed_ = false;
+                }
+                joyChanged_ = false;
+            }
+            // sleep until there is something to do
+            Clock::time_point next = Clock::time_point::max();
+            if (pc_ < script_.size())
+                next = scriptTime_;
+            if (changed_)
+                next = std::min(next, nextTick_);
+            if (joyChanged_)
+                next = std::min(next, nextJoy_);
+            if (state_.status.recording())
+                next = std::min(next, recStart_ + std::chrono::microseconds{((samplesRecorded_ / samplesPerBatch() + 1) * samplesPerBatch()) * 1000000 / sampleRate_});
+            if (next == Clock::time_point::max())
+                cv_.wait(g);
+            else
+                cv_.wait_until(g, next);
+        }
+    }
+
+    void runScript(Clock::time_point t) {
+        size_t steps = 0;
+        while (pc_ < script_.size() && scriptTime_ <= t) {
+            Step const & s = script_[pc_++];
+            switch (s.op) {
+                case Op::Wait:
+                    scriptTime_ += std::chrono::milliseconds{s.a};
+                    break;
+                case Op::Button:
+                    changeButton(static_cast<Button>(s.a), s.b);
+                    break;
+                case Op::Joy:
+                    changeJoy(s.a << 2, s.b << 2);
+                    break;
+                case Op::Vcc:
+                    if (state_.einfo.setVcc(s.a))
+                        state_.changes.set(comms::Changes::EINFO);
+                    break;
+                case Op::VBatt:
+                    if (state_.einfo.setVBatt(s.a))
+                        state_.changes.set(comms::Changes::EINFO);
+                    break;
+                case Op::Temp:
+                    if (state_.einfo.setTemp(s.a))
+                        state_.changes.set(comms::Changes::EINFO);
+                    break;
+                case Op::Power:
+                    changed_ = state_.status.setPowerStatus(static_cast<comms::PowerStatus>(s.a)) || changed_;
+                    break;
+                case Op::Alarm:
+                    changed_ = state_.status.setAlarm(s.a) || changed_;
+                    break;
+                case Op::Rate:
+                    sampleRate_ = s.a;
+                    rateOverride_ = true;
+                    if (state_.status.recording())
+                        recStart_ = t - std::chrono::microseconds{samplesRecorded_ * 1000000 / sampleRate_};
+                    break;
+                case Op::I2C:
+                    i2cHz_ = s.a;
+                    break;
+                case Op::Loop:
+                    pc_ = 0;
+                    // a loop without any waits would never give up the lock
+                    if (++steps > script_.size())
+                        scriptTime_ = t + std::chrono::milliseconds{1};
+                    break;
+            }
+        }
+    }
+
+    void changeButton(Button btn, bool value) {
+        comms::Controls & c = state_.controls;
+        bool old;
+        switch (btn) {
+            case Button::Select:
+                old = c.select();
+                c.setSelect(value);
+                break;
+            case Button::Start:
+                old = c.start();
+                c.setStart(value);
+                break;
+            case Button::Home:
+                old = c.home();
+                c.setButtonHome(value);
+                break;
+            case Button::L:
+                old = c.triggerLeft();
+                c.setTriggerLeft(value);
+                break;
+            case Button::R:
+                old = c.triggerRight();
+                c.setTriggerRight(value);
+                break;
+            default:
+                return;
+        }
+        if (old != value)
+            controlsChanged();
+    }
+
+    void changeJoy(uint16_t h, uint16_t v) {
+        uint16_t threshold = joyStreaming_ ? JOY_STREAM_THRESHOLD : JOY_THRESHOLD;
+        bool changed = state_.controls.setJoyHFull(h, threshold);
+        if (state_.controls.setJoyVFull(v, threshold) || changed) {
+            controlsChanged();
+            joyChanged_ = joyStreaming_;
+        }
+    }
+
+    void controlsChanged() {
+        state_.changes.set(comms::Changes::CONTROLS);
+        changed_ = true;
+    }
+
+    /** Writes all samples the recorder would have taken by the given time to the recording buffer, raising the IRQ each time a batch is filled, like the AVR's ADC1 interrupt does.
+     */
+    void record(Clock::time_point t) {
+        uint64_t target = std::chrono::duration_cast<std::chrono::microseconds>(t - recStart_).count() * sampleRate_ / 1000000;
+        while (samplesRecorded_ < target) {
+            // the sample file has 8bit unsigned samples, which are scaled to 16 bits and masked to the resolution used
+            int16_t sample = 0;
+            if (!samples_.empty()) {
+                sample = static_cast<int16_t>((samples_[sampleIndex_] - 128) * 256) & recMask_;
+                sampleIndex_ = (sampleIndex_ + 1) % samples_.size();
+            }
+            if (encoding_ == comms::AudioEncoding::Raw) {
+                if (bits_ > 8) {
+                    recBuffer_[wrIndex_++] = sample & 0xff;
+                    recBuffer_[wrIndex_++] = (sample >> 8) & 0xff;
+                } else {
+                    recBuffer_[wrIndex_++] = adpcm::Codec::headerSample(sample);
+                }
+            } else if (wrIndex_ % 32 == 0) {
+                uint8_t first = adpcm::Codec::headerSample(sample);
+                recBuffer_[wrIndex_] = adpcm_.index();
+                recBuffer_[wrIndex_ + 1] = first;
+                adpcm_.reset(first, adpcm_.index());
+                wrIndex_ += 2;
+            } else if (!recHalf_) {
+                recBuffer_[wrIndex_] = adpcm_.encode(sample);
+                recHalf_ = true;
+            } else {
+                recBuffer_[wrIndex_++] |= adpcm_.encode(sample) << 4;
+                recHalf_ = false;
+            }
+            ++samplesRecorded_;
+            if (wrIndex_ % 32 == 0 && !recHalf_) {
+                ++batchesRecorded_;
+                if (availableBatches() >= irqBatches_)
+                    setIrq();
+            }
+        }
+    }
+
+    uint8_t availableBatches() const {
+        return ((wrIndex_ >> 5) - state_.status.batchIndex()) & 7;
+    }
+
+    /** Number of samples in a recording batch. 
+     */
+    unsigned samplesPerBatch() const {
+        return comms::samplesPerBatch(encoding_, bits_);
+    }
+
+    void startRecording(uint8_t irqBatches, comms::AudioEncoding encoding, uint16_t sampleRate, uint8_t bits) {
+        wrIndex_ = 0;
+        encoding_ = encoding;
+        bits_ = std::clamp<uint8_t>(bits, 8, 16);
+        recMask_ = static_cast<int16_t>(~((1 << (16 - bits_)) - 1));
+        if (!rateOverride_)
+            sampleRate_ = std::max<unsigned>(1, sampleRate);
+        recHalf_ = false;
+        adpcm_.reset(128, 0);
+        irqBatches_ = std::clamp<uint8_t>(irqBatches, 1, 7);
+        samplesRecorded_ = 0;
+        recStart_ = Clock::now();
+        state_.status.setRecording(true);
+        state_.status.setBatchIndex(0);
+        tx_ = Tx::Recording;
+    }
+
+    void stopRecording() {
+        state_.status.setMode(comms::Mode::On);
+        state_.status.setRecording(false);
+        tx_ = Tx::State;
+    }
+
+    void setIrq() {
+        if (irq_)
+            return;
+        irq_ = true;
+        ++irqs_;
+        platform::gpio::simulate(irqPin_, false);
+    }
+
+    void clearIrq() {
+        if (!irq_)
+            return;
+        irq_ = false;
+        platform::gpio::simulate(irqPin_, true);
+    }
+
+    /** Handles the I2C transaction as the AVR's TWI interrupt and main loop would.
+     */
+    bool transmit(uint8_t const * wb, uint8_t wsize, uint8_t * rb, uint8_t rsize) {
+        // the bus is busy for the address byte and all data bytes, 9 bits each
+        unsigned i2cHz = i2cHz_.load();
+        if (i2cHz != 0)
+            std::this_thread::sleep_for(std::chrono::microseconds{(wsize + rsize + 1) * 9 * 1000000ull / i2cHz});
+        {
+            std::lock_guard<std::mutex> g{m_};
+            if (wsize > 0)
+                processCommand(wb, wsize);
+            if (rsize > 0)
+                read(rb, rsize);
+        }
+        // the command may have started the recording
+        if (wsize > 0)
+            cv_.notify_all();
+        return true;
+    }
+
+    void read(uint8_t * rb, uint8_t rsize) {
+        ++reads_;
+        bool recording = state_.status.recording();
+        // start of the read clears the IRQ
+        clearIrq();
+        state_.uptime = std::chrono::duration_cast<std::chrono::seconds>(Clock::now() - started_).count();
+        comms::Status status = state_.status;
+        uint8_t available = 0;
+        if (recording) {
+            record(Clock::now());
+            available = availableBatches();
+            status.setBatchCount(available);
+        }
+        rb[0] = * reinterpret_cast<uint8_t const *>(& status);
+        for (size_t i = 1; i < rsize; ++i) {
+            if (!recording && tx_ == Tx::State)
+                state_.changes.loaded(i);
+            rb[i] = txByte(i - 1);
+        }
+        if (!recording) {
+            tx_ = Tx::State;
+        } else if (available == 0) {
+            ++incompleteReads_;
+        } else {
+            uint8_t read = std::min<uint8_t>((rsize - 1) / 32, available);
+            if (read > 0) {
+                ++bursts_;
+                batchesRead_ += read;
+                state_.status.setBatchIndex(state_.status.batchIndex() + read);
+                if (availableBatches() >= irqBatches_)
+                    setIrq();
+            }
+        }
+    }
+
+    uint8_t txByte(size_t i) const {
+        switch (tx_) {
+            case Tx::State:
+                return (i + 1 < sizeof(state_)) ? reinterpret_cast<uint8_t const *>(& state_)[i + 1] : 0;
+            case Tx::Info:
+                return (i < sizeof(info_)) ? info_[i] : 0;
+            case Tx::PersistentState:
+                return (i < sizeof(pState_)) ? reinterpret_cast<uint8_t const *>(& pState_)[i] : 0;
+            case Tx::Recording:
+                return recBuffer_[((state_.status.batchIndex() << 5) + i) & 0xff];
+            default:
+                return 0;
+        }
+    }
+
+    void processCommand(uint8_t const * wb, uint8_t wsize) {
+        using namespace msg;
+        uint8_t buffer[I2C_BUFFER_SIZE] = {};
+        memcpy(buffer, wb, std::min<size_t>(wsize, sizeof(buffer)));
+        ++commands_[buffer[0]];
+        switch (buffer[0]) {
+            case AvrReset::ID:
+                if (state_.status.recording())
+                    stopRecording();
+                tx_ = Tx::State;
+                break;
+            // same as the AVR, which reports itself as ATTiny3216 in app mode
+            case Info::ID:
+                memset(info_, 0, sizeof(info_));
+                info_[0] = 0x1e;
+                info_[1] = 0x95;
+                info_[2] = 0x21;
+                info_[3] = 1; // app
+                info_[19] = 0;
+                info_[20] = 128;
+                tx_ = Tx::Info;
+                setIrq();
+                break;
+            case StartAudioRecording::ID:
+                if (state_.status.mode() == comms::Mode::On && !state_.status.recording()) {
+                    auto & m = StartAudioRecording::fromBuffer(buffer);
+                    startRecording(m.irqBatches, m.encoding, m.sampleRate, m.bits);
+                }
+                break;
+            case StopAudioRecording::ID:
+                if (state_.status.recording())
+                    stopRecording();
+                break;
+            case SetBrightness::ID:
+                pState_.brightness = SetBrightness::fromBuffer(buffer).value;
+                break;
+            case SetTime::ID:
+                state_.time = SetTime::fromBuffer(buffer).value;
+                break;
+            case GetPersistentState::ID:
+                tx_ = Tx::PersistentState;
+                setIrq();
+                break;
+            case SetPersistentState::ID:
+                pState_ = SetPersistentState::fromBuffer(buffer).pState;
+                break;
+            case PowerOn::ID:
+                if (state_.status.mode() == comms::Mode::PowerUp || state_.status.mode() == comms::Mode::WakeUp)
+                    state_.status.setMode(comms::Mode::On);
+                break;
+            case PowerDown::ID:
+                if (state_.status.mode() == comms::Mode::On || state_.status.mode() == comms::Mode::PowerUp)
+                    state_.status.setMode(comms::Mode::PowerDown);
+                break;
+            case DInfoClear::ID:
+                if (state_.dinfo.clear())
+                    state_.changes.set(comms::Changes::DINFO);
+                break;
+            case SetJoyStreaming::ID:
+                joyStreaming_ = SetJoyStreaming::fromBuffer(buffer).enabled;
+                joyChanged_ = false;
+                nextJoy_ = Clock::now();
+                break;
+            // rumbler & RGB commands have no visible effect, they are only counted
+            default:
+                break;
+        }
+    }
+
+    mutable std::mutex m_;
+    std::condition_variable cv_;
+    std::thread thread_;
+    bool running_ = false;
+
+    uint8_t address_ = AVR_I2C_ADDRESS;
+    platform::gpio::Pin irqPin_ = RPI_PIN_AVR_IRQ;
+    platform::i2c::Slave slave_{[this](uint8_t const * wb, uint8_t wsize, uint8_t * rb, uint8_t rsize) { return transmit(wb, wsize, rb, rsize); }};
+    std::atomic<unsigned> i2cHz_{400000};
+
+    comms::ExtendedState state_{};
+    comms::PersistentState pState_{};
+    uint8_t info_[I2C_BUFFER_SIZE] = {};
+    Tx tx_ = Tx::State;
+    bool irq_ = false;
+    /** True if there has been a change that the next tick should report via IRQ. */
+    bool changed_ = false;
+    /** True if the thumbstick is streamed and has moved since its last sample. */
+    bool joyStreaming_ = false;
+    bool joyChanged_ = false;
+    Clock::time_point nextJoy_;
+    size_t commands_[256] = {};
+
+    Clock::time_point started_;
+    Clock::time_point nextTick_;
+
+    std::vector<Step> script_;
+    size_t pc_ = 0;
+    Clock::time_point scriptTime_;
+
+    /** The recording buffer, 8 batches of 32 samples, as on the AVR. */
+    uint8_t recBuffer_[256];
+    uint8_t wrIndex_ = 0;
+    unsigned sampleRate_ = 8000;
+    /** True if the sample rate was set by setSampleRate, or the script, in which case the rate requested by the driver is ignored. */
+    bool rateOverride_ = false;
+    uint8_t irqBatches_ = 1;
+    comms::AudioEncoding encoding_ = comms::AudioEncoding::Raw;
+    uint8_t bits_ = 8;
+    int16_t recMask_ = static_cast<int16_t>(0xff00);
+    adpcm::Codec adpcm_;
+    bool recHalf_ = false;
+    Clock::time_point recStart_;
+    uint64_t samplesRecorded_ = 0;
+    std::vector<uint8_t> samples_;
+    size_t sampleIndex_ = 0;
+
+    std::atomic<size_t> irqs_{0};
+    std::atomic<size_t> reads_{0};
+    std::atomic<size_t> batchesRecorded_{0};
+    std::atomic<size_t> batchesRead_{0};
+    std::atomic<size_t> bursts_{0};
+    std::atomic<size_t> incompleteReads_{0};
+
+}; // AvrSimulator
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "platform/platform.h"
+#include "platform/peripherals/nrf24l01.h"
+
+#include "events.h"
+
+/** Occupancy of the radio channels accumulated from the sweeps of the channel scan (see RCKid::nrfScan()).
+
+    For each channel counts the sweeps in which a carrier was detected on it. A single sweep only catches the transmissions that happen to be on air while the receiver listens on the channel, so the more sweeps, the better the picture of the traffic.
+ */
+class ChannelSurvey {
+public:
+
+    static constexpr uint8_t NUM_CHANNELS = platform::NRF24L01::NUM_CHANNELS;
+
+    void reset() {
+        sweeps_ = 0;
+        for (uint32_t & h : hits_)
+            h = 0;
+    }
+
+    void add(NRFScanEvent const & e) {
+        ++sweeps_;
+        for (uint8_t ch = 0; ch < NUM_CHANNELS; ++ch)
+            if (e.channelBusy(ch))
+                ++hits_[ch];
+    }
+
+    uint32_t sweeps() const { return sweeps_; }
+
+    /** Percentage of the sweeps in which the channel was busy.
+     */
+    unsigned occupancy(uint8_t channel) const {
+        return sweeps_ == 0 ? 0 : hits_[channel] * 100 / sweeps_;
+    }
+
+    /** Returns the quietest channel from the given range.
+
+        A transmission at 1Mbps is 1MHz wide and at 2Mbps 2MHz wide, so it spills over to the neighbouring channels. Each channel therefore counts with half of the traffic of its neighbours as well. Of the equally quiet channels the one closest to the preferred channel wins, so the devices do not change the channel for no reason.
+     */
+    uint8_t quietest(uint8_t preferred, uint8_t first = 0, uint8_t last = NUM_CHANNELS - 1) const {
+        uint8_t result = preferred;
+        uint32_t best = UINT32_MAX;
+        for (unsigned ch = first; ch <= last; ++ch) {
+            uint32_t score = 2 * hits_[ch];
+            if (ch > 0)
+                score += hits_[ch - 1];
+            if (ch + 1 < NUM_CHANNELS)
+                score += hits_[ch + 1];
+            if (score < best || (score == best && std::abs(static_cast<int>(ch) - preferred) < std::abs(static_cast<int>(result) - preferred))) {
+                best = score;
+                result = static_cast<uint8_t>(ch);
+            }
+        }
+        return result;
+    }
+
+private:
+
+    uint32_t sweeps_ = 0;
+    uint32_t hits_[NUM_CHANNELS] = {};
+
+}; // ChannelSurvey
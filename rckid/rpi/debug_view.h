@@ -22,37 +22,56 @@ protected:
 
     void onBlur() override {
         rckid().setGamepadActive(false);
+        if (! rckid().inputLatency().dump(INPUT_LATENCY_FILE))
+            TraceLog(LOG_ERROR, STR("Unable to write input latency to " << INPUT_LATENCY_FILE));
     }
 
     void draw(Canvas & c) override{
         comms::ExtendedState state{rckid().extendedState()};
         BeginBlendMode(BLEND_ADD_COLORS);
         // now draw the displayed information
+        // the rows must stay above the footer row (220) and the values within the 320px width, hence the short labels in the right column
         c.drawText(160, 20, "VCC:", DARKGRAY);
-        c.drawText(210, 20, STR(state.einfo.vcc()), WHITE);
-        c.drawText(240, 20, "VBATT:", DARKGRAY);
-        c.drawText(290, 20, STR(state.einfo.vBatt()), WHITE);
-        c.drawText(160, 40, "TEMP:", DARKGRAY);
-        c.drawText(210, 40, STR(state.einfo.temp()), WHITE);
-        c.drawText(240, 40, "ATEMP:", DARKGRAY);
-        c.drawText(290, 40, STR(rckid().accelTemp()), WHITE);
-        c.drawText(160, 60, "PWR:", DARKGRAY);
+        c.drawText(205, 20, STR(state.einfo.vcc()), WHITE);
+        c.drawText(250, 20, "VB:", DARKGRAY);
+        c.drawText(280, 20, STR(state.einfo.vBatt()), WHITE);
+        c.drawText(160, 38, "TEMP:", DARKGRAY);
+        c.drawText(205, 38, STR(state.einfo.temp()), WHITE);
+        c.drawText(250, 38, "AT:", DARKGRAY);
+        c.drawText(280, 38, STR(rckid().accelTemp()), WHITE);
+        c.drawText(160, 56, "PWR:", DARKGRAY);
         switch (state.status.powerStatus()) {
             case comms::PowerStatus::Battery:
-                c.drawText(210, 60, "BATT", WHITE);
+                c.drawText(205, 56, "BATT", WHITE);
                 break;
             case comms::PowerStatus::LowBattery:
-                c.drawText(210, 60, "LOW_BATT", WHITE);
+                c.drawText(205, 56, "LOW", WHITE);
                 break;
             case comms::PowerStatus::Charging:
-                c.drawText(210, 60, "CHRG", WHITE);
+                c.drawText(205, 56, "CHRG", WHITE);
                 break;
             case comms::PowerStatus::USB:
-                c.drawText(210, 60, "USB", WHITE);
+                c.drawText(205, 56, "USB", WHITE);
                 break;
         }
-        c.drawText(160, 80, "UP:", DARKGRAY);
-        c.drawText(210, 80, STR(state.uptime), WHITE);
+        c.drawText(250, 56, "WK:", DARKGRAY);
+        c.drawText(280, 56, STR(rckid().driverWakeupsPerSecond()), WHITE);
+        c.drawText(160, 74, "UP:", DARKGRAY);
+        c.drawText(205, 74, STR(state.uptime), WHITE);
+        // UI events coalesced and dropped
+        c.drawText(160, 92, "UIQ:", DARKGRAY);
+        c.drawText(205, 92, STR(rckid().uiEventsCoalesced() << "/" << rckid().uiEventsDropped()), WHITE);
+        // I2C bus utilization in the last second and the number of deferred accelerometer polls
+        c.drawText(160, 110, "I2C:", DARKGRAY);
+        c.drawText(205, 110, STR(rckid().i2cBus().utilization() << "%/" << rckid().i2cBus().deferred(I2CScheduler::Client::Accel)), WHITE);
+        // skipped recording batches by the class of the event that delayed them
+        c.drawText(160, 128, "MISS:", DARKGRAY);
+        c.drawText(205, 128, STR(rckid().deadlineMisses(RCKid::DriverLane::Deadline) << "/" << rckid().deadlineMisses(RCKid::DriverLane::Input) << "/" << rckid().deadlineMisses(RCKid::DriverLane::Housekeeping)), WHITE);
+        // input latency p50/p99 in microseconds since the interrupt
+        drawLatency(c, 146, "DEQ:", LatencyStats::Stage::Dequeue);
+        drawLatency(c, 164, "EVD:", LatencyStats::Stage::Evdev);
+        drawLatency(c, 182, "UI:", LatencyStats::Stage::UI);
+        drawLatency(c, 200, "PIX:", LatencyStats::Stage::Frame);
 
         //DrawTextEx(window().helpFont(), "VCC:", 160, 20, 16, 1.0, DARKGRAY);
         //DrawTextEx(window().helpFont(), STR(rckid().vcc()).c_str(), 210, 20, 16, 1.0, WHITE);
@@ -151,6 +170,13 @@ protected:
     void btnHome(bool state) override { btnHome_ = state; }
 
 private:
+
+    void drawLatency(Canvas & c, int y, char const * name, LatencyStats::Stage stage) {
+        LatencyStats::Summary s{rckid().inputLatency().summary(stage)};
+        c.drawText(160, y, name, DARKGRAY);
+        c.drawText(205, y, STR(s.p50 << "/" << s.p99 << "us"), WHITE);
+    }
+
     bool btnA_ = false;
     bool btnB_ = false;
     bool btnX_ = false;
@@ -1,17 +1,23 @@
 #pragma once
 
-#include <queue>
-#include <condition_variable>
-#include <mutex>
+#include <atomic>
 #include <optional>
 #include <variant>
+#include <cerrno>
+#include <thread>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 
 #include "platform/platform.h"
 #include "platform/peripherals/nrf24l01.h"
 #include "utils/utils.h"
+#include "utils/queue.h"
 
 #include "common/comms.h"
 
+#include "latency.h"
+
 /** State of the NRF chip. 
  */
 enum class NRFState {
@@ -55,26 +61,45 @@ struct LowBatteryEvent {};
 struct StateChangeEvent {};
 struct Hearts { uint16_t value; };
 
-/** An event triggered when there is a button change. */
-struct ButtonEvent { Button btn; bool state; }; 
+/** An event triggered when there is a button change. The origin is the time of the interrupt that caused the change, if known. */
+struct ButtonEvent { Button btn; bool state; LatencyClock::time_point origin{}; }; 
 
 struct JoyEvent { uint8_t h; uint8_t v; };
 
 /** The accelerometer readouts. */
 struct AccelEvent { uint8_t h; uint8_t v; };
 
+/** Gestures detected from the accelerometer's movement. 
+ */
+enum class Gesture {
+    None,
+    Tap, 
+    Shake,
+}; // Gesture
+
+struct GestureEvent { Gesture gesture; };
+
 struct HeadphonesEvent { bool connected; }; 
 
 /** Audio recording event. 
  
-    Contains the status word which can be used to determine the batch and 32 data bytes of the actual recording. 
+    Contains the status word which can be used to determine the batch and 32 signed 16bit samples of the actual recording, regardless of the sample resolution and encoding used by the AVR. 
  */
-struct RecordingEvent { comms::Status status; uint8_t data[32]; };
-static_assert(sizeof(RecordingEvent) == 33); 
+struct RecordingEvent { comms::Status status; int16_t data[32]; };
+static_assert(sizeof(RecordingEvent) == 66); 
 
 struct NRFPacketEvent { uint8_t packet[32]; };
 
-struct NRFTxEvent {};
+/** Transmits have finished. The number of packets done since the last event and how many of them failed, i.e. the radio gave up after the retransmits (only possible with acks). */
+struct NRFTxEvent { uint8_t packets; uint8_t failed; };
+
+/** A single sweep of the radio channel scan. Has a bit for each of the NRF24L01's 126 channels, set if a carrier has been detected on the channel. 
+ */
+struct NRFScanEvent { 
+    uint8_t busy[16]; 
+
+    bool channelBusy(uint8_t channel) const { return busy[channel / 8] & (1 << (channel % 8)); }
+};
 
 using Event = std::variant<
     comms::Mode, 
@@ -89,32 +114,70 @@ using Event = std::variant<
     HeadphonesEvent,
     RecordingEvent,
     NRFPacketEvent,
-    NRFTxEvent
+    NRFTxEvent,
+    GestureEvent,
+    NRFScanEvent
 >;
 
+/** Default priority policy of the event queue where all events are served in the order they were sent. 
+ 
+    A policy provides the number of lanes and a static of() function that returns the lane of given event. Lane 0 has the highest priority.
+ */
+struct SingleLane {
+    static constexpr size_t LANES = 1;
+
+    template<typename T>
+    static size_t of(T const &) { return 0; }
+}; // SingleLane
+
 /** Event queue.
+
+    A bounded multi-producer queue built on top of the lock-free utils::BoundedQueue so that neither the ISR threads, nor the recording path ever block on a mutex held by the consumer. Sending to a full queue drops the event and increments the overflow counter instead of growing the queue - the queue never allocates.
+
+    Only a single thread may consume the events (the driver's hw loop for the driver queue, the UI thread for the UI queue). The consumer is woken up via an eventfd, which is only signalled when the consumer announced it is about to block so that a busy queue costs no syscalls at all. The eventfd is exposed via fd() so that the consumer can wait for it together with other file descriptors.
+
+    The PRIORITY policy splits the queue into lanes, each of them with its own CAPACITY. Events within a lane are received in the order they were sent, but an event is only received when all lanes of higher priority are empty. 
  */
-template<typename T> 
+template<typename T, size_t CAPACITY = 256, typename PRIORITY = SingleLane> 
 class EventQueue {
 public:
 
+    static constexpr size_t LANES = PRIORITY::LANES;
+
+    EventQueue():
+        efd_{eventfd(0, EFD_CLOEXEC)} {
+    }
+
+    ~EventQueue() {
+        close(efd_);
+    }
+
     /** Sends new event to the queue. 
+     
+        Returns true if the event was enqueued, false if the queue was full and the event has been dropped.
      */
-    void send(T && event) {
-        std::lock_guard<std::mutex> g{m_};
-        q_.push(std::move(event));
-        cv_.notify_all();
+    bool send(T && event) {
+        size_t lane = PRIORITY::of(event);
+        if (! q_[lane].push(std::move(event))) {
+            overflows_[lane].fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        // only wake the consumer if it announced it is about to block, the fence orders the push before the check (pairs with the one in prepareWait())
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping_.load(std::memory_order_relaxed) && sleeping_.exchange(false))
+            notify();
+        return true;
     }
 
+    /** Returns the oldest event of the highest priority lane that is not empty, or nothing if all lanes are empty.
+     */
     std::optional<T> receive() {
-        std::lock_guard<std::mutex> g{m_};
-        if (!q_.empty()) {
-            auto x = std::move(q_.front());
-            q_.pop();
-            return x;
-        } else {
-            return {};
+        for (auto & q : q_) {
+            std::optional<T> x = q.pop();
+            if (x.has_value())
+                return x;
         }
+        return std::nullopt;
     }
 
     /** Returns the number of events currently in the queue and if the queue is not empty, pops the front and returns it. 
@@ -122,27 +185,208 @@ public:
         I.e. if the result != 0, the event is valid. If the result is 1 no need to call again immediately. 
     */
     size_t tryReceive(Event & event) {
-        std::lock_guard<std::mutex> g{m_};
-        size_t result = q_.size();
-        if (result > 0) {
-            event = std::move(q_.front());
-            q_.pop();
-        }
+        std::optional<T> x = receive();
+        if (! x.has_value())
+            return 0;
+        size_t result = size() + 1;
+        event = std::move(x.value());
         return result;
     }
 
     /** Returns next event, if the queue is empty waits for new event to be sent.
      */
     T waitReceive() {
-        std::unique_lock<std::mutex> g{m_};
-        cv_.wait(g, [this](){ return ! q_.empty(); });
-        auto x = std::move(q_.front());
-        q_.pop();
-        return x;
+        while (true) {
+            for (size_t i = 0; i < SPIN_BEFORE_WAIT; ++i) {
+                std::optional<T> x = receive();
+                if (x.has_value())
+                    return std::move(x.value());
+                std::this_thread::yield();
+            }
+            if (prepareWait())
+                wait();
+        }
+    }
+
+    /** Announces that the consumer is about to block on the queue. Returns false if the queue is not empty after all, in which case the consumer should not block. 
+     
+        When true is returned, the consumer may block either via wait(), or by polling fd() for readability and then calling wait() to clear the notification. A consumer that polls fd() together with other descriptors must call finishWait() once the poll returns, whatever woke it up.
+     */
+    bool prepareWait() {
+        sleeping_.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (size() == 0) 
+            return true;
+        sleeping_.store(false);
+        return false;
+    }
+
+    /** Announces that the consumer is awake again after prepareWait() so that producers stop writing to the eventfd. Called when the consumer's poll returns for any reason, such as a timer, without receiving the queue's notification.
+     */
+    void finishWait() { sleeping_.store(false); }
+
+    /** Blocks until the queue is signalled as non-empty. Spurious wakeups are possible, the caller must retry the receive afterwards. 
+     */
+    void wait() {
+        uint64_t x;
+        while (read(efd_, & x, sizeof(x)) < 0 && errno == EINTR) {}
+    }
+
+    /** Blocks for at most timeoutMs milliseconds (-1 waits indefinitely) until the queue is signalled as non-empty. Returns false if the wait timed out. 
+     
+        Like wait(), spurious wakeups are possible so true only means the caller should try to receive. 
+     */
+    bool waitFor(int timeoutMs) {
+        if (! prepareWait())
+            return true;
+        pollfd p{efd_, POLLIN, 0};
+        int n;
+        while ((n = poll(& p, 1, timeoutMs)) < 0 && errno == EINTR) {}
+        finishWait();
+        if (n <= 0)
+            return false;
+        wait();
+        return true;
+    }
+
+    /** File descriptor which becomes readable when the consumer should wake up. 
+     */
+    int fd() const { return efd_; }
+
+    /** Number of events currently in the queue. 
+     */
+    size_t size() const { 
+        size_t result = 0;
+        for (auto & q : q_)
+            result += q.size();
+        return result; 
     }
 
+    /** Number of events currently in given lane. 
+     */
+    size_t size(size_t lane) const { return q_[lane].size(); }
+
+    /** Capacity of a single lane. 
+     */
+    static constexpr size_t capacity() { return CAPACITY; }
+
+    /** Number of events dropped so far because their lane was full. 
+     */
+    size_t overflows() const { 
+        size_t result = 0;
+        for (auto & x : overflows_)
+            result += x.load(std::memory_order_relaxed);
+        return result;
+    }
+
+    /** Number of events dropped so far because given lane was full. 
+     */
+    size_t overflows(size_t lane) const { return overflows_[lane].load(std::memory_order_relaxed); }
+
 private:
-    std::queue<T> q_;
-    std::mutex m_;
-    std::condition_variable cv_;
+
+    /** Number of times the consumer yields and retries before it blocks. Producers usually send events in short bursts so that this saves the wakeup syscalls for most of them. */
+    static constexpr size_t SPIN_BEFORE_WAIT = 4;
+
+    void notify() {
+        uint64_t x = 1;
+        while (write(efd_, & x, sizeof(x)) < 0 && errno == EINTR) {}
+    }
+
+    utils::BoundedQueue<T, CAPACITY> q_[LANES];
+    /** Set by the consumer just before it blocks so that producers only pay for the eventfd write when someone is actually waiting. */
+    std::atomic<bool> sleeping_{false};
+    std::atomic<size_t> overflows_[LANES] = {};
+    int efd_;
 }; // EventQueue
+
+/** UI event queue. 
+
+    The UI thread may stall for a long time (loading textures, etc.) during which the high-rate state updates would pile up in the queue and then be replayed one by one. To avoid this, the latest-value-wins events (JoyEvent, AccelEvent, StateChangeEvent and Hearts) are coalesced: at most one of each kind is in the queue at any time and when it is received it carries the latest value sent. All other events, such as ButtonEvent and RecordingEvent are delivered in order, unchanged. 
+
+    The coalescing is lock-free as well: the latest value of each kind lives in an atomic slot next to a flag that tells whether an event of that kind is already waiting in the queue. 
+ */
+template<size_t CAPACITY = 256>
+class UIEventQueue {
+public:
+
+    bool send(Event && event) {
+        int slot = coalescingSlot(event);
+        if (slot >= 0) {
+            latest_[slot].store(pack(event));
+            if (queued_[slot].exchange(true)) {
+                coalesced_.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+            if (! q_.send(std::move(event))) {
+                queued_[slot].store(false);
+                return false;
+            }
+            return true;
+        }
+        return q_.send(std::move(event));
+    }
+
+    std::optional<Event> receive() {
+        std::optional<Event> e = q_.receive();
+        if (e.has_value()) {
+            int slot = coalescingSlot(e.value());
+            // clear the flag first so that any value sent after we read the slot enqueues a new event
+            if (slot >= 0) {
+                queued_[slot].store(false);
+                unpack(e.value(), latest_[slot].load());
+            }
+        }
+        return e;
+    }
+
+    bool waitFor(int timeoutMs) { return q_.waitFor(timeoutMs); }
+
+    int fd() const { return q_.fd(); }
+
+    size_t size() const { return q_.size(); }
+
+    size_t overflows() const { return q_.overflows(); }
+
+    /** Number of events that were merged into an already queued event of the same kind. 
+     */
+    size_t coalesced() const { return coalesced_.load(std::memory_order_relaxed); }
+
+private:
+
+    static constexpr int NUM_SLOTS = 4;
+
+    static int coalescingSlot(Event const & e) {
+        return std::visit(overloaded{
+            [](JoyEvent const &) { return 0; },
+            [](AccelEvent const &) { return 1; },
+            [](StateChangeEvent const &) { return 2; },
+            [](Hearts const &) { return 3; },
+            [](auto const &) { return -1; },
+        }, e);
+    }
+
+    static uint16_t pack(Event const & e) {
+        return std::visit(overloaded{
+            [](JoyEvent const & x) { return static_cast<uint16_t>((x.h << 8) | x.v); },
+            [](AccelEvent const & x) { return static_cast<uint16_t>((x.h << 8) | x.v); },
+            [](Hearts const & x) { return x.value; },
+            [](auto const &) { return static_cast<uint16_t>(0); },
+        }, e);
+    }
+
+    static void unpack(Event & e, uint16_t value) {
+        std::visit(overloaded{
+            [value](JoyEvent & x) { x.h = value >> 8; x.v = value & 0xff; },
+            [value](AccelEvent & x) { x.h = value >> 8; x.v = value & 0xff; },
+            [value](Hearts & x) { x.value = value; },
+            [](auto &) { },
+        }, e);
+    }
+
+    EventQueue<Event, CAPACITY> q_;
+    std::atomic<uint16_t> latest_[NUM_SLOTS] = {};
+    std::atomic<bool> queued_[NUM_SLOTS] = {};
+    std::atomic<size_t> coalesced_{0};
+
+}; // UIEventQueue
@@ -90,6 +90,9 @@ protected:
             window().back();
     }
 
+    // check whether the process is still running even if there is nothing to redraw
+    int tickInterval() const override { return UI_IDLE_TICK_MS; }
+
     void draw(Canvas &) override {
         cancelRedraw();
     }
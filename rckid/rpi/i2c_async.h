@@ -0,0 +1,348 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+#include "platform/platform.h"
+
+#include "events.h"
+#include "i2c_scheduler.h"
+#include "trace.h"
+
+/** Executes the I2C transactions in a worker thread so that the driver thread does not block on the bus.
+
+    The driver builds a transaction of up to MAX_TRANSFERS transfers (each a write followed by a read from the same device), submits it and gets on with other events, such as the buttons. The worker executes the transactions in the order they were submitted and puts the finished ones to the completion queue. It then calls the notify function given to start(), which the driver uses to wake itself up. The driver takes the finished transactions with nextFinished() and passes them to complete(), so that the completion callbacks run in the driver thread, in the order the transactions were executed, and can access its state freely. That is the order in which they were submitted, except for a needsStop() transaction, which goes after the transactions merged with it (see below). The transactions of a single device always complete in the order they were submitted.
+
+    Every submitted transaction is completed exactly once, those that could not be executed with ok() being false. At most MAX_PENDING transactions can be submitted and not yet completed, so the completion queue never overflows. When there are more, submit() completes the transaction as failed right away.
+
+    Transactions that are queued at the same time and talk to different devices are executed in a single I2C_RDWR ioctl, e.g. the accelerometer and the AVR state. Transactions to the same device are never merged so that each of them ends with a stop condition the device can act upon, like the AVR processing a command before the next read. Devices that only finish their transfers on a stop condition (the AVR) mark their transactions with needsStop(), such transaction is always last in the merged ioctl and there can be at most one of them. If the merged ioctl fails, its transactions are executed again one by one, so that a device which does not acknowledge (such as a missing accelerometer) only fails its own transactions. The transfers before the failed one are thus repeated. This is harmless for plain register reads and writes, but not for reads that consume the data, such as the accelerometer's FIFO. Such transactions are marked with once() and fail with the merged ioctl instead of being repeated.
+
+    When tracing, the merged ioctls and their retries are marked in the trace so that the replay, which executes the transactions one by one, can skip the superseded responses.
+
+    Until started (and when replaying a trace) the engine is synchronous, i.e. the transactions are executed and their callbacks called right away in the submitting thread.
+ */
+class AsyncI2C {
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    class Transaction {
+    public:
+
+        using Callback = std::function<void(Transaction &)>;
+
+        static constexpr size_t MAX_TRANSFERS = 4;
+        static constexpr size_t BUFFER_SIZE = 256;
+
+        Transaction(I2CScheduler::Client client, Callback done = nullptr):
+            client_{client},
+            done_{std::move(done)} {
+        }
+
+        Transaction(Transaction const &) = delete;
+        Transaction & operator = (Transaction const &) = delete;
+
+        /** Adds a write of the given bytes (copied to the transaction) followed by a read of rsize bytes from the device.
+         */
+        Transaction & transfer(uint8_t address, void const * wb, uint8_t wsize, uint8_t rsize) {
+            if (numTransfers_ == MAX_TRANSFERS || used_ + wsize + rsize > BUFFER_SIZE)
+                throw std::runtime_error{STR("I2C transaction too large")};
+            Part & p = parts_[numTransfers_++];
+            p.address = address;
+            p.offset = used_;
+            p.wsize = wsize;
+            p.rsize = rsize;
+            if (wsize > 0)
+                memcpy(buffer_ + used_, wb, wsize);
+            used_ += wsize + rsize;
+            return *this;
+        }
+
+        Transaction & write(uint8_t address, void const * wb, uint8_t wsize) { return transfer(address, wb, wsize, 0); }
+
+        Transaction & read(uint8_t address, uint8_t rsize) { return transfer(address, nullptr, 0, rsize); }
+
+        /** Marks the transaction as one that must end with a stop condition.
+         */
+        Transaction & needsStop() {
+            needsStop_ = true;
+            return *this;
+        }
+
+        /** Marks the transaction as one that must not be executed twice, such as a read that pops the data from the device. If its merged ioctl fails, the transaction fails, too, instead of being repeated. 
+         */
+        Transaction & once() {
+            once_ = true;
+            return *this;
+        }
+
+        I2CScheduler::Client client() const { return client_; }
+
+        /** Returns true if the transaction has been acknowledged.
+         */
+        bool ok() const { return ok_; }
+
+        /** Bytes read by the i-th transfer.
+         */
+        uint8_t const * result(size_t i = 0) const { return buffer_ + parts_[i].offset + parts_[i].wsize; }
+
+        /** Bus time of the transaction. If merged with others, the time of the whole ioctl is split by the number of bytes transferred.
+         */
+        Clock::duration busTime() const { return busTime_; }
+
+        /** Time the transaction (or the merged ioctl it was part of) started on the bus.
+         */
+        Clock::time_point started() const { return started_; }
+
+    private:
+
+        friend class AsyncI2C;
+
+        struct Part {
+            uint8_t address;
+            uint8_t wsize;
+            uint8_t rsize;
+            size_t offset;
+        };
+
+        bool sharesDevice(Transaction const & other) const {
+            for (size_t i = 0; i < numTransfers_; ++i)
+                for (size_t j = 0; j < other.numTransfers_; ++j)
+                    if (parts_[i].address == other.parts_[j].address)
+                        return true;
+            return false;
+        }
+
+        size_t appendTo(platform::i2c::Transfer * transfers) {
+            for (size_t i = 0; i < numTransfers_; ++i) {
+                Part & p = parts_[i];
+                transfers[i] = platform::i2c::Transfer{p.address, buffer_ + p.offset, p.wsize, buffer_ + p.offset + p.wsize, p.rsize};
+            }
+            return numTransfers_;
+        }
+
+        I2CScheduler::Client client_;
+        Callback done_;
+        Part parts_[MAX_TRANSFERS];
+        size_t numTransfers_ = 0;
+        uint8_t buffer_[BUFFER_SIZE];
+        size_t used_ = 0;
+        bool needsStop_ = false;
+        bool once_ = false;
+        bool ok_ = false;
+        Clock::duration busTime_{0};
+        Clock::time_point started_;
+    }; // AsyncI2C::Transaction
+
+    /** Maximum number of transactions submitted and not yet completed. 
+     */
+    static constexpr size_t MAX_PENDING = 64;
+
+    /** Called by the worker after it has added finished transactions to the completion queue.
+     */
+    using Notify = std::function<void()>;
+
+    ~AsyncI2C() { 
+        stop(); 
+        // the callbacks of what is left can't be called anymore
+        while (std::optional<Transaction *> t = finished_.pop())
+            delete t.value();
+    }
+
+    /** Starts the worker thread.
+     */
+    void start(Notify notify) {
+        if (worker_.joinable())
+            return;
+        notify_ = std::move(notify);
+        worker_ = std::thread{[this](){ loop(); }};
+    }
+
+    /** Stops the worker thread after it finishes the transactions already submitted. The engine is synchronous afterwards.
+     */
+    void stop() {
+        if (!worker_.joinable())
+            return;
+        while (!queue_.send(nullptr))
+            std::this_thread::yield();
+        worker_.join();
+    }
+
+    /** Submits the transaction. Returns false if there are already MAX_PENDING transactions pending, in which case the transaction is completed as failed before the function returns. 
+     
+        Only to be called from the thread that completes the transactions.
+     */
+    bool submit(std::unique_ptr<Transaction> t) {
+        if (!worker_.joinable()) {
+            Transaction * batch[] = { t.get() };
+            execute(batch, 1);
+            complete(t.release(), false);
+            return true;
+        }
+        if (pending_ == MAX_PENDING || !queue_.send(t.get())) {
+            ++dropped_;
+            t->ok_ = false;
+            complete(t.release(), false);
+            return false;
+        }
+        t.release();
+        ++pending_;
+        return true;
+    }
+
+    /** Returns the oldest finished transaction that has not been completed yet, or nullptr if there is none. 
+     */
+    Transaction * nextFinished() {
+        std::optional<Transaction *> t = finished_.pop();
+        return t.has_value() ? t.value() : nullptr;
+    }
+
+    /** Calls the callback of a transaction returned by nextFinished() and deletes it.
+     */
+    void complete(Transaction * t) { complete(t, true); }
+
+    /** Sets the trace to which the merged ioctls and their retries are recorded, nullptr to stop.
+     */
+    void setTrace(Trace::Writer * trace) { trace_ = trace; }
+
+    /** Number of ioctls executed and number of transactions that were merged with others in them.
+     */
+    size_t batches() const { return batches_.load(std::memory_order_relaxed); }
+    size_t merged() const { return merged_.load(std::memory_order_relaxed); }
+
+    /** Number of merged ioctls that failed and were executed again one transaction at a time. 
+     */
+    size_t retried() const { return retried_.load(std::memory_order_relaxed); }
+
+    /** Number of transactions failed by submit() because too many were pending. 
+     */
+    size_t dropped() const { return dropped_; }
+
+private:
+
+    void complete(Transaction * t, bool wasPending) {
+        if (wasPending)
+            --pending_;
+        std::unique_ptr<Transaction> x{t};
+        if (x->done_)
+            x->done_(*x);
+    }
+
+    void loop() {
+        Transaction * next = nullptr;
+        bool stopping = false;
+        while (!stopping) {
+            Transaction * t = (next != nullptr) ? next : queue_.waitReceive();
+            next = nullptr;
+            if (t == nullptr)
+                return;
+            Transaction * batch[platform::i2c::MAX_TRANSFERS];
+            size_t n = 0;
+            size_t transfers = 0;
+            Transaction * last = nullptr;
+            // add the transactions that are already waiting while they are compatible
+            while (true) {
+                transfers += t->numTransfers_;
+                if (t->needsStop_)
+                    last = t;
+                else
+                    batch[n++] = t;
+                std::optional<Transaction *> x = queue_.receive();
+                if (!x.has_value())
+                    break;
+                t = x.value();
+                // the stop request is served after the batch
+                if (t == nullptr) {
+                    stopping = true;
+                    break;
+                }
+                if (!canMerge(t, batch, n, last, transfers)) {
+                    next = t;
+                    break;
+                }
+            }
+            if (last != nullptr)
+                batch[n++] = last;
+            execute(batch, n);
+            // never fails as there is at most MAX_PENDING transactions in flight
+            for (size_t i = 0; i < n; ++i)
+                finished_.push(std::move(batch[i]));
+            notify_();
+        }
+    }
+
+    static bool canMerge(Transaction const * t, Transaction * const * batch, size_t n, Transaction const * last, size_t transfers) {
+        if (transfers + t->numTransfers_ > platform::i2c::MAX_TRANSFERS)
+            return false;
+        if (last != nullptr && (t->needsStop_ || last->sharesDevice(*t)))
+            return false;
+        for (size_t i = 0; i < n; ++i)
+            if (batch[i]->sharesDevice(*t))
+                return false;
+        return true;
+    }
+
+    void execute(Transaction ** batch, size_t n) {
+        Trace::Writer * trace = trace_;
+        if (trace != nullptr && n > 1)
+            trace->i2cBatch();
+        if (transmit(batch, n) || n == 1)
+            return;
+        if (trace != nullptr) {
+            uint8_t addresses[platform::i2c::MAX_TRANSFERS];
+            size_t numAddresses = 0;
+            for (size_t i = 0; i < n; ++i)
+                if (!batch[i]->once_)
+                    for (size_t j = 0; j < batch[i]->numTransfers_; ++j)
+                        addresses[numAddresses++] = batch[i]->parts_[j].address;
+            trace->i2cRetry(addresses, numAddresses);
+        }
+        retried_.fetch_add(1, std::memory_order_relaxed);
+        for (size_t i = 0; i < n; ++i)
+            if (!batch[i]->once_)
+                transmit(batch + i, 1);
+    }
+
+    /** Executes the transactions in a single ioctl and returns true if it succeeded.
+     */
+    bool transmit(Transaction ** batch, size_t n) {
+        platform::i2c::Transfer transfers[platform::i2c::MAX_TRANSFERS];
+        size_t numTransfers = 0;
+        size_t bytes = 0;
+        for (size_t i = 0; i < n; ++i) {
+            numTransfers += batch[i]->appendTo(transfers + numTransfers);
+            bytes += batch[i]->used_;
+        }
+        Clock::time_point start = Clock::now();
+        bool ok = platform::i2c::transmit(transfers, numTransfers);
+        Clock::duration d = Clock::now() - start;
+        for (size_t i = 0; i < n; ++i) {
+            batch[i]->ok_ = ok;
+            batch[i]->started_ = start;
+            batch[i]->busTime_ = (n == 1 || bytes == 0) ? d / n : d * batch[i]->used_ / bytes;
+        }
+        batches_.fetch_add(1, std::memory_order_relaxed);
+        if (n > 1)
+            merged_.fetch_add(n, std::memory_order_relaxed);
+        return ok;
+    }
+
+    /** Submitted transactions, nullptr stops the worker. Larger than MAX_PENDING so that the stop request always fits. */
+    EventQueue<Transaction *, 2 * MAX_PENDING> queue_;
+    utils::BoundedQueue<Transaction *, MAX_PENDING> finished_;
+    std::thread worker_;
+    Notify notify_;
+    /** Transactions submitted to the worker and not yet completed, only accessed by the completing thread. */
+    size_t pending_ = 0;
+    size_t dropped_ = 0;
+    std::atomic<size_t> batches_{0};
+    std::atomic<size_t> merged_{0};
+    std::atomic<size_t> retried_{0};
+    std::atomic<Trace::Writer *> trace_{nullptr};
+
+}; // AsyncI2C
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#include "common/config.h"
+
+/** Shares the I2C bus between the devices the driver talks to.
+
+    The bus time is accounted per client, i.e. per kind of traffic. The recording reads, the AVR input reads and the commands are never limited, they are served as soon as the driver gets to them, which for the recording and input is before anything else, thanks to the driver event lanes. The periodic polls (the accelerometer and the AVR's extended state) have a budget, a share of the bus time they may use, and are only served when they have not used it up and when the bus was not too busy recently, so that they fill whatever capacity is left instead of being switched off whenever the bus is needed for something more important.
+
+    The budgets are token buckets in microseconds of bus time refilled at the client's share, which can hold up to I2C_BUDGET_WINDOW_US worth of the share. The recent bus load is an exponentially decaying sum of the bus time with the same window. All of the accounting is done by the driver's thread, only the statistics can be read from other threads.
+ */
+class I2CScheduler {
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    /** Kinds of the bus traffic, in order of priority.
+     */
+    enum class Client {
+        /** Audio recording bursts from the AVR. Not limited. */
+        Recording,
+        /** AVR state reads after AVR_IRQ. Not limited. */
+        AvrInput,
+        /** Commands sent to the AVR. Not limited. */
+        AvrCommand,
+        /** The periodic AVR extended state reads. */
+        AvrExtendedState,
+        /** The accelerometer polls. */
+        Accel,
+    };
+
+    static constexpr size_t NUM_CLIENTS = 5;
+
+    /** Budget of clients that are not limited. */
+    static constexpr unsigned UNLIMITED = 100;
+
+    I2CScheduler() {
+        for (auto & b : budget_)
+            b = UNLIMITED;
+        budget_[static_cast<size_t>(Client::AvrExtendedState)] = I2C_BUDGET_AVR_EXTENDED_STATE;
+        budget_[static_cast<size_t>(Client::Accel)] = I2C_BUDGET_ACCEL;
+        last_ = Clock::now();
+        windowStart_ = last_;
+    }
+
+    /** Sets the share of the bus time in percent the client may use. 0 disables the client, 100 (UNLIMITED) does not limit it at all.
+     */
+    void setBudget(Client c, unsigned percent) {
+        budget_[static_cast<size_t>(c)] = std::min(percent, UNLIMITED);
+    }
+
+    unsigned budget(Client c) const { return budget_[static_cast<size_t>(c)]; }
+
+    /** Returns true if the client may use the bus now. If not, the request is counted as deferred.
+     */
+    bool admit(Client c) {
+        size_t i = static_cast<size_t>(c);
+        if (budget_[i] == UNLIMITED)
+            return true;
+        update(Clock::now());
+        if (budget_[i] > 0 && tokens_[i] > 0 && load_ < I2C_MAX_UTILIZATION * I2C_BUDGET_WINDOW_US / 100)
+            return true;
+        deferred_[i].fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    /** Accounts the bus time used by the client.
+     */
+    void account(Client c, Clock::duration d) {
+        size_t i = static_cast<size_t>(c);
+        int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+        update(Clock::now());
+        load_ += us;
+        if (budget_[i] != UNLIMITED)
+            tokens_[i] -= us;
+        busy_[i] += us;
+        transactions_[i].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /** If the client is admitted, calls the function doing the transaction(s) and accounts the time it took. Returns true if the function was called.
+     */
+    template<typename F>
+    bool run(Client c, F && f) {
+        if (!admit(c))
+            return false;
+        Clock::time_point t = Clock::now();
+        f();
+        account(c, Clock::now() - t);
+        return true;
+    }
+
+    /** Updates the utilization statistics of the last second. To be called every second.
+     */
+    void secondTick() {
+        Clock::time_point t = Clock::now();
+        int64_t us = std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::microseconds>(t - windowStart_).count());
+        int64_t total = 0;
+        for (size_t i = 0; i < NUM_CLIENTS; ++i) {
+            total += busy_[i];
+            utilization_[i] = static_cast<unsigned>(busy_[i] * 100 / us);
+            busy_[i] = 0;
+        }
+        totalUtilization_ = static_cast<unsigned>(total * 100 / us);
+        windowStart_ = t;
+    }
+
+    /** Percentage of the last second the bus was used.
+     */
+    unsigned utilization() const { return totalUtilization_.load(); }
+
+    /** Percentage of the last second the bus was used by given client.
+     */
+    unsigned utilization(Client c) const { return utilization_[static_cast<size_t>(c)].load(); }
+
+    /** Number of transactions of the client so far.
+     */
+    size_t transactions(Client c) const { return transactions_[static_cast<size_t>(c)].load(std::memory_order_relaxed); }
+
+    /** Number of times the client was refused the bus so far.
+     */
+    size_t deferred(Client c) const { return deferred_[static_cast<size_t>(c)].load(std::memory_order_relaxed); }
+
+private:
+
+    /** Refills the budgets and decays the recent load for the time elapsed since the last update.
+     */
+    void update(Clock::time_point t) {
+        int64_t dt = std::chrono::duration_cast<std::chrono::microseconds>(t - last_).count();
+        if (dt <= 0)
+            return;
+        last_ = t;
+        for (size_t i = 0; i < NUM_CLIENTS; ++i)
+            if (budget_[i] != UNLIMITED)
+                tokens_[i] = std::min<int64_t>(tokens_[i] + dt * budget_[i] / 100, I2C_BUDGET_WINDOW_US * budget_[i] / 100);
+        load_ = (dt >= I2C_BUDGET_WINDOW_US) ? 0 : load_ - load_ * dt / I2C_BUDGET_WINDOW_US;
+    }
+
+    unsigned budget_[NUM_CLIENTS];
+    /** Bus time in microseconds each client may still use, can go negative when a transaction took longer than the budget left. */
+    int64_t tokens_[NUM_CLIENTS] = {};
+    /** Decaying sum of the bus time of all clients in microseconds. */
+    int64_t load_ = 0;
+    Clock::time_point last_;
+
+    /** Bus time per client in the current second. */
+    int64_t busy_[NUM_CLIENTS] = {};
+    Clock::time_point windowStart_;
+    std::atomic<unsigned> utilization_[NUM_CLIENTS] = {};
+    std::atomic<unsigned> totalUtilization_{0};
+    std::atomic<size_t> transactions_[NUM_CLIENTS] = {};
+    std::atomic<size_t> deferred_[NUM_CLIENTS] = {};
+
+}; // I2CScheduler
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <linux/input.h>
+
+/** Accumulates the evdev events of a single input frame so that they can be emitted as one synchronized report.
+
+    All button and axis changes detected from a single AVR state read, or a burst of gpio interrupts are added to the frame and then flushed together with a single EV_SYN/SYN_REPORT, so that e.g. a D-pad diagonal pressed together with a face button arrives to the emulator as one report instead of three.
+
+    If the same event code changes twice within a frame (e.g. a press and release processed together), the frame is flushed before the second change so that no change is lost. The same happens when the frame is full. The frame does not know anything about libevdev, events are written to a sink function taking the type, code and value, which makes it easy to test.
+ */
+template<size_t CAPACITY = 32>
+class InputFrame {
+public:
+
+    /** Adds the event to the frame, flushing it first to the sink if necessary.
+     */
+    template<typename SINK>
+    void add(uint16_t type, uint16_t code, int32_t value, SINK && sink) {
+        if (size_ == CAPACITY || contains(type, code))
+            flush(sink);
+        events_[size_++] = Event{type, code, value};
+    }
+
+    /** Writes all events in the frame followed by the synchronization report to the sink. Does nothing if the frame is empty.
+     */
+    template<typename SINK>
+    void flush(SINK && sink) {
+        if (size_ == 0)
+            return;
+        for (size_t i = 0; i < size_; ++i)
+            sink(events_[i].type, events_[i].code, events_[i].value);
+        sink(EV_SYN, SYN_REPORT, 0);
+        size_ = 0;
+        ++reports_;
+    }
+
+    bool empty() const { return size_ == 0; }
+
+    size_t size() const { return size_; }
+
+    /** Number of reports flushed so far.
+     */
+    size_t reports() const { return reports_; }
+
+private:
+
+    struct Event {
+        uint16_t type;
+        uint16_t code;
+        int32_t value;
+    };
+
+    bool contains(uint16_t type, uint16_t code) const {
+        for (size_t i = 0; i < size_; ++i)
+            if (events_[i].type == type && events_[i].code == code)
+                return true;
+        return false;
+    }
+
+    Event events_[CAPACITY];
+    size_t size_ = 0;
+    size_t reports_ = 0;
+
+}; // InputFrame
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <string>
+
+/** Clock used for the input latency timestamps. Monotonic so that the measurements survive the wall clock being set.
+ */
+using LatencyClock = std::chrono::steady_clock;
+
+/** Input latency statistics.
+
+    Input events (gpio edges and AVR interrupts) are timestamped as soon as they are detected and the timestamp travels with the event through the driver to the UI. At each stage, the time elapsed since the interrupt is recorded. For each stage the last SAMPLES measurements are kept in a lock-free ring, from which the percentiles are calculated, and a log2 histogram of all measurements is kept as well.
+
+    Recording is wait-free and can be done from any thread, reading the statistics while they are being recorded only gives approximate results, which is fine for their purpose.
+ */
+class LatencyStats {
+public:
+
+    enum class Stage {
+        /** The event was taken from the driver's queue. */
+        Dequeue,
+        /** The input frame containing the change was written to the evdev device. */
+        Evdev,
+        /** The event was dispatched to the active widget. */
+        UI,
+        /** The first frame drawn after the event was dispatched is on the screen (time to first pixel). */
+        Frame,
+    };
+
+    static constexpr size_t NUM_STAGES = 4;
+    static constexpr size_t SAMPLES = 1024;
+    static constexpr size_t BUCKETS = 32;
+
+    static char const * stageName(Stage stage) {
+        switch (stage) {
+            case Stage::Dequeue:
+                return "dequeue";
+            case Stage::Evdev:
+                return "evdev";
+            case Stage::UI:
+                return "ui";
+            case Stage::Frame:
+                return "frame";
+            default:
+                return "???";
+        }
+    }
+
+    struct Summary {
+        size_t count;
+        uint32_t p50;
+        uint32_t p99;
+        uint32_t max;
+    };
+
+    /** Records the time elapsed since the given origin for the stage. Does nothing if the origin is not set.
+     */
+    void record(Stage stage, LatencyClock::time_point origin) {
+        if (origin == LatencyClock::time_point{})
+            return;
+        int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(LatencyClock::now() - origin).count();
+        uint32_t value = static_cast<uint32_t>(std::clamp<int64_t>(us, 0, UINT32_MAX));
+        Ring & r = rings_[static_cast<size_t>(stage)];
+        size_t i = r.next.fetch_add(1, std::memory_order_relaxed);
+        r.samples[i % SAMPLES].store(value, std::memory_order_relaxed);
+        r.histogram[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /** Returns the number of measurements and the percentiles (in microseconds) of the last SAMPLES measurements of the stage.
+     */
+    Summary summary(Stage stage) const {
+        Ring const & r = rings_[static_cast<size_t>(stage)];
+        size_t count = r.next.load(std::memory_order_relaxed);
+        size_t n = std::min(count, SAMPLES);
+        if (n == 0)
+            return Summary{0, 0, 0, 0};
+        uint32_t sorted[SAMPLES];
+        for (size_t i = 0; i < n; ++i)
+            sorted[i] = r.samples[i].load(std::memory_order_relaxed);
+        std::sort(sorted, sorted + n);
+        return Summary{count, sorted[n / 2], sorted[n * 99 / 100], sorted[n - 1]};
+    }
+
+    /** Writes the summaries and the histograms of all stages to given file. Returns false if the file can't be written.
+     */
+    bool dump(std::string const & filename) const {
+        std::ofstream f{filename};
+        if (! f.good())
+            return false;
+        for (size_t s = 0; s < NUM_STAGES; ++s) {
+            Stage stage = static_cast<Stage>(s);
+            Summary x = summary(stage);
+            f << stageName(stage) << ": count " << x.count << ", p50 " << x.p50 << "us, p99 " << x.p99 << "us, max " << x.max << "us" << std::endl;
+            for (size_t b = 0; b < BUCKETS; ++b) {
+                size_t n = rings_[s].histogram[b].load(std::memory_order_relaxed);
+                if (n != 0)
+                    f << "    < " << (1ull << b) << "us: " << n << std::endl;
+            }
+        }
+        return f.good();
+    }
+
+private:
+
+    /** Bucket b holds values smaller than 2^b microseconds.
+     */
+    static size_t bucket(uint32_t value) {
+        size_t b = 0;
+        while (b < BUCKETS - 1 && (1u << b) <= value)
+            ++b;
+        return b;
+    }
+
+    struct Ring {
+        std::atomic<size_t> next{0};
+        std::atomic<uint32_t> samples[SAMPLES] = {};
+        std::atomic<size_t> histogram[BUCKETS] = {};
+    };
+
+    Ring rings_[NUM_STAGES];
+
+}; // LatencyStats
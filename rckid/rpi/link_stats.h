@@ -0,0 +1,191 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+
+/** Radio link statistics, per peer.
+
+    The apps report the packets they receive, identified by the link they came by, i.e. the peer's name and for peers with more than one packet stream, the stream as well. Where the protocol has sequence numbers (the walkie-talkie's heartbeats and PTT audio), the last 256 of them are kept in a bitmask ring, which gives the loss over the last 16, 64 and 128 packets and detects duplicates (the same packet received twice). A late packet fills its gap in the ring again. For all packets the interval between them and its jitter, i.e. the mean deviation from the average interval, is tracked.
+
+    The transmitter side is not per peer as all the apps broadcast. The driver reports the packets transmitted and those the radio gave up on after the retransmits (NRFTxEvent).
+
+    The statistics are only accessed from the UI thread. dump() appends them to a file so that the range and the bitrate can be tuned with real data.
+ */
+class LinkStats {
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    /** Windows, in packets, over which the loss is reported. */
+    static constexpr unsigned NUM_WINDOWS = 3;
+    static constexpr unsigned WINDOWS[NUM_WINDOWS] = { 16, 64, 128 };
+
+    class Peer {
+    public:
+
+        /** Records a packet with the given sequence number. Returns false if the packet is a duplicate.
+
+            Sequence numbers up to 127 behind the newest one are late packets, or duplicates, all others are new.
+         */
+        bool received(uint8_t seq, Clock::time_point t = Clock::now()) {
+            if (!sequenced_) {
+                sequenced_ = true;
+                last_ = seq;
+                span_ = 1;
+                set(seq, true);
+            } else {
+                uint8_t ahead = seq - last_;
+                if (ahead == 0 || ahead >= 128) {
+                    if (test(seq)) {
+                        ++duplicates_;
+                        return false;
+                    }
+                    if (lost_ > 0)
+                        --lost_;
+                } else {
+                    for (uint8_t s = last_ + 1; s != seq; ++s) {
+                        set(s, false);
+                        ++lost_;
+                    }
+                    last_ = seq;
+                    span_ = std::min<unsigned>(256, span_ + ahead);
+                }
+                set(seq, true);
+            }
+            received(t);
+            return true;
+        }
+
+        /** Records a packet without sequence number, which only counts for the number of packets and their timing.
+         */
+        void received(Clock::time_point t = Clock::now()) {
+            if (packets_++ > 0 && t >= lastSeen_) {
+                float interval = std::chrono::duration_cast<std::chrono::microseconds>(t - lastSeen_).count();
+                if (packets_ == 2)
+                    intervalUs_ = interval;
+                intervalUs_ += (interval - intervalUs_) / SMOOTHING;
+                jitterUs_ += (std::abs(interval - intervalUs_) - jitterUs_) / SMOOTHING;
+            }
+            lastSeen_ = t;
+        }
+
+        size_t packets() const { return packets_; }
+        size_t lost() const { return lost_; }
+        size_t duplicates() const { return duplicates_; }
+
+        /** Number of the last n (at most 128) sequence numbers that were received. 
+         */
+        unsigned receivedOf(unsigned n) const {
+            n = std::min(n, span_);
+            unsigned result = 0;
+            for (unsigned i = 0; i < n; ++i)
+                if (test(static_cast<uint8_t>(last_ - i)))
+                    ++result;
+            return result;
+        }
+
+        /** Percentage of the last n (at most 128) sequence numbers that were not received. If there were fewer sequence numbers so far, only those count.
+         */
+        unsigned loss(unsigned n) const {
+            n = std::min(n, span_);
+            return n == 0 ? 0 : (n - receivedOf(n)) * 100 / n;
+        }
+
+        uint32_t intervalUs() const { return static_cast<uint32_t>(intervalUs_); }
+        uint32_t jitterUs() const { return static_cast<uint32_t>(jitterUs_); }
+        Clock::time_point lastSeen() const { return lastSeen_; }
+
+    private:
+
+        /** Weight of the new interval in the running averages (1/SMOOTHING), as in RFC 3550's jitter. */
+        static constexpr float SMOOTHING = 16;
+
+        bool test(uint8_t seq) const { return ring_[seq / 64] & (1ull << (seq % 64)); }
+
+        void set(uint8_t seq, bool value) {
+            if (value)
+                ring_[seq / 64] |= 1ull << (seq % 64);
+            else
+                ring_[seq / 64] &= ~(1ull << (seq % 64));
+        }
+
+        uint64_t ring_[4] = {};
+        bool sequenced_ = false;
+        uint8_t last_ = 0;
+        /** Number of sequence numbers covered by the ring so far. */
+        unsigned span_ = 0;
+        size_t packets_ = 0;
+        size_t lost_ = 0;
+        size_t duplicates_ = 0;
+        float intervalUs_ = 0;
+        float jitterUs_ = 0;
+        Clock::time_point lastSeen_;
+    }; // LinkStats::Peer
+
+    /** Returns the statistics of the given link, creating them if necessary.
+     */
+    Peer & peer(std::string const & name) { return peers_[name]; }
+
+    /** Returns the statistics of the given link, or nullptr if nothing has been received from it yet.
+     */
+    Peer const * find(std::string const & name) const {
+        auto i = peers_.find(name);
+        return i == peers_.end() ? nullptr : & i->second;
+    }
+
+    std::unordered_map<std::string, Peer> const & peers() const { return peers_; }
+
+    /** Records finished transmits, of which the given number failed.
+     */
+    void transmitted(size_t packets, size_t failed = 0) {
+        transmits_ += packets;
+        txFailures_ += failed;
+    }
+
+    size_t transmits() const { return transmits_; }
+    size_t txFailures() const { return txFailures_; }
+
+    void reset() {
+        peers_.clear();
+        transmits_ = 0;
+        txFailures_ = 0;
+    }
+
+    /** Appends a line per link to the given CSV file, stamped with the current time. The transmits are the "tx" link, with the failed ones as lost packets. Writes the header if the file is new. Returns false if the file can't be written.
+     */
+    bool dump(std::string const & filename) const {
+        bool empty;
+        {
+            std::ifstream f{filename};
+            empty = !f.good() || f.peek() == std::ifstream::traits_type::eof();
+        }
+        std::ofstream f{filename, std::ios::app};
+        if (! f.good())
+            return false;
+        if (empty)
+            f << "time,link,packets,lost,duplicates,loss16,loss64,loss128,interval_us,jitter_us,last_seen_ms" << std::endl;
+        std::time_t time = std::time(nullptr);
+        Clock::time_point t = Clock::now();
+        f << time << ",tx," << transmits_ << "," << txFailures_ << ",,,,,,," << std::endl;
+        for (auto const & [name, p] : peers_) {
+            f << time << "," << name << "," << p.packets() << "," << p.lost() << "," << p.duplicates();
+            for (unsigned w : WINDOWS)
+                f << "," << p.loss(w);
+            f << "," << p.intervalUs() << "," << p.jitterUs() << "," << std::chrono::duration_cast<std::chrono::milliseconds>(t - p.lastSeen()).count() << std::endl;
+        }
+        return f.good();
+    }
+
+private:
+
+    std::unordered_map<std::string, Peer> peers_;
+    size_t transmits_ = 0;
+    size_t txFailures_ = 0;
+
+}; // LinkStats
@@ -4,9 +4,15 @@
 
 #include "widget.h"
 #include "window.h"
+#include "channel_survey.h"
 
 /** A simple NRF sniffer class that displays received messages, which is useful for testing
     
+    Also shows the number of packets received in the last second and the best second so far, which measures the throughput of the transmitting device (such as a walkie-talkie streaming PTT audio).
+
+    The spectrum view (Y) scans the radio channels instead and shows how busy each of them is, the channel the sniffer listens on can be moved with left and right. Nothing is received while the spectrum is shown.
+
+    The links view (Select) shows the radio link statistics of all the apps (see LinkStats), with the sniffed packets as the "sniffer" link, and X exports them to LINK_STATS_FILE.
  */
 class NRFSniffer : public Widget {
 public:
@@ -15,7 +21,15 @@ protected:
 
     void draw(Canvas & c) override {
         BeginBlendMode(BLEND_ADD_COLORS);
-        c.drawText(0, 200, STR("TX: " << tx_ << " RX: " << rx_ << " /s: " << packetsPerLastSecond_), WHITE);
+        if (spectrum_) {
+            drawSpectrum(c);
+            return;
+        }
+        if (links_) {
+            drawLinks(c);
+            return;
+        }
+        c.drawText(0, 200, STR("TX: " << tx_ << " RX: " << rx_ << " /s: " << packetsPerLastSecond_ << " max: " << packetsPerSecondMax_), WHITE);
         c.setFont(c.helpFont());
         for (size_t i = 0; i < msgs_.size(); ++i) {
             size_t id = (rx_ - msgs_.size() + i) % 1000;
@@ -30,12 +44,31 @@ protected:
     void setFooterHints() override {
         Widget::setFooterHints();
         window().addFooterItem(FooterItem::A("Start/Stop"));
-        window().addFooterItem(FooterItem::X("Reset"));
+        window().addFooterItem(FooterItem::X(links_ ? "Export" : "Reset"));
+        window().addFooterItem(FooterItem::Y(spectrum_ ? "Packets" : "Spectrum"));
+        if (!spectrum_)
+            window().addFooterItem(FooterItem::Select(links_ ? "Packets" : "Links"));
+    }
+
+    void tick() override {
+        Timepoint t = now();
+        if (asMillis(t - lastSecond_) >= 1000) {
+            lastSecond_ = t;
+            packetsPerLastSecond_ = packetsPerSecond_;
+            packetsPerSecondMax_ = std::max(packetsPerSecondMax_, packetsPerSecond_);
+            packetsPerSecond_ = 0;
+            requestRedraw();
+        }
     }
 
+    /** Ticked even when nothing is received so that the rate drops to zero when the transmitter stops. */
+    int tickInterval() const override { return UI_IDLE_TICK_MS; }
+
     void onNavigationPush() override {
         lastSecond_ = now();
         packetsPerSecond_ = 0;
+        spectrum_ = false;
+        links_ = false;
 
         rckid().nrfInitialize(rxAddr_.c_str(), txAddr_.c_str(), channel_);
         rckid().nrfEnableReceiver();
@@ -51,7 +84,10 @@ protected:
     }
 
     void btnA(bool state) override {
-        if (state) {
+        // the receiver is not used while the spectrum is shown
+        if (state && spectrum_) {
+            running_ = !running_;
+        } else if (state) {
             if (running_) {
                 running_ = false;
                 rckid().nrfPowerDown();
@@ -64,30 +100,127 @@ protected:
     }
 
     void btnX(bool state) override {
-        if (state) {
+        if (state && links_) {
+            if (rckid().linkStats().dump(LINK_STATS_FILE))
+                TraceLog(LOG_INFO, STR("Link statistics appended to " << LINK_STATS_FILE));
+            else
+                TraceLog(LOG_ERROR, STR("Unable to write link statistics to " << LINK_STATS_FILE));
+        } else if (state) {
             msgs_.clear();
             rx_ = 0;
             tx_ = 0;
+            packetsPerSecondMax_ = 0;
+            survey_.reset();
+            requestRedraw();
+        }
+    }
+
+    /** Switches between the received packets and the spectrum of the channels. 
+     */
+    void btnY(bool state) override {
+        if (!state)
+            return;
+        spectrum_ = !spectrum_;
+        if (spectrum_) {
+            survey_.reset();
+            rckid().nrfScan(SCAN_SWEEPS);
+        } else if (running_) {
+            rckid().nrfInitialize(rxAddr_.c_str(), txAddr_.c_str(), channel_);
+            rckid().nrfEnableReceiver();
+        } else {
+            rckid().nrfPowerDown();
+        }
+        setFooterHints();
+        requestRedraw();
+    }
+
+    /** Switches between the received packets and the link statistics. 
+     */
+    void btnSelect(bool state) override {
+        if (state && !spectrum_) {
+            links_ = !links_;
+            setFooterHints();
+            requestRedraw();
+        }
+    }
+
+    void dpadLeft(bool state) override {
+        if (state && spectrum_ && channel_ > 0) {
+            --channel_;
+            requestRedraw();
         }
     }
 
+    void dpadRight(bool state) override {
+        if (state && spectrum_ && channel_ < ChannelSurvey::NUM_CHANNELS - 1) {
+            ++channel_;
+            requestRedraw();
+        }
+    }
+
+    /** The scan is kept going for as long as the spectrum is shown. 
+     */
+    void nrfScanDone(NRFScanEvent & e) override {
+        if (!spectrum_)
+            return;
+        survey_.add(e);
+        if (survey_.sweeps() % SCAN_SWEEPS == 0)
+            rckid().nrfScan(SCAN_SWEEPS);
+        requestRedraw();
+    }
+
     void nrfPacketReceived(NRFPacketEvent & e) override {
         ++rx_;
+        ++packetsPerSecond_;
+        rckid().linkStats().peer("sniffer").received();
         msgs_.push_back(Message{e.packet});
-        while (msgs_.size() > 8) {
-            ++ packetsPerSecond_;
+        while (msgs_.size() > 8)
             msgs_.pop_front();
-        }
-        Timepoint t = now();
+    }
 
-        if (asMillis(t - lastSecond_) >= 1000 ) {
-            lastSecond_ = t;
-            packetsPerLastSecond_ = packetsPerSecond_;
-            packetsPerSecond_ = 0;
+private:
+
+    /** Sweeps requested from the driver at once, the scan is restarted when they are done. */
+    static constexpr uint8_t SCAN_SWEEPS = 100;
+
+    /** Draws a bar for each channel with the percentage of the sweeps it was busy in. The channel the sniffer listens on is highlighted and the quietest channel is green. 
+     */
+    void drawSpectrum(Canvas & c) {
+        static constexpr int X = 34;
+        static constexpr int Y = 180;
+        static constexpr int HEIGHT = 150;
+        uint8_t quietest = survey_.quietest(channel_);
+        for (uint8_t ch = 0; ch < ChannelSurvey::NUM_CHANNELS; ++ch) {
+            int h = std::max(1u, survey_.occupancy(ch) * HEIGHT / 100);
+            ::Color color = (ch == channel_) ? c.accentColor() : (ch == quietest) ? GREEN : LIGHTGRAY;
+            c.fillFrame(X + ch * 2, Y - h, 2, h, color);
         }
+        c.setFont(c.helpFont());
+        c.drawText(X, Y + 2, "0", DARKGRAY);
+        c.drawText(X + 63 * 2 - 8, Y + 2, "63", DARKGRAY);
+        c.drawText(X + 125 * 2 - 16, Y + 2, "125", DARKGRAY);
+        c.drawText(0, 200, STR("Ch: " << (int)channel_ << " " << survey_.occupancy(channel_) << "%, quietest: " << (int)quietest << ", sweeps: " << survey_.sweeps()), WHITE);
     }
 
-private:
+    static constexpr char const * LINK_STATS_FILE = "/rckid/link-stats.csv";
+
+    /** Draws a line per link with the packets received, the loss over the shortest and longest window, duplicates, the average interval between the packets and its jitter. 
+     */
+    void drawLinks(Canvas & c) {
+        LinkStats const & stats = rckid().linkStats();
+        c.setFont(c.helpFont());
+        c.drawText(0, 20, "Link", DARKGRAY);
+        c.drawText(110, 20, "Rx Loss% Dup Int/J ms", DARKGRAY);
+        int y = 38;
+        for (auto const & [name, p] : stats.peers()) {
+            if (y > 180)
+                break;
+            c.drawText(0, y, name.substr(0, 12), WHITE);
+            c.drawText(110, y, STR(p.packets() << " " << p.loss(LinkStats::WINDOWS[0]) << "/" << p.loss(LinkStats::WINDOWS[LinkStats::NUM_WINDOWS - 1]) << " " << p.duplicates() << " " << p.intervalUs() / 1000 << "/" << p.jitterUs() / 1000), WHITE);
+            y += 18;
+        }
+        c.drawText(0, 200, STR("TX: " << stats.transmits() << " failed: " << stats.txFailures()), WHITE);
+    }
 
     struct Message {
         uint8_t packet[32];
@@ -112,6 +245,9 @@ private:
     };
 
     bool running_ = true;
+    bool spectrum_ = false;
+    bool links_ = false;
+    ChannelSurvey survey_;
     std::string rxAddr_ = "AAAAA";
     std::string txAddr_ = "AAAAA";
     uint8_t channel_ = 86;
@@ -119,6 +255,7 @@ private:
     size_t tx_ = 0;
     size_t packetsPerSecond_ = 0;
     size_t packetsPerLastSecond_ = 0;
+    size_t packetsPerSecondMax_ = 0;
     Timepoint lastSecond_;
 
     std::deque<Message> msgs_;
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#include "common/config.h"
+
+#include "events.h"
+
+/** Turns the raw accelerometer and gyroscope samples into tilt axes, virtual dpad buttons and gestures.
+
+    The tilt is the direction of gravity in the sensor's frame, tracked by a complementary filter. Each sample the gravity is rotated by the angular velocity from the gyroscope, which is smooth and fast, but drifts, and then pulled towards the measured acceleration, which does not drift, but is noisy and includes any movement of the device. The pull weakens as the magnitude of the acceleration departs from 1g, i.e. when the device is being moved rather than tilted. The gyroscope's bias is estimated whenever the device rests and calibrate() makes the current position neutral so that the tilt is relative to the way the device is held.
+
+    The tilt axes have a dead zone around the neutral position and the virtual buttons are pressed and released at different tilts so that they do not chatter at the threshold. The gestures are detected from the linear acceleration, i.e. the measured acceleration without gravity: a tap is a short spike followed by calm, a shake is a quick succession of strong movements in opposite directions.
+
+    The filter keeps all of its state in the object and costs a handful of float operations per sample so that it can run at the full sensor rate in the driver thread.
+ */
+class Orientation {
+public:
+
+    /** Tunables of the filter. The tilts are in g, i.e. the sine of the angle from the neutral position.
+     */
+    struct Config {
+        /** Time constant of the complementary filter in seconds. The longer, the more the gyroscope is trusted. */
+        float tau = ACCEL_FILTER_TAU_MS / 1000.0f;
+        /** Tilt under which the axes report the neutral position. */
+        float deadZone = ACCEL_DEAD_ZONE / 128.0f;
+        /** Tilts at which the virtual buttons are pressed and released. */
+        float press = ACCEL_BUTTON_PRESS / 128.0f;
+        float release = ACCEL_BUTTON_RELEASE / 128.0f;
+        /** Linear accelerations in g that make a tap and a shake. */
+        float tap = ACCEL_TAP_THRESHOLD / 100.0f;
+        float shake = ACCEL_SHAKE_THRESHOLD / 100.0f;
+    }; // Orientation::Config
+
+    /** Creates the filter for given sample rate and scales of the raw values in LSB per g and per degree per second.
+     */
+    Orientation(unsigned sampleRate, float accelLsbPerG, float gyroLsbPerDps):
+        dt_{1.0f / sampleRate},
+        accelScale_{1.0f / accelLsbPerG},
+        gyroScale_{static_cast<float>(M_PI) / 180.0f / gyroLsbPerDps},
+        tapMax_{sampleRate * TAP_MAX_MS / 1000},
+        tapSettle_{sampleRate * TAP_SETTLE_MS / 1000},
+        tapQuiet_{sampleRate * TAP_QUIET_MS / 1000},
+        shakeWindow_{sampleRate * SHAKE_WINDOW_MS / 1000},
+        holdoff_{sampleRate * GESTURE_HOLDOFF_MS / 1000} {
+        setConfig(Config{});
+    }
+
+    Config const & config() const { return config_; }
+
+    void setConfig(Config const & config) {
+        config_ = config;
+        alpha_ = dt_ / (config.tau + dt_);
+    }
+
+    /** Makes the current orientation the neutral position.
+     */
+    void calibrate() {
+        neutralX_ = g_.x;
+        neutralY_ = g_.y;
+    }
+
+    /** Processes a single sample of the raw acceleration (a) and angular velocity (w) and returns the gesture detected, if any.
+     */
+    Gesture update(int16_t ax, int16_t ay, int16_t az, int16_t wx, int16_t wy, int16_t wz) {
+        Vector a{ax * accelScale_, ay * accelScale_, az * accelScale_};
+        Vector w{wx * gyroScale_, wy * gyroScale_, wz * gyroScale_};
+        float m = a.length();
+        if (m == 0)
+            return Gesture::None;
+        if (!initialized_) {
+            g_ = a * (1 / m);
+            initialized_ = true;
+        }
+        float e = std::fabs(m - 1);
+        // the gyroscope bias is whatever it measures while the device rests
+        if (e < REST_ACCEL && (w - bias_).length() < REST_GYRO)
+            bias_ = bias_ + (w - bias_) * BIAS_RATE;
+        w = w - bias_;
+        // rotate the gravity by the angular velocity (dg/dt = -w x g) and pull it towards the measured acceleration
+        Vector r = g_ - w.cross(g_) * dt_;
+        float k = (e < MOVING_ACCEL) ? alpha_ * (1 - e / MOVING_ACCEL) : 0;
+        r = r * (1 - k) + a * (k / m);
+        float rl = r.length();
+        if (rl > 0)
+            g_ = r * (1 / rl);
+        updateButton(buttonX_, tiltX());
+        updateButton(buttonY_, tiltY());
+        return detectGesture(a - g_);
+    }
+
+    /** The tilt from the neutral position in g along the horizontal and vertical axis. The tilts are negated sensor axes, which is the orientation the accelerometer's axes have always been reported in.
+     */
+    float tiltX() const { return -(g_.x - neutralX_); }
+    float tiltY() const { return -(g_.y - neutralY_); }
+
+    /** The tilt with the dead zone applied as axis value (0..255, 128 being neutral).
+     */
+    uint8_t axisX() const { return toAxis(tiltX()); }
+    uint8_t axisY() const { return toAxis(tiltY()); }
+
+    /** State of the virtual buttons along the axis, -1 for the negative direction, 1 for the positive direction and 0 when neither is pressed.
+     */
+    int buttonX() const { return buttonX_; }
+    int buttonY() const { return buttonY_; }
+
+private:
+
+    struct Vector {
+        float x;
+        float y;
+        float z;
+
+        Vector operator + (Vector const & o) const { return Vector{x + o.x, y + o.y, z + o.z}; }
+        Vector operator - (Vector const & o) const { return Vector{x - o.x, y - o.y, z - o.z}; }
+        Vector operator * (float k) const { return Vector{x * k, y * k, z * k}; }
+        float dot(Vector const & o) const { return x * o.x + y * o.y + z * o.z; }
+        Vector cross(Vector const & o) const { return Vector{y * o.z - z * o.y, z * o.x - x * o.z, x * o.y - y * o.x}; }
+        float length() const { return std::sqrt(dot(*this)); }
+    }; // Orientation::Vector
+
+    /** Acceleration error (in g) and angular velocity (in rad/s) under which the device is considered resting, and the rate at which the gyroscope bias is learnt then. */
+    static constexpr float REST_ACCEL = 0.05f;
+    static constexpr float REST_GYRO = 0.1f;
+    static constexpr float BIAS_RATE = 0.005f;
+    /** Acceleration error (in g) above which the accelerometer is not trusted at all. */
+    static constexpr float MOVING_ACCEL = 0.5f;
+    /** Longest spike that is a tap, the time given to the sensor to settle after it and the calm that must follow. */
+    static constexpr unsigned TAP_MAX_MS = 40;
+    static constexpr unsigned TAP_SETTLE_MS = 20;
+    static constexpr unsigned TAP_QUIET_MS = 100;
+    /** Longest time between the shake movements. */
+    static constexpr unsigned SHAKE_WINDOW_MS = 300;
+    static constexpr unsigned SHAKE_MOVEMENTS = 3;
+    /** No new gesture is detected for this long after one has been. */
+    static constexpr unsigned GESTURE_HOLDOFF_MS = 500;
+
+    uint8_t toAxis(float tilt) const {
+        float t = std::max(0.0f, std::fabs(tilt) - config_.deadZone) / (1 - config_.deadZone);
+        int v = 128 + static_cast<int>((tilt < 0 ? -t : t) * 128);
+        return static_cast<uint8_t>(std::clamp(v, 0, 255));
+    }
+
+    void updateButton(int & state, float tilt) {
+        if (state == 0)
+            state = (tilt <= -config_.press) ? -1 : (tilt >= config_.press) ? 1 : 0;
+        else if (state * tilt < config_.release)
+            state = 0;
+    }
+
+    Gesture detectGesture(Vector linear) {
+        float m = linear.length();
+        if (holdoffLeft_ > 0) {
+            --holdoffLeft_;
+            return Gesture::None;
+        }
+        // shake: strong movements in opposite directions, each following the previous one quickly
+        ++sinceMovement_;
+        if (sinceMovement_ > shakeWindow_)
+            movements_ = 0;
+        if (m >= config_.shake && (movements_ == 0 || linear.dot(movement_) < 0)) {
+            movement_ = linear;
+            sinceMovement_ = 0;
+            if (++movements_ == SHAKE_MOVEMENTS)
+                return gesture(Gesture::Shake);
+        }
+        // tap: a short spike followed by calm that is not part of a shake, the sensor may ring for a few samples after the spike
+        if (m >= config_.tap) {
+            ++spike_;
+            tapPending_ = false;
+        } else if (spike_ > 0) {
+            tapPending_ = spike_ <= tapMax_;
+            spike_ = 0;
+            calm_ = 0;
+            settle_ = 0;
+        } else if (tapPending_) {
+            if (m < config_.tap / 3) {
+                if (++calm_ >= tapQuiet_ && movements_ <= 1)
+                    return gesture(Gesture::Tap);
+            } else {
+                calm_ = 0;
+                tapPending_ = ++settle_ <= tapSettle_;
+            }
+        }
+        return Gesture::None;
+    }
+
+    Gesture gesture(Gesture g) {
+        holdoffLeft_ = holdoff_;
+        movements_ = 0;
+        spike_ = 0;
+        calm_ = 0;
+        settle_ = 0;
+        tapPending_ = false;
+        return g;
+    }
+
+    Config config_;
+    float const dt_;
+    float const accelScale_;
+    float const gyroScale_;
+    float alpha_;
+
+    bool initialized_ = false;
+    Vector g_{0, 0, 1};
+    Vector bias_{0, 0, 0};
+    float neutralX_ = 0;
+    float neutralY_ = 0;
+    int buttonX_ = 0;
+    int buttonY_ = 0;
+
+    unsigned const tapMax_;
+    unsigned const tapSettle_;
+    unsigned const tapQuiet_;
+    unsigned const shakeWindow_;
+    unsigned const holdoff_;
+    unsigned holdoffLeft_ = 0;
+    unsigned spike_ = 0;
+    unsigned calm_ = 0;
+    unsigned settle_ = 0;
+    bool tapPending_ = false;
+    Vector movement_{0, 0, 0};
+    unsigned movements_ = 0;
+    unsigned sinceMovement_ = 0;
+
+}; // Orientation
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <algorithm>
 
 #include "../avr-i2c-bootloader/src/programmer.h"
 
@@ -18,12 +19,133 @@ RCKid & RCKid::create() {
 }
 
 RCKid::RCKid() {
+    reportWakeups_ = getenv("RCKID_REPORT_WAKEUPS") != nullptr;
+    reactor_.add(driverEvents_.fd(), [this](){ driverEvents_.wait(); });
+    // the ticks go through the driver queue so that they can't delay more urgent events
+    reactor_.add(tickTimer_, [this](){
+        if (tickTimer_.expirations() > 0)
+            driverEvents_.send(Tick{});
+    });
+    reactor_.add(debounceTimer_, [this](){
+        if (debounceTimer_.expirations() > 0)
+            debounceExpired();
+    });
+    reactor_.add(nrfScanTimer_, [this](){
+        if (nrfScanTimer_.expirations() > 0)
+            nrfScanStep();
+    });
+    reactor_.add(secondTimer_, [this](){
+        if (secondTimer_.expirations() == 0)
+            return;
+        driverEvents_.send(SecondTick{});
+        uiEvents_.send(SecondTick{});
+        size_t w = reactor_.wakeups();
+        wakeupsPerSecond_ = w - lastWakeups_;
+        lastWakeups_ = w;
+        i2cBus_.secondTick();
+        if (reportWakeups_)
+            TraceLog(LOG_INFO, STR("Driver wakeups/s: " << wakeupsPerSecond_));
+    });
     gpio::initialize();
     if (!spi::initialize()) 
         TraceLog(LOG_ERROR, STR("Unable to initialize spi (errno " << errno << ")"));
     if (!i2c::initializeMaster())
         TraceLog(LOG_ERROR, STR("Unable to initialize i2c (errno " << errno << "), make sure /dev/i2c1 exists"));
     initializeLibevdev();
+    // start tracing before talking to the devices so that their initialization is in the trace as well
+    if (char const * trace = getenv("RCKID_TRACE")) {
+        if (trace_.open(trace)) {
+            tracing_ = true;
+            tracer_ = & trace_;
+            i2c::setObserver(traceI2C);
+            i2cAsync_.setTrace(& trace_);
+            spi::setObserver(traceSPI);
+            TraceLog(LOG_INFO, STR("Recording driver trace to " << trace));
+        } else {
+            TraceLog(LOG_ERROR, STR("Unable to create driver trace " << trace));
+        }
+    }
+#if (defined ARCH_MOCK)
+    if (char const * replay = getenv("RCKID_REPLAY")) {
+        if (replay_.load(replay)) {
+            replaying_ = true;
+            replayFast_ = getenv("RCKID_REPLAY_FAST") != nullptr;
+        } else {
+            TraceLog(LOG_ERROR, STR("Unable to load driver trace " << replay));
+        }
+    }
+    if (replaying_) {
+        // the recorded responses stand in for all devices on the buses
+        // the transactions of different devices may have been executed in any order (merged ioctls, completion callbacks), but those of the same device are always in order, so each device replays its own responses
+        std::vector<size_t> batch;
+        auto flushBatch = [&]() {
+            for (size_t i : batch)
+                replayI2C_[replay_.records()[i].payload[0]].push_back(i);
+            batch.clear();
+        };
+        for (size_t i = 0, e = replay_.records().size(); i < e; ++i) {
+            switch (replay_.records()[i].kind) {
+                case Trace::Kind::I2C:
+                    batch.push_back(i);
+                    break;
+                case Trace::Kind::I2CBatch:
+                    flushBatch();
+                    break;
+                // the failed merged ioctl is superseded by the transactions executed again one by one, those that are not repeated keep their responses
+                case Trace::Kind::I2CRetry: {
+                    std::vector<uint8_t> const & retried = replay_.records()[i].payload;
+                    batch.erase(std::remove_if(batch.begin(), batch.end(), [&](size_t j) {
+                        return std::find(retried.begin(), retried.end(), replay_.records()[j].payload[0]) != retried.end();
+                    }), batch.end());
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+        flushBatch();
+        for (auto & [address, responses] : replayI2C_) {
+            replayI2CSlaves_[address] = [this, address = address](uint8_t const *, uint8_t, uint8_t * rb, uint8_t rsize) {
+                std::lock_guard<std::mutex> g{mReplay_};
+                std::deque<size_t> & responses = replayI2C_[address];
+                if (responses.empty() || replay_.records()[responses.front()].payload[1] != rsize) {
+                    ++replayDivergences_;
+                    return false;
+                }
+                std::vector<uint8_t> const & r = replay_.records()[responses.front()].payload;
+                responses.pop_front();
+                if (rsize > 0)
+                    memcpy(rb, r.data() + 3, rsize);
+                return r[2] != 0;
+            };
+            i2c::attachSlave(address, & replayI2CSlaves_[address]);
+        }
+        replaySPISlave_ = [this](uint8_t const *, uint8_t * rx, size_t numBytes) {
+            if (rx == nullptr)
+                return;
+            std::lock_guard<std::mutex> g{mReplay_};
+            auto const & records = replay_.records();
+            while (replaySPI_ < records.size() && records[replaySPI_].kind != Trace::Kind::SPI)
+                ++replaySPI_;
+            if (replaySPI_ == records.size() || records[replaySPI_].payload.size() != numBytes) {
+                ++replayDivergences_;
+                memset(rx, 0, numBytes);
+                return;
+            }
+            memcpy(rx, records[replaySPI_++].payload.data(), numBytes);
+        };
+        spi::attachSlave(& replaySPISlave_);
+    } else {
+        // the AVR must be on the bus before we talk to it
+        avrSim_.loadSamples("assets/recording/test.dat");
+        if (char const * script = getenv("RCKID_AVR_SCRIPT")) {
+            std::string err;
+            if (!avrSim_.loadScript(script, & err))
+                TraceLog(LOG_ERROR, STR("Unable to load AVR script " << script << ": " << err));
+        }
+        avrSim_.start(AVR_I2C_ADDRESS, PIN_AVR_IRQ);
+    }
+#endif
     initializeAvr();
     initializeAccel();
     initializeNrf();
@@ -38,50 +160,19 @@ RCKid::RCKid() {
             state_.status.setMode(comms::Mode::On);
             processAvrStatus(state_.status, true);
         }
-        while (!shouldTerminate_.load()) {
-            DriverEvent e = driverEvents_.waitReceive();
-            processDriverEvent(e);
-        }
-    }};
-    tTicks_ = std::thread{[this](){
-        while (!shouldTerminate_.load()) {
-            cpu::delayMs(10);
-            this->driverEvents_.send(Tick{});
-        }
-    }};
-    tSeconds_ = std::thread{[this](){
-        while (!shouldTerminate_.load()) {
-            cpu::delayMs(1000);
-            this->driverEvents_.send(SecondTick{});
-            this->uiEvents_.send(SecondTick{});
-        }
-    }};
-
 #if (defined ARCH_MOCK)
-    std::thread mockRecording{[this](){
-        std::vector<uint8_t> rec;
-        std::ifstream f{"assets/recording/test.dat"};
-        while (!f.eof())
-            rec.push_back(f.get());
-        TraceLog(LOG_DEBUG, STR("Loaded mock recording with size " << rec.size()).c_str());
-        size_t i = 0;
-        while (true) {
-            cpu::delayMs(4);
-            if (mockRecording_) {
-                RecordingEvent e;
-                e.status.setRecording(true);
-                e.status.setBatchIndex(mockRecBatch_);
-                mockRecBatch_ = (mockRecBatch_ + 1) % 8;
-                for (size_t x = 0; x < 32; ++x) {
-                    e.data[x] = rec[i];
-                    i = (i + 1) % rec.size();
-                }
-                uiEvents_.send(e);
-            }
+        // the replay processes the events one by one, so the I2C transactions stay synchronous
+        if (replaying_) {
+            replayLoop();
+            return;
         }
-    }};
-    mockRecording.detach();
 #endif
+        // if the lane is full, the transactions are completed after the events in it
+        i2cAsync_.start([this]() {
+            driverEvents_.send(I2CDone{});
+        });
+        hwLoop();
+    }};
 }
 
 std::optional<Event> RCKid::nextEvent() {
@@ -89,6 +180,9 @@ std::optional<Event> RCKid::nextEvent() {
     // TODO process events we are interested in for statistics
     if (e) {
         std::visit(overloaded{
+            [this](NRFTxEvent const & x) {
+                linkStats_.transmitted(x.packets, x.failed);
+            },
             [this](SecondTick const &) {
                 if (heartsCounterEnabled_ > 0) {
                     if (pState_.hearts > 0)
@@ -112,13 +206,9 @@ void RCKid::powerOff() {
 
 void RCKid::startAudioRecording() {
     TraceLog(LOG_DEBUG, "Recording start");
-    driverEvents_.send(msg::StartAudioRecording{});
+    driverEvents_.send(msg::StartAudioRecording{AUDIO_RECORDING_BURST, AUDIO_RECORDING_ENCODING, AUDIO_RECORDING_SAMPLE_RATE, AUDIO_RECORDING_BITS});
     // notify the main thread that there has been a state change (amongst other things refreshes the header)
     uiEvents_.send(StateChangeEvent{});
-#if (defined ARCH_MOCK)
-    mockRecBatch_ = 0;
-    mockRecording_ = true;
-#endif
 }
 
 void RCKid::stopAudioRecording() {
@@ -126,116 +216,358 @@ void RCKid::stopAudioRecording() {
     driverEvents_.send(msg::StopAudioRecording{}); 
     // notify the main thread that there has been a state change (amongst other things refreshes the header)
     uiEvents_.send(StateChangeEvent{});
+}
+
+void RCKid::hwLoop() {
+    secondTimer_.start(1000000);
+    while (!shouldTerminate_.load()) {
+        while (true) {
+            std::optional<DriverEvent> e = driverEvents_.receive();
+            if (! e.has_value())
+                break;
+            DriverLane lane = static_cast<DriverLane>(DriverEventPriority::of(e.value()));
+            if (tracing_)
+                traceEvent(e.value());
+            processDriverEvent(std::move(e.value()));
+            lastLane_ = lane;
+        }
+        completeI2C();
+        // all changes from the events processed so far form a single input frame
+        flushInputFrame();
+        updateTimers();
+        // only block if the queue is still empty after announcing the wait, otherwise just check the timers and interrupts
+        if (driverEvents_.prepareWait()) {
+            reactor_.poll(-1);
+            // a timer or an interrupt may have woken us instead of the queue
+            driverEvents_.finishWait();
+        } else {
+            reactor_.poll(0);
+        }
+    }
+}
+
+void RCKid::traceEvent(DriverEvent const & e) {
+    uint8_t index = static_cast<uint8_t>(e.index());
+    std::visit(overloaded{
+        [&](ButtonIrq const & x) {
+            uint8_t data[2] = { 0, x.state };
+            while (buttons_[data[0]] != & x.btn)
+                ++data[0];
+            trace_.event(index, data, sizeof(data));
+        },
+        [&](AvrIrq const &) {
+            trace_.event(index, nullptr, 0);
+        },
+        // consequences of the traced events, the transactions themselves are in the trace
+        [&](I2CDone const &) {},
+        [&](auto const & x) {
+            // all other events are plain data without any pointers, or references
+            trace_.event(index, & x, sizeof(x));
+        },
+    }, e);
+}
+
+/** Index of the type in the variant. 
+ */
+template<typename T, typename V, size_t I = 0>
+constexpr size_t variantIndex() {
+    if constexpr (std::is_same_v<std::variant_alternative_t<I, V>, T>)
+        return I;
+    else
+        return variantIndex<T, V, I + 1>();
+}
+
+template<size_t... I>
+std::optional<RCKid::DriverEvent> RCKid::decodeRawEvent(uint8_t index, uint8_t const * data, size_t size, std::index_sequence<I...>) {
+    std::optional<DriverEvent> result;
+    // the events have no default constructors, so they are copied from raw storage of the right alignment
+    ((index == I && size == sizeof(std::variant_alternative_t<I, DriverEvent>) ? [&](){
+        using T = std::variant_alternative_t<I, DriverEvent>;
+        alignas(T) uint8_t buffer[sizeof(T)];
+        memcpy(buffer, data, sizeof(T));
+        result.emplace(std::in_place_index<I>, * reinterpret_cast<T const *>(buffer));
+    }() : void()), ...);
+    return result;
+}
+
+std::optional<RCKid::DriverEvent> RCKid::decodeEvent(std::vector<uint8_t> const & payload) {
+    if (payload.empty())
+        return std::nullopt;
+    uint8_t index = payload[0];
+    uint8_t const * data = payload.data() + 1;
+    size_t size = payload.size() - 1;
+    if (index == variantIndex<ButtonIrq, DriverEvent>()) {
+        if (size != 2 || data[0] >= sizeof(buttons_) / sizeof(buttons_[0]))
+            return std::nullopt;
+        return DriverEvent{ButtonIrq{* buttons_[data[0]], data[1] != 0, LatencyClock::now()}};
+    }
+    if (index == variantIndex<AvrIrq, DriverEvent>())
+        return DriverEvent{AvrIrq{LatencyClock::now()}};
+    if (index == variantIndex<I2CDone, DriverEvent>())
+        return std::nullopt;
+    return decodeRawEvent(index, data, size, std::make_index_sequence<std::variant_size_v<DriverEvent>>{});
+}
+
+#if (defined ARCH_MOCK)
+void RCKid::replayLoop() {
+    size_t events = 0;
+    for (Trace::Record const & r : replay_.records())
+        events += (r.kind == Trace::Kind::Event);
+    TraceLog(LOG_INFO, STR("Replaying " << events << " driver events, " << replay_.duration() / 1000 << "ms" << (replayFast_ ? " as fast as possible" : "")));
+    // the second timer only delivers the UI's second ticks, the driver's ones are in the trace
+    secondTimer_.start(1000000);
+    LatencyClock::time_point start = LatencyClock::now();
+    events = 0;
+    for (Trace::Record const & r : replay_.records()) {
+        if (shouldTerminate_.load())
+            return;
+        if (r.kind != Trace::Kind::Event)
+            continue;
+        if (!replayFast_)
+            std::this_thread::sleep_until(start + std::chrono::microseconds{r.time});
+        // events sent during the replay are consequences of the replayed events and are in the trace already
+        while (driverEvents_.receive().has_value()) {}
+        std::optional<DriverEvent> e = decodeEvent(r.payload);
+        if (! e.has_value()) {
+            ++replayDivergences_;
+            continue;
+        }
+        processDriverEvent(std::move(e.value()));
+        flushInputFrame();
+        // serve the debounce timer
+        reactor_.poll(0);
+        ++events;
+    }
+    int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(LatencyClock::now() - start).count();
+    TraceLog(LOG_INFO, STR("Replay done: " << events << " events in " << ms << "ms, " << replayDivergences_ << " divergences"));
+    std::string latency = STR(getenv("RCKID_REPLAY") << ".latency");
+    if (!inputLatency_.dump(latency))
+        TraceLog(LOG_ERROR, STR("Unable to write input latency to " << latency));
+    while (!shouldTerminate_.load()) {
+        while (driverEvents_.receive().has_value()) {}
+        if (driverEvents_.prepareWait()) {
+            reactor_.poll(-1);
+            driverEvents_.finishWait();
+        }
+    }
+}
+#endif
+
+void RCKid::updateTimers() {
+    bool tick = false;
 #if (defined ARCH_MOCK)
-    mockRecording_ = false;
+    // the keyboard is polled in the ticks
+    tick = true;
 #endif
+    // the accelerometer is only polled (and powered) when someone is interested, while recording the I2C scheduler makes sure the polls only use the spare bus capacity
+    bool accel;
+    {
+        std::lock_guard<std::mutex> g{mState_};
+        accel = gamepadActive_ || accelAsButtons_ || gesturesActive_;
+    }
+    enableAccel(accel);
+    tick = tick || accel;
+    if (tick && !tickTimer_.running())
+        tickTimer_.start(RPI_TICK_US);
+    else if (!tick && tickTimer_.running())
+        tickTimer_.stop();
+}
+
+void RCKid::scheduleDebounce(ButtonState & btn) {
+    auto t = std::chrono::steady_clock::now();
+    btn.debounceEnd = t + std::chrono::microseconds{btn.debounceUs.load()};
+    btn.debounceScheduled = true;
+    debouncing_[numDebouncing_++] = & btn;
+    // rearm the timer if this is the first button to expire
+    for (size_t i = 0; i < numDebouncing_ - 1; ++i)
+        if (debouncing_[i]->debounceEnd <= btn.debounceEnd)
+            return;
+    debounceTimer_.startOnce(std::max<unsigned>(1, btn.debounceUs.load()));
+}
+
+void RCKid::debounceExpired() {
+    auto t = std::chrono::steady_clock::now();
+    size_t i = 0;
+    while (i < numDebouncing_) {
+        ButtonState & btn = *debouncing_[i];
+        if (btn.debounceEnd <= t) {
+            debouncing_[i] = debouncing_[--numDebouncing_];
+            btn.debouncing = false;
+            btn.debounceScheduled = false;
+            if (btn.reportedState != btn.actualState)
+                buttonAction(btn);
+        } else {
+            ++i;
+        }
+    }
+    if (numDebouncing_ == 0)
+        return;
+    auto next = debouncing_[0]->debounceEnd;
+    for (i = 1; i < numDebouncing_; ++i)
+        next = std::min(next, debouncing_[i]->debounceEnd);
+    int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(next - t).count();
+    debounceTimer_.startOnce(static_cast<unsigned>(std::max<int64_t>(1, us)));
+}
+
+void RCKid::nrfStartScan(uint8_t sweeps) {
+    bool poweredDown;
+    {
+        std::lock_guard<std::mutex> g{mRadio_};
+        poweredDown = nrfState_ == NRFState::PowerDown;
+    }
+    if (nrfScanSweeps_ == 0)
+        nrfScanRestore_ = nrf_.channel();
+    nrfScanSweeps_ = sweeps;
+    nrfScanChannel_ = 0;
+    nrfScanResult_ = NRFScanEvent{};
+    nrf_.enableReceiver();
+    nrf_.tuneReceiver(0);
+    // the radio needs 1.5ms to power up before the receiver starts
+    nrfScanTimer_.startOnce(NRF24L01::RPD_SETTLE_US + (poweredDown ? 1500 : 0));
+}
+
+void RCKid::nrfScanStep() {
+    if (nrfScanSweeps_ == 0)
+        return;
+    uint8_t ch = nrfScanChannel_;
+    if (nrf_.receivedPowerDetected())
+        nrfScanResult_.busy[ch / 8] |= 1 << (ch % 8);
+    if (++nrfScanChannel_ < NRF24L01::NUM_CHANNELS) {
+        nrf_.tuneReceiver(nrfScanChannel_);
+        nrfScanTimer_.startOnce(NRF24L01::RPD_SETTLE_US);
+        return;
+    }
+    NRFScanEvent result{nrfScanResult_};
+    if (nrfScanSweeps_ == 1) {
+        // return the radio to its channel and state before the UI learns that the scan is done so that it can use the radio right away
+        NRFState state;
+        {
+            std::lock_guard<std::mutex> g{mRadio_};
+            state = nrfState_;
+        }
+        processDriverEvent(state);
+    } else {
+        --nrfScanSweeps_;
+        nrfScanChannel_ = 0;
+        nrfScanResult_ = NRFScanEvent{};
+        nrf_.tuneReceiver(0);
+        nrfScanTimer_.startOnce(NRF24L01::RPD_SETTLE_US);
+    }
+    uiEvents_.send(result);
+}
+
+void RCKid::attachInterrupt(gpio::Pin pin, gpio::Edge edge, void (*handler)()) {
+    int fd = gpio::interruptFd(pin, edge);
+    if (fd < 0 || !reactor_.add(fd, [fd, handler](){ gpio::clearInterrupt(fd); handler(); }, EPOLLPRI | EPOLLERR)) {
+        if (fd >= 0)
+            close(fd);
+        gpio::attachInterrupt(pin, edge, handler);
+    }
 }
 
 void RCKid::processDriverEvent(DriverEvent e) {
     std::visit(overloaded{
         // do nothing for termination, it's sent just to ensure the thread will wake up and can react to shouldTerminate flag
         [this](Terminate) {},
+        // timers are updated after each batch of events, nothing else to do
+        [this](UpdateTimers) {},
         [this](Tick){
 #if (defined ARCH_MOCK)        
             checkMockButtons();
 #endif
-            buttonTick(btnA_);
-            buttonTick(btnB_);
-            buttonTick(btnX_);
-            buttonTick(btnY_);
-            buttonTick(btnL_);
-            buttonTick(btnR_);
-            buttonTick(btnSelect_);
-            buttonTick(btnStart_);
-            buttonTick(btnDpadLeft_);
-            buttonTick(btnDpadRight_);
-            buttonTick(btnDpadUp_);
-            buttonTick(btnDpadDown_);
-            buttonTick(btnJoy_);
-            buttonTick(btnHome_);
-            buttonTick(btnJoyUp_);
-            buttonTick(btnJoyDown_);
-            buttonTick(btnJoyLeft_);
-            buttonTick(btnJoyRight_);
-            buttonTick(btnAccelUp_);
-            buttonTick(btnAccelDown_);
-            buttonTick(btnAccelLeft_);
-            buttonTick(btnAccelRight_);
-            // only query the accell and photores status when we are not recording to keep the I2C fully for the audio recorder
-            if (!state_.status.recording()) {
-                queryAccelStatus();
-                // TODO query photores
-            }
+            // the accel is polled even when recording, the I2C scheduler defers the poll if the bus is needed by the audio recorder
+            queryAccelStatus();
+            // TODO query photores
         },
         [this](SecondTick) {
-            // only query extended state if we are not recording audio at the same time
-            if (!state_.status.recording()) {
-                comms::ExtendedState state{queryAvrExtendedState()};
+            {
+                // the AVR keeps the time and uptime the same way, so they are only read once in a while to follow its RTC
                 std::lock_guard<std::mutex> g{mState_};
-                processAvrStatus(state.status, true);
-                processAvrControls(state.controls, true);
-                processAvrExtendedState(state, true);
+                state_.time.secondTick();
+                ++state_.uptime;
+            }
+            // the AVR only returns the recording when recording audio so the extended state can't be read at the same time
+            if (state_.status.recording())
+                return;
+            if (++avrTimeSyncTicks_ >= AVR_TIME_SYNC_SECONDS) {
+                // if deferred by the I2C budget, try again next second
+                if (queryAvrFullState())
+                    avrTimeSyncTicks_ = 0;
+                return;
             }
+            // read the changes first and then only the parts that have changed
+            queryAvrExtendedState(2, I2CScheduler::Client::AvrExtendedState, [this](comms::ExtendedState & state) {
+                processAvrStatus(state.status);
+                if (!state.status.recording() && state.changes.any())
+                    queryAvrChanges(state.changes);
+            });
         },
         // this could be either input interrupt, or recording interrupt. If we are not aware in the status that recording has started yet, try the input reading, which also updates the status, and if this update switches to recording, abort the input and go to recording instead. 
-        [this](AvrIrq) {
+        [this](AvrIrq e) {
             if (!state_.status.recording()) {
-                comms::State state{queryAvrState()};
-                {
-                    std::lock_guard<std::mutex> g{mState_};
-                    processAvrStatus(state.status, true);
-                    if (!state_.status.recording()) {
-                        processAvrControls(state.controls, true);
-                        return;
-                    }
-                }
+                inputLatency_.record(LatencyStats::Stage::Dequeue, e.origin);
+                queryAvrState(e.origin);
+            } else {
+                getAvrRecording();
             }
-            getAvrRecording();
         }, 
+        [this](I2CDone) {
+            completeI2C();
+        },
         [this](HeadphonesIrq e) {
             { 
                 std::lock_guard<std::mutex> g{mState_};
-                headphones_ = platform::gpio::read(PIN_HEADPHONES);
+                headphones_ = e.value;
             }
             uiEvents_.send(HeadphonesEvent{headphones_});
         },
         [this](ButtonIrq e) {
+            inputLatency_.record(LatencyStats::Stage::Dequeue, e.origin);
+            inputOrigin_ = e.origin;
             if (e.btn.update(e.state))
                 buttonAction(e.btn);
+            inputOrigin_ = LatencyClock::time_point{};
         },
         // keyboard presses
         [this](KeyPress e) {
             if (gamepad_ != nullptr) {
-                libevdev_uinput_write_event(gamepad_, EV_KEY, e.key, e.state);
-                libevdev_uinput_write_event(gamepad_, EV_SYN, SYN_REPORT, 0);
+                evdevEvent(EV_KEY, e.key, e.state);
             } else {
                 TraceLog(LOG_WARNING, "Cannot emit key - keyboard not available");
             }
         },
         [this](NRFIrq) {
-            NRF24L01::Status status{nrf_.clearIrq()};
-            if (status.rxDataReady()) {
-                NRFPacketEvent e;
-                while (nrf_.receive(e.packet, 32))
-                    uiEvents_.send(e);
+            // clearing the irq, reading the first packet and checking for more is a single spi transaction
+            NRFPacketEvent e;
+            NRF24L01::Received r{nrf_.clearIrqAndReceive(e.packet, 32)};
+            NRF24L01::Status status{r.status};
+            while (r.valid) {
+                uiEvents_.send(e);
+                if (!r.more)
+                    break;
+                r = nrf_.receiveNext(e.packet, 32);
             }
-            if (status.txDataSentIrq()) {
-                uiEvents_.send(NRFTxEvent{});
-                // we are now in standby 1 mode (assuming we transmit one message per invocation). Check if there is more messages, and if yes, trasnmit them immediately w/o going to real standby
-                mRadio_.lock();
-                if (! nrfTxQueue_.empty()) {
-                    NRFPacket p{nrfTxQueue_.front()};
-                    nrfTxQueue_.pop_front();
-                    mRadio_.unlock();
-                    nrf_.transmit(p.packet, 32); // since in standby-1, will be transmitted immediately
-                // if no more messages, go to either standby (if Tx) or enable receiver if this was a tx burst from rx mode
-                } else {
-                    mRadio_.unlock();
+            if (status.txDataSentIrq() || status.txDataFailIrq()) {
+                NRF24L01::FifoStatus fifo = nrf_.getFifoStatus();
+                NRFTxEvent done{nrfTxFinished(fifo, status.txDataFailIrq())};
+                if (done.packets > 0)
+                    uiEvents_.send(done);
+                // a packet that failed (only possible with acks) stays in the fifo and would block it
+                if (status.txDataFailIrq()) {
+                    nrf_.flushTx();
+                    fifo = nrf_.getFifoStatus();
+                }
+                // keep the tx fifo full while there are packets to send, the radio stays in tx mode and sends them back to back. Only when both the fifo and the queue are empty, go to either standby (if Tx) or enable receiver if this was a tx burst from rx mode
+                if (nrfFillTxFifo(fifo) == 0 && fifo.txEmpty()) {
                     if (nrfState_ == NRFState::Rx)
                         nrf_.enableReceiver();
                     else
                         nrf_.standby();
                     nrfTx_ = false;
+                    if (nrfScanDeferred_ != 0) {
+                        nrfStartScan(nrfScanDeferred_);
+                        nrfScanDeferred_ = 0;
+                    }
                 }
             }
             /*
@@ -269,17 +601,24 @@ void RCKid::processDriverEvent(DriverEvent e) {
             } */
         }, 
         [this](NRFInitialize e) {
+            nrfStopScan();
+            nrfScanDeferred_ = 0;
             // TODO process error
             nrf_.initialize(e.rxAddr, e.txAddr, e.channel);
             nrf_.standby();
+            nrfTxLoaded_ = 0;
             std::lock_guard<std::mutex> g{mRadio_};
             if (nrfState_ != NRFState::Error)
                 nrfState_ = NRFState::Standby;
         },
         [this](NRFState e) {
+            nrfStopScan();
+            nrfScanDeferred_ = 0;
             switch (e) {
+                // standby flushes the tx fifo
                 case NRFState::Standby:
                     nrf_.standby();
+                    nrfTxLoaded_ = 0;
                     break;
                 case NRFState::PowerDown:
                     nrf_.powerDown();
@@ -289,6 +628,7 @@ void RCKid::processDriverEvent(DriverEvent e) {
                     break;
                 case NRFState::Tx:
                     nrf_.standby();
+                    nrfTxLoaded_ = 0;
                     break;
             }
             nrfTx_ = false;
@@ -301,33 +641,56 @@ void RCKid::processDriverEvent(DriverEvent e) {
             uiEvents_.send(StateChangeEvent{});
         }, 
         [this](NRFTransmit e) {
-            nrfTx_ = true;
-            mRadio_.lock();
-            NRFPacket p{nrfTxQueue_.front()};
-            nrfTxQueue_.pop_front();
-            mRadio_.unlock();
-            nrf_.transmit(p.packet, 32);
-            nrf_.enableTransmitter();
+            LatencyClock::time_point start = LatencyClock::now();
+            nrfStopScan();
+            // the packets may have been sent by the tx irq, or cleared in the meantime
+            if (nrfFillTxFifo(nrf_.getFifoStatus()) == 0)
+                return;
+            if (!nrfTx_) {
+                nrfTx_ = true;
+                nrf_.enableTransmitter();
+            }
+            recordNrfTx(start);
         },
-        // immediate transmit
+        [this](msg::StartAudioRecording msg) {
+            // the AVR starts recording from the first batch
+            lastRecBatch_ = -1;
+            recBurst_ = std::clamp<uint8_t>(msg.irqBatches, 1, 7);
+            recPending_ = 0;
+            recEncoding_ = msg.encoding;
+            recBits_ = msg.bits;
+            recSampleRate_ = msg.sampleRate;
+            recNumSamples_ = 0;
+            recEventIndex_ = 0;
+            sendAvrCommand(msg);
+        },
+        [this](NRFScan e) {
+            if (e.sweeps == 0)
+                return;
+            // switching to the receiver would leave the packets being transmitted in the tx fifo, the scan starts when the tx irq finishes the burst
+            if (nrfTx_ || !nrfTxQueue_.empty()) {
+                nrfScanDeferred_ = e.sweeps;
+                return;
+            }
+            nrfStartScan(e.sweeps);
+        },
+        // immediate transmit, loads the packet to the radio and switches to tx mode, the tx irq then returns the radio to rx mode and confirms the transmit to the UI
         [this](NRFPacket e) {
-            nrfTx_ = true;
-            nrf_.transmit(e.packet, 32);
-            nrf_.enablePolledTransmitter();
-            NRF24L01::Status status = nrf_.clearTxIrqs();
-            while (!status.txDataSentIrq() && !status.txDataFailIrq())
-                status = nrf_.clearTxIrqs();
-            nrf_.enableReceiver();
-            nrfTx_ = false;            
-            // send UI confirmation
-            uiEvents_.send(NRFTxEvent{});
-            // if there is tx irq, process it (means we have received a message while transmitting and enabling the receiver
-            if (status.rxDataReady()) {
-                NRFPacketEvent e;
-                nrf_.clearDataReadyIrq();
-                while (nrf_.receive(e.packet, 32))
-                    uiEvents_.send(e);
+            LatencyClock::time_point start = LatencyClock::now();
+            nrfStopScan();
+            if (nrf_.transmit(e.packet, 32))
+                ++nrfTxLoaded_;
+            // if already transmitting, the packet is sent after those in the tx fifo
+            if (!nrfTx_) {
+                nrfTx_ = true;
+                nrf_.enableTransmitter();
             }
+            recordNrfTx(start);
+        },
+        [this](msg::SetTime msg) {
+            sendAvrCommand(msg);
+            // read the time back from the AVR at the next second tick
+            avrTimeSyncTicks_ = AVR_TIME_SYNC_SECONDS;
         },
         [this](auto msg) {
             sendAvrCommand(msg);
@@ -366,7 +729,9 @@ void RCKid::initializeAvr() {
     // if we are to terminate immediately because the current status is power down, shutdown and terminate itself immediately
     if (status.mode() == comms::Mode::PowerDown) {
         TraceLog(LOG_INFO, "Spurious power-up. Powering down immediately");
+#if (defined ARCH_RPI)
         system("sudo poweroff");
+#endif
         exit(EXIT_SUCCESS);
     }
     // get the persistent state
@@ -378,7 +743,7 @@ void RCKid::initializeAvr() {
     setVolume(pState_.volume);
     // attach the interrupt
     gpio::inputPullup(PIN_AVR_IRQ);
-    gpio::attachInterrupt(PIN_AVR_IRQ, gpio::Edge::Falling, & isrAvrIrq);
+    attachInterrupt(PIN_AVR_IRQ, gpio::Edge::Falling, & isrAvrIrq);
 }
 
 void RCKid::readPersistentState() {
@@ -408,7 +773,9 @@ void RCKid::processAvrStatus(comms::Status status, bool alreadyLocked) {
         switch (status.mode()) {
             case comms::Mode::PowerDown: 
                 TraceLog(LOG_INFO, "Power down requested");
+#if (defined ARCH_RPI)
                 system("sudo poweroff");
+#endif
                 break;
             case comms::Mode::WakeUp:
                 TraceLog(LOG_WARNING, "WakeUp mode detected when powering on");
@@ -428,7 +795,8 @@ void RCKid::processAvrStatus(comms::Status status, bool alreadyLocked) {
         state_.status.setAlarm(status.alarm());
         uiEvents_.send(AlarmEvent{});
     }
-    if (state_.status.powerStatus() != status.powerStatus()) {
+    // while recording, the power status bits carry the number of recorded batches instead
+    if (!status.recording() && state_.status.powerStatus() != status.powerStatus()) {
         state_.status.setPowerStatus(status.powerStatus());
         uiEvents_.send(status.powerStatus());
     }
@@ -464,7 +832,7 @@ void RCKid::processAvrControls(comms::Controls controls, bool alreadyLocked) {
 
     // joystick reading
     bool report = false;
-    if (joyX_.update(controls.joyH())) {
+    if (joyX_.update(controls.joyHFull())) {
         if (joyAsButtons_) {
             AnalogButtonState bState{axisAsButton(controls.joyH(), ANALOG_BUTTON_THRESHOLD)};
             if (btnJoyLeft_.update(bState == AnalogButtonState::Low))
@@ -475,9 +843,9 @@ void RCKid::processAvrControls(comms::Controls controls, bool alreadyLocked) {
             report = true;
             axisAction(joyX_, true);
         }
-        state_.controls.setJoyH(controls.joyH());
+        state_.controls.setJoyHFull(controls.joyHFull());
     }
-    if (joyY_.update(controls.joyV())) {
+    if (joyY_.update(controls.joyVFull())) {
         if (joyAsButtons_) {
             AnalogButtonState bState{axisAsButton(controls.joyV(), ANALOG_BUTTON_THRESHOLD)};
             if (btnJoyUp_.update(bState == AnalogButtonState::Low))
@@ -488,31 +856,84 @@ void RCKid::processAvrControls(comms::Controls controls, bool alreadyLocked) {
             report = true;
             axisAction(joyY_, true);
         }
-        state_.controls.setJoyV(controls.joyV());
+        state_.controls.setJoyVFull(controls.joyVFull());
     }
     if (report)
-        uiEvents_.send(JoyEvent{joyX_.reportedValue, joyY_.reportedValue});
+        uiEvents_.send(JoyEvent{static_cast<uint8_t>(joyX_.reportedValue >> 2), static_cast<uint8_t>(joyY_.reportedValue >> 2)});
+}
+
+void RCKid::queryAvrState(LatencyClock::time_point origin) {
+    auto t = std::make_unique<AsyncI2C::Transaction>(I2CScheduler::Client::AvrInput, [this, origin](AsyncI2C::Transaction & t) {
+        if (!t.ok()) {
+            TraceLog(LOG_WARNING, "AVR state read failed");
+            return;
+        }
+        comms::State state;
+        memcpy(& state, t.result(), sizeof(state));
+        inputOrigin_ = origin;
+        bool urgent = false;
+        {
+            std::lock_guard<std::mutex> g{mState_};
+            comms::PowerStatus power = state_.status.powerStatus();
+            processAvrStatus(state.status, true);
+            if (!state_.status.recording()) {
+                processAvrControls(state.controls, true);
+                urgent = state.changes.dinfo() || (state.changes.einfo() && power != state_.status.powerStatus());
+            }
+        }
+        inputOrigin_ = LatencyClock::time_point{};
+        // if the recording has started meanwhile, we got the beginning of the recording instead, read it properly
+        if (state_.status.recording()) {
+            getAvrRecording();
+        // debug info changes and power status transitions bring the extended info along right away, other extended info changes are left for the second tick
+        } else if (urgent) {
+            queryAvrChanges(state.changes, I2CScheduler::Client::AvrInput);
+        }
+    });
+    t->read(AVR_I2C_ADDRESS, sizeof(comms::State)).needsStop();
+    submitI2C(std::move(t));
+}
+
+void RCKid::queryAvrChanges(comms::Changes changes, I2CScheduler::Client client) {
+    queryAvrExtendedState(changes.readSize(), client, [this, changes](comms::ExtendedState & state) {
+        std::lock_guard<std::mutex> g{mState_};
+        processAvrStatus(state.status, true);
+        // if the recording has started meanwhile, we got the recording instead 
+        if (state.status.recording())
+            return;
+        // the controls are always read as they precede the rest
+        processAvrControls(state.controls, true);
+        processAvrExtendedState(state, changes, true);
+    });
 }
 
-void RCKid::processAvrExtendedState(comms::ExtendedState & state, bool alreadyLocked) {
+bool RCKid::queryAvrFullState() {
+    return queryAvrExtendedState(sizeof(comms::ExtendedState), I2CScheduler::Client::AvrExtendedState, [this](comms::ExtendedState & state) {
+        std::lock_guard<std::mutex> g{mState_};
+        processAvrStatus(state.status, true);
+        if (state.status.recording())
+            return;
+        comms::Changes all;
+        all.set(comms::Changes::ALL);
+        processAvrControls(state.controls, true);
+        processAvrExtendedState(state, all, true);
+        state_.time = state.time;
+        state_.uptime = state.uptime;
+    });
+}
+
+void RCKid::processAvrExtendedState(comms::ExtendedState & state, comms::Changes changes, bool alreadyLocked) {
     utils::cond_lock_guard g{mState_, alreadyLocked};
     bool report = false;
-    if (state_.einfo.vcc() != state.einfo.vcc()) {
-        report = true;
-        state_.einfo.setVcc(state.einfo.vcc());
-    }   
-    if (state_.einfo.vBatt() != state.einfo.vBatt()) {
-        report = true;
-        state_.einfo.setVBatt(state.einfo.vBatt());
+    if (changes.einfo()) {
+        report = state_.einfo.setVcc(state.einfo.vcc()) || report;
+        report = state_.einfo.setVBatt(state.einfo.vBatt()) || report;
+        report = state_.einfo.setTemp(state.einfo.temp()) || report;
     }
-    if (state_.einfo.temp() != state.einfo.temp()) {
+    if (changes.dinfo() && state_.dinfo.errorCode() != state.dinfo.errorCode()) {
         report = true;
-        state_.einfo.setTemp(state.einfo.temp());
+        state_.dinfo = state.dinfo;
     }
-    // simply copy the time and uptime, we mostly use them for debugging purposes
-    state_.uptime = state.uptime;
-    state_.time = state.time;
-    // TODO process the rest 
     if (report)
         uiEvents_.send(StateChangeEvent{});
 }
@@ -522,56 +943,117 @@ void RCKid::processAvrExtendedState(comms::ExtendedState & state, bool alreadyLo
 void RCKid::initializeAccel() {
     if (accel_.deviceIdentification() == 104) {
         accel_.reset();
+        // the FIFO is started only when the accelerometer is used, see updateTimers()
+        accel_.disableFifo();
+        accelFound_ = true;
     } else {
         TraceLog(LOG_ERROR, "Accel not found");
     }
 }
 
-uint8_t accelTo1GUnsigned(int16_t v) {
-    if (v < -16384)
-        v = -16384;
-    if (v >= 16384)
-        v = 16383;
-    v += 16384;
-    return (v >> 7);    
+void RCKid::enableAccel(bool enable) {
+    if (!accelFound_ || accelEnabled_ == enable)
+        return;
+    accelEnabled_ = enable;
+    if (enable)
+        accel_.enableFifo(ACCEL_SAMPLE_RATE, true);
+    else
+        accel_.disableFifo();
 }
 
 void RCKid::queryAccelStatus() {
-    MPU6050::AccelData d = accel_.readAccel();
-    int16_t t = accel_.readTemp();
-    uint8_t x = accelTo1GUnsigned(-d.x);
-    uint8_t y = accelTo1GUnsigned(-d.y);
-    bool report = false;
-    if (accelX_.update(x)) {
-        if (accelAsButtons_) {
-            AnalogButtonState bState{axisAsButton(x, ANALOG_BUTTON_THRESHOLD)};
-            if (btnAccelUp_.update(bState == AnalogButtonState::Low))
-                buttonAction(btnAccelUp_, true);
-            if (btnAccelDown_.update(bState == AnalogButtonState::High))
-                buttonAction(btnAccelDown_, true);
-        } else {
-            report = true;
-            axisAction(accelX_);
+    if (!accelEnabled_ || accelPending_ || ++accelTicks_ < ACCEL_READ_TICKS)
+        return;
+    accelTicks_ = 0;
+    auto t = std::make_unique<AsyncI2C::Transaction>(I2CScheduler::Client::Accel, [this](AsyncI2C::Transaction & t) {
+        accelPending_ = false;
+        // the FIFO may have been stopped while the read was on the bus
+        if (!t.ok() || !accelEnabled_)
+            return;
+        int16_t temp = MPU6050::temp(t.result(1));
+        if (accelTemp_ != temp) {
+            std::lock_guard<std::mutex> g{mState_};
+            accelTemp_ = temp;
         }
+        readAccelFifo(MPU6050::fifoCount(t.result(0)));
+    });
+    t->transfer(accel_.address, & MPU6050::REG_FIFO_COUNT, 1, 2);
+    t->transfer(accel_.address, & MPU6050::REG_TEMP, 1, 2);
+    // when synchronous, the callback is called before submitI2C returns
+    accelPending_ = true;
+    if (!submitI2C(std::move(t)))
+        accelPending_ = false;
+}
+
+void RCKid::readAccelFifo(uint16_t count) {
+    // once the FIFO overflows, the oldest bytes are overwritten and the samples are no longer aligned
+    size_t sampleSize = accel_.fifoSampleSize();
+    if (count > MPU6050::FIFO_SIZE - sampleSize) {
+        TraceLog(LOG_WARNING, "Accel FIFO overflow");
+        auto t = std::make_unique<AsyncI2C::Transaction>(I2CScheduler::Client::Accel);
+        t->write(accel_.address, MPU6050::CMD_FIFO_RESET, sizeof(MPU6050::CMD_FIFO_RESET));
+        submitI2C(std::move(t));
+        return;
     }
-    if (accelY_.update(y)) {
-        if (accelAsButtons_) {
-            AnalogButtonState bState{axisAsButton(y, ANALOG_BUTTON_THRESHOLD)};
-            if (btnAccelRight_.update(bState == AnalogButtonState::Low))
-                buttonAction(btnAccelRight_, true);
-            if (btnAccelLeft_.update(bState == AnalogButtonState::High))
-                buttonAction(btnAccelLeft_, true);
-        } else {
-            report = true;
-            axisAction(accelY_);
+    size_t n = std::min<size_t>(count / sampleSize, (AsyncI2C::Transaction::BUFFER_SIZE - 1) / sampleSize);
+    if (n == 0)
+        return;
+    auto t = std::make_unique<AsyncI2C::Transaction>(I2CScheduler::Client::Accel, [this, n](AsyncI2C::Transaction & t) {
+        accelPending_ = false;
+        if (t.ok() && accelEnabled_)
+            processAccelSamples(t.result(), n);
+    });
+    // the read pops the samples from the FIFO, repeating it would skip samples and break the alignment
+    t->transfer(accel_.address, & MPU6050::REG_FIFO_DATA, 1, static_cast<uint8_t>(n * sampleSize)).once();
+    accelPending_ = true;
+    if (!submitI2C(std::move(t)))
+        accelPending_ = false;
+}
+
+void RCKid::processAccelSamples(uint8_t const * samples, size_t n) {
+    bool asButtons;
+    {
+        std::lock_guard<std::mutex> g{mState_};
+        asButtons = accelAsButtons_;
+        if (accelConfigChanged_) {
+            orientation_.setConfig(accelConfig_);
+            accelConfigChanged_ = false;
+        }
+        if (accelCalibrate_) {
+            orientation_.calibrate();
+            accelCalibrate_ = false;
         }
     }
-    if (accelTemp_ != t) {
-        std::lock_guard<std::mutex> g{mState_};
-        accelTemp_ = t;
+    size_t sampleSize = accel_.fifoSampleSize();
+    bool report = false;
+    for (size_t i = 0; i < n; ++i, samples += sampleSize) {
+        MPU6050::AccelData a = MPU6050::accelData(samples);
+        MPU6050::AccelData w = (sampleSize > MPU6050::FIFO_SAMPLE_SIZE) ? MPU6050::accelData(samples + MPU6050::GYRO_OFFSET) : MPU6050::AccelData{};
+        Gesture gesture = orientation_.update(a.x, a.y, a.z, w.x, w.y, w.z);
+        if (gesture != Gesture::None)
+            uiEvents_.send(GestureEvent{gesture});
+        if (asButtons) {
+            if (btnAccelUp_.update(orientation_.buttonX() < 0))
+                buttonAction(btnAccelUp_);
+            if (btnAccelDown_.update(orientation_.buttonX() > 0))
+                buttonAction(btnAccelDown_);
+            if (btnAccelRight_.update(orientation_.buttonY() < 0))
+                buttonAction(btnAccelRight_);
+            if (btnAccelLeft_.update(orientation_.buttonY() > 0))
+                buttonAction(btnAccelLeft_);
+        } else {
+            if (accelX_.update(orientation_.axisX())) {
+                report = true;
+                axisAction(accelX_);
+            }
+            if (accelY_.update(orientation_.axisY())) {
+                report = true;
+                axisAction(accelY_);
+            }
+        }
     }
     if (report)
-        uiEvents_.send(AccelEvent{accelX_.reportedValue, accelY_.reportedValue});
+        uiEvents_.send(AccelEvent{static_cast<uint8_t>(accelX_.reportedValue), static_cast<uint8_t>(accelY_.reportedValue)});
 }
 
 void RCKid::initializeNrf() {
@@ -584,12 +1066,12 @@ void RCKid::initializeNrf() {
     }
     // attach the interrupt handler
     gpio::input(PIN_NRF_IRQ);
-    gpio::attachInterrupt(PIN_NRF_IRQ, gpio::Edge::Falling, & isrNrfIrq);
+    attachInterrupt(PIN_NRF_IRQ, gpio::Edge::Falling, & isrNrfIrq);
 }
 
 void RCKid::initializeISRs() {
     gpio::input(PIN_HEADPHONES);
-    gpio::attachInterrupt(PIN_HEADPHONES, gpio::Edge::Both, & isrHeadphones);
+    attachInterrupt(PIN_HEADPHONES, gpio::Edge::Both, & isrHeadphones);
 
     gpio::inputPullup(PIN_BTN_A);
     gpio::inputPullup(PIN_BTN_B);
@@ -600,15 +1082,15 @@ void RCKid::initializeISRs() {
     gpio::inputPullup(PIN_BTN_DPAD_LEFT);
     gpio::inputPullup(PIN_BTN_DPAD_RIGHT);
     gpio::inputPullup(PIN_BTN_JOY);
-    gpio::attachInterrupt(PIN_BTN_A, gpio::Edge::Both, & isrButtonA);
-    gpio::attachInterrupt(PIN_BTN_B, gpio::Edge::Both, & isrButtonB);
-    gpio::attachInterrupt(PIN_BTN_X, gpio::Edge::Both, & isrButtonX);
-    gpio::attachInterrupt(PIN_BTN_Y, gpio::Edge::Both, & isrButtonY);
-    gpio::attachInterrupt(PIN_BTN_DPAD_UP, gpio::Edge::Both, & isrButtonDpadUp);
-    gpio::attachInterrupt(PIN_BTN_DPAD_DOWN, gpio::Edge::Both, & isrButtonDpadDown);
-    gpio::attachInterrupt(PIN_BTN_DPAD_LEFT, gpio::Edge::Both, & isrButtonDpadLeft);
-    gpio::attachInterrupt(PIN_BTN_DPAD_RIGHT, gpio::Edge::Both, & isrButtonDpadRight);
-    gpio::attachInterrupt(PIN_BTN_JOY, gpio::Edge::Both, & isrButtonJoy);
+    attachInterrupt(PIN_BTN_A, gpio::Edge::Both, & isrButtonA);
+    attachInterrupt(PIN_BTN_B, gpio::Edge::Both, & isrButtonB);
+    attachInterrupt(PIN_BTN_X, gpio::Edge::Both, & isrButtonX);
+    attachInterrupt(PIN_BTN_Y, gpio::Edge::Both, & isrButtonY);
+    attachInterrupt(PIN_BTN_DPAD_UP, gpio::Edge::Both, & isrButtonDpadUp);
+    attachInterrupt(PIN_BTN_DPAD_DOWN, gpio::Edge::Both, & isrButtonDpadDown);
+    attachInterrupt(PIN_BTN_DPAD_LEFT, gpio::Edge::Both, & isrButtonDpadLeft);
+    attachInterrupt(PIN_BTN_DPAD_RIGHT, gpio::Edge::Both, & isrButtonDpadRight);
+    attachInterrupt(PIN_BTN_JOY, gpio::Edge::Both, & isrButtonJoy);
 }
 
 void RCKid::initializeLibevdev() {
@@ -645,7 +1127,15 @@ void RCKid::initializeLibevdev() {
     libevdev_enable_event_code(gamepadDev_, EV_ABS, btnDpadLeft_.evdevId, &thumb);
     // thumbstick button
     libevdev_enable_event_code(gamepadDev_, EV_KEY, btnJoy_.evdevId, nullptr);
-    // enable the thumbstick and accelerometer
+    // enable the thumbstick (in full 10bit precision) and accelerometer
+    input_absinfo stick {
+        .value = 512,
+        .minimum = 0,
+        .maximum = 1023,
+        .fuzz = 0,
+        .flat = 0,
+        .resolution = 1,
+    };
     input_absinfo info {
         .value = 128,
         .minimum = 0,
@@ -654,8 +1144,8 @@ void RCKid::initializeLibevdev() {
         .flat = 0,
         .resolution = 1,
     };
-    libevdev_enable_event_code(gamepadDev_, EV_ABS, joyX_.evdevId, & info);
-    libevdev_enable_event_code(gamepadDev_, EV_ABS, joyY_.evdevId, & info);
+    libevdev_enable_event_code(gamepadDev_, EV_ABS, joyX_.evdevId, & stick);
+    libevdev_enable_event_code(gamepadDev_, EV_ABS, joyY_.evdevId, & stick);
     libevdev_enable_event_code(gamepadDev_, EV_ABS, accelX_.evdevId, & info);
     libevdev_enable_event_code(gamepadDev_, EV_ABS, accelY_.evdevId, & info);
 
@@ -676,17 +1166,20 @@ void RCKid::checkMockButtons() {
     CHECK_KEY(KeyboardKey::KEY_B, btnB_);
     CHECK_KEY(KeyboardKey::KEY_X, btnX_);
     CHECK_KEY(KeyboardKey::KEY_Y, btnY_);
-    CHECK_KEY(KeyboardKey::KEY_L, btnL_);
-    CHECK_KEY(KeyboardKey::KEY_R, btnR_);
     CHECK_KEY(KeyboardKey::KEY_D, btnJoy_);
-    CHECK_KEY(KeyboardKey::KEY_ENTER, btnSelect_);
-    CHECK_KEY(KeyboardKey::KEY_SPACE, btnStart_);
     CHECK_KEY(KeyboardKey::KEY_LEFT, btnDpadLeft_);
     CHECK_KEY(KeyboardKey::KEY_RIGHT, btnDpadRight_);
     CHECK_KEY(KeyboardKey::KEY_UP, btnDpadUp_);
     CHECK_KEY(KeyboardKey::KEY_DOWN, btnDpadDown_);
-    CHECK_KEY(KeyboardKey::KEY_H, btnHome_);
 #undef CHECK_KEY
+    // buttons read by the AVR go through the simulator so that they arrive via the AVR_IRQ and state reads like on the device
+#define CHECK_AVR_KEY(KEY, BTN) if (IsKeyPressed(KEY)) avrSim_.setButton(BTN, true); else if (IsKeyReleased(KEY)) avrSim_.setButton(BTN, false);
+    CHECK_AVR_KEY(KeyboardKey::KEY_L, AvrSimulator::Button::L);
+    CHECK_AVR_KEY(KeyboardKey::KEY_R, AvrSimulator::Button::R);
+    CHECK_AVR_KEY(KeyboardKey::KEY_ENTER, AvrSimulator::Button::Select);
+    CHECK_AVR_KEY(KeyboardKey::KEY_SPACE, AvrSimulator::Button::Start);
+    CHECK_AVR_KEY(KeyboardKey::KEY_H, AvrSimulator::Button::Home);
+#undef CHECK_AVR_KEY
 }
 #endif
 
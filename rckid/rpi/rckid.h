@@ -1,8 +1,12 @@
 #pragma once
 
 #include <queue>
+#include <deque>
+#include <unordered_map>
+#include <array>
 #include <mutex>
 #include <variant>
+#include <utility>
 #include <functional>
 #include <memory>
 #include <atomic>
@@ -83,7 +87,18 @@
 
 #include "common/config.h"
 #include "common/comms.h"
+#include "common/adpcm.h"
 #include "events.h"
+#include "reactor.h"
+#include "input_frame.h"
+#include "trace.h"
+#include "i2c_scheduler.h"
+#include "i2c_async.h"
+#include "orientation.h"
+#include "link_stats.h"
+#if (defined ARCH_MOCK)
+#include "avr_sim.h"
+#endif
 
 /** RCKid RPI Driver
 
@@ -152,8 +167,7 @@ public:
         shouldTerminate_.store(true);
         driverEvents_.send(Terminate{});
         tHwLoop_.join();
-        tTicks_.join();
-        tSeconds_.join();
+        i2cAsync_.stop();
         libevdev_uinput_destroy(gamepad_);
         libevdev_free(gamepadDev_);
     }
@@ -187,6 +201,59 @@ public:
      */
     std::optional<Event> nextEvent();
 
+    /** Blocks the UI thread until there is a UI event to be processed, or for at most timeoutMs milliseconds (-1 waits indefinitely). Returns false if the wait timed out. 
+     */
+    bool waitForEvent(int timeoutMs) UI_THREAD { return uiEvents_.waitFor(timeoutMs); }
+
+    /** Sets the debounce window of the button in microseconds. If the button is also emulated by the thumbstick, or the accelerometer, the virtual buttons are updated as well. 
+     */
+    void setDebounceWindow(Button btn, unsigned us) {
+        for (ButtonState * b : buttons_)
+            if (b->btn == btn)
+                b->debounceUs = us;
+    }
+
+    /** Input latency statistics, from the gpio edge or AVR interrupt to the driver, evdev and UI. 
+     */
+    LatencyStats & inputLatency() { return inputLatency_; }
+
+    /** Radio link statistics. The transmits are recorded as their events are taken from the queue, the apps record the packets they receive. Must only be used from the UI thread. 
+     */
+    LinkStats & linkStats() { return linkStats_; }
+
+    /** The I2C bus scheduler, for its utilization statistics. 
+     */
+    I2CScheduler const & i2cBus() const { return i2cBus_; }
+
+    /** Number of times the driver's thread woke up in the last second. 
+     
+        When the RCKID_REPORT_WAKEUPS environment variable is set, the number is also logged every second. 
+     */
+    size_t driverWakeupsPerSecond() const { return wakeupsPerSecond_.load(); }
+
+    /** Priority classes of the driver events, in the order in which they are served. 
+     */
+    enum class DriverLane {
+        /** Recording and radio interrupts. */
+        Deadline, 
+        /** Buttons, keys and headphones. */
+        Input, 
+        /** Timer ticks and commands. */
+        Housekeeping, 
+    };
+
+    /** Number of recording batches skipped because the driver was busy processing an event of given class when the deadline passed. 
+     */
+    size_t deadlineMisses(DriverLane lane) const { return deadlineMisses_[static_cast<size_t>(lane)].load(); }
+
+    /** Number of UI state updates merged into already queued ones because the UI did not keep up. 
+     */
+    size_t uiEventsCoalesced() const { return uiEvents_.coalesced(); }
+
+    /** Number of UI events dropped because the UI queue was full. 
+     */
+    size_t uiEventsDropped() const { return uiEvents_.overflows(); }
+
     /** Turns RCKid off. 
      
         Tells the AVR to enter the power down mode. AVR does this and then waits for the RPI_POWEROFF signal, while when we detect the transition to powerOff state actually happening, we do rpi shutdown in the main loop.  
@@ -205,7 +272,15 @@ public:
     //@{
     bool gamepadActive() const { std::lock_guard<std::mutex> g{mState_}; return gamepadActive_; }
 
-    void setGamepadActive(bool value = true) { std::lock_guard<std::mutex> g{mState_}; gamepadActive_ = value; }
+    void setGamepadActive(bool value = true) { 
+        {
+            std::lock_guard<std::mutex> g{mState_}; 
+            gamepadActive_ = value; 
+        }
+        // the gamepad needs the accelerometer to be polled and the thumbstick streamed
+        driverEvents_.send(UpdateTimers{});
+        driverEvents_.send(msg::SetJoyStreaming{value});
+    }
 
     void keyPress(int key, bool state) { driverEvents_.send(KeyPress{key, state}); }
 
@@ -215,7 +290,41 @@ public:
 
     bool accelAsButtons() const { std::lock_guard<std::mutex> g{mState_}; return accelAsButtons_; }
 
-    void setAccelAsButtons(bool value) { std::lock_guard<std::mutex> g{mState_}; accelAsButtons_ = value;}
+    void setAccelAsButtons(bool value) { 
+        {
+            std::lock_guard<std::mutex> g{mState_}; 
+            accelAsButtons_ = value;
+        }
+        driverEvents_.send(UpdateTimers{});
+    }
+
+    /** Whether the focused widget wants the gesture events, see Widget::gestures(). 
+     */
+    bool gesturesActive() const { std::lock_guard<std::mutex> g{mState_}; return gesturesActive_; }
+
+    void setGesturesActive(bool value) {
+        {
+            std::lock_guard<std::mutex> g{mState_};
+            if (gesturesActive_ == value)
+                return;
+            gesturesActive_ = value;
+        }
+        driverEvents_.send(UpdateTimers{});
+    }
+
+    /** The dead zones, button thresholds and gesture sensitivity of the accelerometer's tilt controls, see Orientation::Config. 
+     */
+    Orientation::Config accelConfig() const { std::lock_guard<std::mutex> g{mState_}; return accelConfig_; }
+
+    void setAccelConfig(Orientation::Config const & config) {
+        std::lock_guard<std::mutex> g{mState_};
+        accelConfig_ = config;
+        accelConfigChanged_ = true;
+    }
+
+    /** Makes the current orientation of the device the neutral position of the tilt controls. 
+     */
+    void calibrateAccel() { std::lock_guard<std::mutex> g{mState_}; accelCalibrate_ = true; }
     //@}
 
 
@@ -272,7 +381,6 @@ public:
     /** Resets the NRF chip state and enters standby mode. Clears the on-chip rx and tx buffers as well as the internal tx buffer for RC kid. 
      */
     void nrfReset() {
-        std::lock_guard<std::mutex> g{mRadio_};
         nrfTxQueue_.clear();
         driverEvents_.send(NRFState::Standby);
     }
@@ -286,30 +394,43 @@ public:
     /** Enable the radio in transmitter mode, without transmitting any messages. 
      */
     void nrfEnableTransmitter() {
-        bool txEmpty;
-        {
-            std::lock_guard<std::mutex> g{mRadio_};
-            txEmpty = nrfTxQueue_.empty();
-        }
+        bool txEmpty = nrfTxQueue_.empty();
         driverEvents_.send(NRFState::Tx);
         // if there is something in the Tx queue, initiate a transmit message immediately after switching to tx mode
         if (!txEmpty)
             driverEvents_.send(NRFTransmit{});
     }
 
-    /** Transmits a message. If used in received mode, briefly stops the receiver, enters the transmitter mode and then transmits the message, returning to receiver mode afterwards. 
+    /** Transmits a message. If used in received mode, briefly stops the receiver, enters the transmitter mode and then transmits the message, returning to receiver mode afterwards. Returns false if the transmit queue is full and the message has been dropped.
      */
     template<typename T>
-    void nrfTransmit(T const * packet, uint8_t length = 32) {
-        uint8_t const * buffer = reinterpret_cast<uint8_t const *>(packet);
-        std::lock_guard<std::mutex> g{mRadio_};
-        nrfTxQueue_.push_back(NRFPacket{buffer, length});
+    bool nrfTransmit(T const * packet, uint8_t length = 32) {
+        uint8_t * buffer = nrfTxReserve();
+        if (buffer == nullptr)
+            return false;
+        memcpy(buffer, packet, length);
+        nrfTxCommit();
+        return true;
+    }
+
+    /** Returns the next free 32 byte packet in the transmit queue to be filled in place, or nullptr if the queue is full. The packet is sent by nrfTxCommit(). 
+     
+        Like all other nrfTransmit functions, must only be called from the UI thread as the queue has a single producer.
+     */
+    uint8_t * nrfTxReserve() {
+        auto * slot = nrfTxQueue_.reserve();
+        return slot == nullptr ? nullptr : slot->data();
+    }
+
+    void nrfTxCommit() {
         // if we are the first in the queue, we need to notify the driver thread to start sending
-        if (nrfTxQueue_.size() == 1)
+        if (nrfTxQueue_.commit() == 1)
             driverEvents_.send(NRFTransmit{});
     }
 
     /** Transmits the given packet in immediate mode, to minimalize the time spent in tx mode not receiving. 
+     
+        The packet skips the transmit queue and goes straight to the radio's tx fifo. The radio returns to the receiver (or standby) once the fifo has been sent, as signalled by the radio's interrupt.
      */
     template<typename T>
     void nrfTransmitImmediate(T const * packet, uint8_t length = 32) {
@@ -317,13 +438,13 @@ public:
         driverEvents_.send(NRFPacket{buffer, length});
     }
 
-    size_t nrfTxQueueSize() const {
-        std::lock_guard<std::mutex> g{mRadio_};
-        return nrfTxQueue_.size();
-    }
+    /** Number of packets waiting in the transmit queue, the most there have ever been and the number of packets dropped because the queue was full.
+     */
+    size_t nrfTxQueueSize() const { return nrfTxQueue_.size(); }
+    size_t nrfTxQueueMaxSize() const { return nrfTxQueue_.maxSize(); }
+    size_t nrfTxQueueOverflows() const { return nrfTxQueue_.overflows(); }
 
     void nrfClearTxQueue() {
-        std::lock_guard<std::mutex> g{mRadio_};
         nrfTxQueue_.clear();
     }
 
@@ -332,6 +453,30 @@ public:
         return nrfTx_ ? NRFState::Tx : nrfState_;
     }
 
+    /** Time the driver thread spends on a single transmit, i.e. loading the packet to the radio and switching it to the transmitter. The driver never waits for the packet to be sent. 
+     */
+    struct NRFTxStats {
+        size_t transmits;
+        uint32_t avgUs;
+        uint32_t maxUs;
+    };
+
+    NRFTxStats nrfTxStats() const {
+        size_t n = nrfTxCount_.load(std::memory_order_relaxed);
+        uint64_t total = nrfTxBlockedUs_.load(std::memory_order_relaxed);
+        return NRFTxStats{n, static_cast<uint32_t>(n == 0 ? 0 : total / n), nrfTxBlockedMaxUs_.load(std::memory_order_relaxed)};
+    }
+
+    /** Surveys the radio channels. 
+     
+        The receiver is tuned to each channel in turn and its received power detector tells whether the channel is busy. After each sweep over all channels the UI gets NRFScanEvent with the results. When the given number of sweeps is done, the radio returns to its channel and state. The radio can't receive during the scan and changing its state, initializing it, or transmitting stops the scan. A scan requested while the radio is transmitting starts when all the packets have been sent. 
+
+        The receiver needs some time to settle on each channel, so a sweep takes some 30ms. The driver does not wait for the radio, the scan is driven by a timer.
+     */
+    void nrfScan(uint8_t sweeps) {
+        driverEvents_.send(NRFScan{sweeps});
+    }
+
     //@}
 
     void rumblerOk() {
@@ -348,10 +493,18 @@ public:
 
 private:
 
+    /** State of a single button. 
+     
+        When a change is reported, the button enters its debounce window during which further changes are only recorded in the actual state. When the window expires and the actual state differs from the reported one, it is reported then. 
+     */
     struct ButtonState {
         Button const btn;
         unsigned const evdevId;
-        size_t debounceTimer{0};
+        std::atomic<unsigned> debounceUs{BTN_DEBOUNCE_US};
+        std::chrono::steady_clock::time_point debounceEnd;
+        bool debouncing{false};
+        // true if the button is in the debounce active set
+        bool debounceScheduled{false};
         bool actualState{false};
         bool reportedState{false}; // protected by mState_
         int reportValue;
@@ -360,9 +513,9 @@ private:
 
         bool update(bool state) {
             actualState = state;
-            if (debounceTimer == 0) {
+            if (!debouncing) {
                 if (reportedState != actualState) {
-                    debounceTimer = BTN_DEBOUNCE_DURATION_TICKS;
+                    debouncing = true;
                     return true;
                 }
             }
@@ -372,12 +525,12 @@ private:
 
     struct AxisState {
         unsigned const evdevId;
-        uint8_t actualValue{0};
-        uint8_t reportedValue{0}; // protected by mState_
+        uint16_t actualValue{0};
+        uint16_t reportedValue{0}; // protected by mState_
 
         AxisState(unsigned evdevId): evdevId{evdevId} {}
 
-        bool update(uint8_t state) {
+        bool update(uint16_t state) {
             actualValue = state;
             return actualValue != reportedValue;
         }
@@ -385,12 +538,15 @@ private:
 
     struct Terminate{};
     struct Tick {};
-    struct AvrIrq {};
+    struct UpdateTimers {};
+    struct AvrIrq { LatencyClock::time_point origin; };
     struct NRFIrq {};
     struct NRFTransmit {};
     struct HeadphonesIrq { bool value; };
-    struct ButtonIrq { ButtonState & btn; bool state; };
+    struct ButtonIrq { ButtonState & btn; bool state; LatencyClock::time_point origin; };
     struct KeyPress{ int key; bool state; };
+    /** Asynchronous I2C transactions have finished and their callbacks should be called, see completeI2C(). */
+    struct I2CDone {};
 
     struct NRFInitialize{ 
         char rxAddr[5]; 
@@ -403,6 +559,9 @@ private:
         }
     };
 
+    /** Starts the channel scan, see nrfScan(). */
+    struct NRFScan { uint8_t sweeps; };
+
     struct NRFPacket {
         uint8_t packet[32]; 
         NRFPacket(uint8_t const * packet, uint8_t length) {
@@ -413,6 +572,7 @@ private:
     using DriverEvent = std::variant<
         Terminate,
         Tick, 
+        UpdateTimers,
         SecondTick, // ::SecondTick
         AvrIrq,
         NRFIrq, 
@@ -438,21 +598,152 @@ private:
         msg::RGBOff,
         msg::RGBColor,
         msg::PowerOn,
-        msg::PowerDown
+        msg::PowerDown,
+        // internal events, never traced, appended so that the indices of the traced events stay the same
+        I2CDone,
+        // events added since are appended for the same reason
+        msg::SetJoyStreaming,
+        NRFScan
     >;
 
+    /** Priority policy of the driver events. 
+     
+        The AVR only buffers 8 recording batches (some 32ms of audio) and the NRF chip only 3 received packets, so their interrupts are always served first. Input interrupts come next and everything else (timer ticks, commands from the UI, etc.) is housekeeping, which waits until there is nothing more urgent to do. 
+
+        Finished I2C transactions are deadline events too, as they include the recording reads. They are all completed in the order they were submitted regardless of their client, so that an older AVR status is never processed after a newer one.
+     */
+    struct DriverEventPriority {
+        static constexpr size_t LANES = 3;
+
+        static size_t of(DriverEvent const & e) {
+            return static_cast<size_t>(std::visit(overloaded{
+                [](AvrIrq const &) { return DriverLane::Deadline; },
+                [](NRFIrq const &) { return DriverLane::Deadline; },
+                [](ButtonIrq const &) { return DriverLane::Input; },
+                [](KeyPress const &) { return DriverLane::Input; },
+                [](HeadphonesIrq const &) { return DriverLane::Input; },
+                [](I2CDone const &) { return DriverLane::Deadline; },
+                [](auto const &) { return DriverLane::Housekeeping; },
+            }, e));
+        }
+    };
+
     /** Private constructor for the singleton object. */
     RCKid();
 
     void processDriverEvent(DriverEvent e);
 
+    /** Drains the driver events queue, then blocks in the reactor until there is something to do. 
+     */
+    void hwLoop() DRIVER_THREAD;
+
+    /** Arms, or disarms the tick timer depending on whether there is anything to do in the ticks. 
+     */
+    void updateTimers() DRIVER_THREAD;
+
+    /** Attaches the interrupt handler to given pin. 
+     
+        If possible the pin's interrupts are polled by the reactor in the driver thread, otherwise falls back to the wiringPi's ISR thread. In both cases the handler is called. 
+     */
+    void attachInterrupt(platform::gpio::Pin pin, platform::gpio::Edge edge, void (*handler)());
+
     void initializeAvr();
+
+    /** Submits the I2C transaction to the asynchronous engine if the I2C budget of its client allows it. Returns false if the transaction has been deferred, in which case its callback is not called, or if there were too many transactions pending, in which case the callback has already been called with the transaction failed. Otherwise the callback is called in the driver thread when the transaction finishes. 
+     */
+    bool submitI2C(std::unique_ptr<AsyncI2C::Transaction> t) DRIVER_THREAD {
+        if (!i2cBus_.admit(t->client()))
+            return false;
+        if (i2cAsync_.submit(std::move(t)))
+            return true;
+        TraceLog(LOG_WARNING, STR("I2C transaction failed, too many pending (" << i2cAsync_.dropped() << " so far)"));
+        return false;
+    }
+
+    /** Accounts the bus time of the finished I2C transactions and calls their callbacks. 
+     
+        Called for each I2CDone event and after every batch of driver events as the I2CDone event may have been lost when the deadline lane was full.
+     */
+    void completeI2C() DRIVER_THREAD {
+        while (AsyncI2C::Transaction * t = i2cAsync_.nextFinished()) {
+            i2cBus_.account(t->client(), t->busTime());
+            i2cAsync_.complete(t);
+        }
+    }
+
+    /** Moves packets from the transmit queue to the radio's tx fifo until the fifo is full, or the queue is empty. Returns the number of packets moved.
+     */
+    size_t nrfFillTxFifo(platform::NRF24L01::FifoStatus fifo) DRIVER_THREAD {
+        if (fifo.txFull())
+            return 0;
+        size_t n = 0;
+        while (n < NRF_TX_FIFO_SIZE) {
+            auto * p = nrfTxQueue_.front();
+            // the radio refuses the packet when its fifo is full
+            if (p == nullptr || !nrf_.transmit(p->data(), 32))
+                break;
+            nrfTxQueue_.pop();
+            ++n;
+        }
+        nrfTxLoaded_ += n;
+        return n;
+    }
+
+    /** Accounts the packets the radio has finished since the last tx irq, given the state of the tx fifo at the irq. 
+     
+        As the radio sends the whole tx fifo back to back, a single irq may stand for several packets. Those done are the packets loaded minus those still in the fifo. The fifo only tells whether it is empty, or full, so with one or two packets left two are assumed and a packet that has been sent already is accounted at the next irq. A packet the radio gave up on (only possible with acks) stays in the fifo with those behind it and they are all flushed, i.e. failed. 
+     */
+    NRFTxEvent nrfTxFinished(platform::NRF24L01::FifoStatus fifo, bool failed) DRIVER_THREAD {
+        uint8_t left = fifo.txEmpty() ? 0 : fifo.txFull() ? NRF_TX_FIFO_SIZE : NRF_TX_FIFO_SIZE - 1;
+        uint8_t sent = nrfTxLoaded_ > left ? nrfTxLoaded_ - left : 0;
+        if (failed) {
+            NRFTxEvent result{std::max<uint8_t>(nrfTxLoaded_, 1), std::max<uint8_t>(nrfTxLoaded_ - sent, 1)};
+            nrfTxLoaded_ = 0;
+            return result;
+        }
+        nrfTxLoaded_ -= sent;
+        return NRFTxEvent{sent, 0};
+    }
+
+    /** Starts the channel scan with the given number of sweeps. The radio must not be transmitting. 
+     */
+    void nrfStartScan(uint8_t sweeps) DRIVER_THREAD;
+
+    /** Measures the channel the receiver has been tuned to for the scan and tunes it to the next one. Called by the scan timer. After the last sweep returns the radio to its channel and state. 
+     */
+    void nrfScanStep() DRIVER_THREAD;
+
+    /** Stops the channel scan, if in progress, and tunes the radio back to its channel. 
+     */
+    void nrfStopScan() DRIVER_THREAD {
+        if (nrfScanSweeps_ == 0)
+            return;
+        nrfScanTimer_.stop();
+        nrfScanSweeps_ = 0;
+        nrf_.setChannel(nrfScanRestore_);
+    }
+
+    /** Records the time the driver thread spent on a radio transmit that started at the given time.
+     */
+    void recordNrfTx(LatencyClock::time_point start) DRIVER_THREAD {
+        uint32_t us = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(LatencyClock::now() - start).count());
+        nrfTxCount_.fetch_add(1, std::memory_order_relaxed);
+        nrfTxBlockedUs_.fetch_add(us, std::memory_order_relaxed);
+        if (us > nrfTxBlockedMaxUs_.load(std::memory_order_relaxed))
+            nrfTxBlockedMaxUs_.store(us, std::memory_order_relaxed);
+    }
+
     /** Transmits the given command to the AVR. 
      */
     template<typename T>
     void sendAvrCommand(T const & cmd) DRIVER_THREAD {
         static_assert(std::is_base_of<msg::Message, T>::value, "only applicable for mesages");
-        platform::i2c::transmit(AVR_I2C_ADDRESS, reinterpret_cast<uint8_t const *>(& cmd), sizeof(T), nullptr, 0);
+        auto t = std::make_unique<AsyncI2C::Transaction>(I2CScheduler::Client::AvrCommand, [](AsyncI2C::Transaction & t) {
+            if (!t.ok())
+                TraceLog(LOG_ERROR, STR("AVR command " << static_cast<int>(T::ID) << " failed"));
+        });
+        t->write(AVR_I2C_ADDRESS, & cmd, sizeof(T)).needsStop();
+        submitI2C(std::move(t));
     }
     comms::Status queryAvrStatus() {
         comms::Status status;
@@ -460,59 +751,191 @@ private:
         return status;
     }
 
-    comms::State queryAvrState() {
-        comms::State state;
-        platform::i2c::transmit(AVR_I2C_ADDRESS, nullptr, 0, (uint8_t*)& state, sizeof(state));
-        return state;
+    /** Reads the AVR state after AVR_IRQ and processes the input. 
+     */
+    void queryAvrState(LatencyClock::time_point origin) DRIVER_THREAD;
+
+    /** Reads the first size bytes of the extended state if the I2C budget of the client allows it and calls the callback with the result when done. Returns false if the read has been deferred. If the read fails, the callback is not called. 
+     */
+    bool queryAvrExtendedState(uint8_t size, I2CScheduler::Client client, std::function<void(comms::ExtendedState &)> done) DRIVER_THREAD {
+        auto t = std::make_unique<AsyncI2C::Transaction>(client, [size, done = std::move(done)](AsyncI2C::Transaction & t){
+            if (!t.ok()) {
+                TraceLog(LOG_WARNING, "AVR extended state read failed");
+                return;
+            }
+            comms::ExtendedState state;
+            memcpy(& state, t.result(), size);
+            done(state);
+        });
+        t->read(AVR_I2C_ADDRESS, size).needsStop();
+        return submitI2C(std::move(t));
     }
 
-    comms::ExtendedState queryAvrExtendedState() {
-        comms::ExtendedState state;
-        platform::i2c::transmit(AVR_I2C_ADDRESS, nullptr, 0, (uint8_t*)& state, sizeof(state));
-        return state;
+    /** Reads the extended state as far as the last of the given changed parts and processes it. 
+     */
+    void queryAvrChanges(comms::Changes changes, I2CScheduler::Client client = I2CScheduler::Client::AvrExtendedState) DRIVER_THREAD;
+
+    /** Reads the whole extended state, including the time and uptime, and processes it. Returns false if the read has been deferred. 
+     */
+    bool queryAvrFullState() DRIVER_THREAD;
+
+    /** Reads the recorded batches from the AVR in a single burst and sends them to the UI, one event per batch. 
+     
+        The AVR raises the interrupt when at least recBurst_ batches are available, so that many are read. If the status says more batches were available, the AVR raises the interrupt again right away and the next burst reads all of the remaining ones. 
+     */
+    void getAvrRecording() DRIVER_THREAD {
+        uint8_t batches = std::max(recBurst_, recPending_);
+        auto t = std::make_unique<AsyncI2C::Transaction>(I2CScheduler::Client::Recording, [this, batches](AsyncI2C::Transaction & t){
+            // the AVR keeps the batches and raises the interrupt again
+            if (!t.ok()) {
+                TraceLog(LOG_WARNING, "AVR recording read failed");
+                return;
+            }
+            processAvrRecording(t.result(), batches, t.started());
+        });
+        t->read(AVR_I2C_ADDRESS, 1 + batches * 32).needsStop();
+        submitI2C(std::move(t));
     }
 
-    void getAvrRecording() {
-        RecordingEvent r;
-        platform::i2c::transmit(AVR_I2C_ADDRESS, nullptr, 0, (uint8_t*)(&r), sizeof(RecordingEvent));
+    /** Processes the recording burst read from the AVR at the given time. 
+     */
+    void processAvrRecording(uint8_t const * buffer, uint8_t batches, LatencyClock::time_point t) DRIVER_THREAD {
+        comms::Status status = * reinterpret_cast<comms::Status const *>(buffer);
         // do the normal status processing as we would in non-recording mode
-        processAvrStatus(r.status);
-        if (r.status.recording() && !r.status.batchIncomplete())
-            uiEvents_.send(r);
+        processAvrStatus(status);
+        // no complete batches, such as when the read was issued just after the recording started, or the previous burst already took them all, means there is nothing to do
+        if (!status.recording() || status.batchIncomplete())
+            return;
+        uint8_t read = std::min(status.batchCount(), batches);
+        size_t missed = checkRecordingDeadline(status, read, t);
+        recPending_ = status.batchCount() - read;
+        // the events do not correspond to the batches, so the lost batches are replaced with silence to keep the timing
+        unsigned n = comms::samplesPerBatch(recEncoding_, recBits_);
+        int16_t samples[adpcm::samplesPerBlock(32)];
+        if (missed > 0) {
+            memset(samples, 0, sizeof(samples));
+            for (size_t i = 0; i < missed; ++i)
+                sendRecordedSamples(status, samples, n);
+        }
+        for (uint8_t i = 0; i < read; ++i) {
+            uint8_t const * batch = buffer + 1 + i * 32;
+            if (recEncoding_ == comms::AudioEncoding::ADPCM)
+                adpcm::decodeBlock(batch, 32, samples);
+            else if (recBits_ > 8)
+                for (unsigned j = 0; j < n; ++j)
+                    samples[j] = static_cast<int16_t>(batch[j * 2] | (batch[j * 2 + 1] << 8));
+            else
+                for (unsigned j = 0; j < n; ++j)
+                    samples[j] = (static_cast<int16_t>(batch[j]) - 128) * 256;
+            sendRecordedSamples(status, samples, n);
+        }
+    }
+
+    /** Sends the decoded recording to the UI in 32 sample events with consecutive batch indices. 
+     */
+    void sendRecordedSamples(comms::Status status, int16_t const * samples, size_t n) DRIVER_THREAD {
+        while (n > 0) {
+            size_t x = std::min<size_t>(n, 32 - recNumSamples_);
+            memcpy(recSamples_ + recNumSamples_, samples, x * sizeof(int16_t));
+            recNumSamples_ += x;
+            samples += x;
+            n -= x;
+            if (recNumSamples_ == 32) {
+                RecordingEvent r;
+                r.status = status;
+                r.status.setBatchIndex(recEventIndex_++);
+                r.status.setBatchCount(1);
+                memcpy(r.data, recSamples_, sizeof(r.data));
+                uiEvents_.send(r);
+                recNumSamples_ = 0;
+            }
+        }
+    }
+
+    /** Detects recording batches lost because the driver did not read them in time and blames them on the class of the event processed just before. Only called for reads with at least one complete batch.
+     
+        A gap in the batch indices means batches were read, but never processed. As the AVR's batch index only advances when batches are read, a recorder that went all the way around its buffer does not leave a gap, but the batch count, which is modulo the 8 batches of the buffer, is then 8 batches short of what has been recorded since the previous read (the batches left unread then and those recorded in the time between the reads). The difference is rounded to whole laps, so that the timing noise of the reads does not count. Returns the number of batches lost. 
+     */
+    size_t checkRecordingDeadline(comms::Status status, uint8_t batches, LatencyClock::time_point t) DRIVER_THREAD {
+        size_t missed = 0;
+        if (lastRecBatch_ >= 0) {
+            missed = (status.batchIndex() - lastRecBatch_ - 1) & 7;
+            int64_t recorded = std::chrono::duration_cast<std::chrono::microseconds>(t - lastRecRead_).count() * recSampleRate_ / (comms::samplesPerBatch(recEncoding_, recBits_) * 1000000ll);
+            int64_t deficit = recPending_ + recorded - status.batchCount();
+            if (deficit > 0)
+                missed += (deficit + 4) / 8 * 8;
+        }
+        // the last batch of the burst
+        lastRecBatch_ = (status.batchIndex() + batches - 1) & 7;
+        lastRecRead_ = t;
+        if (missed != 0)
+            deadlineMisses_[static_cast<size_t>(lastLane_)] += missed;
+        return missed;
     }
 
     void processAvrStatus(comms::Status status, bool alreadyLocked = false);
     void processAvrControls(comms::Controls controls, bool alreadyLocked = false);
-    void processAvrExtendedState(comms::ExtendedState & state, bool alreadyLocked = false);
+    void processAvrExtendedState(comms::ExtendedState & state, comms::Changes changes, bool alreadyLocked = false);
 
     void initializeAccel();
-    void queryAccelStatus();
+
+    /** Starts the accelerometer's FIFO (and the gyroscope) when the gamepad, the virtual buttons, or gestures need it and stops it when nobody polls. 
+     */
+    void enableAccel(bool enable) DRIVER_THREAD;
+
+    /** The accelerometer stores its samples in its FIFO and the driver reads them in bursts every ACCEL_READ_TICKS ticks. The burst takes two transactions, the first reads the number of bytes in the FIFO and the temperature, the second reads only the samples counted, since reading a sample that is just being stored would break the alignment of the FIFO. Samples left in the FIFO when the read is deferred by the I2C scheduler are read next time. 
+     */
+    void queryAccelStatus() DRIVER_THREAD;
+    void readAccelFifo(uint16_t count) DRIVER_THREAD;
+
+    /** Runs the samples of a burst through the orientation filter, updates the axes and the virtual buttons and sends the detected gestures to the UI. 
+     */
+    void processAccelSamples(uint8_t const * samples, size_t n) DRIVER_THREAD;
 
     void initializeNrf();
     
     void initializeISRs();
-    static void isrAvrIrq() { RCKid::instance()->driverEvents_.send(AvrIrq{}); }
+    static void isrAvrIrq() { RCKid::instance()->driverEvents_.send(AvrIrq{LatencyClock::now()}); }
     static void isrNrfIrq() { RCKid::instance()->driverEvents_.send(NRFIrq{}); }
     static void isrHeadphones() { RCKid::instance()->driverEvents_.send(HeadphonesIrq{platform::gpio::read(PIN_HEADPHONES)}); }
-    static void isrButtonA() { auto & i = RCKid::instance(); i->driverEvents_.send(ButtonIrq{i->btnA_, ! platform::gpio::read(PIN_BTN_A)}); }
-    static void isrButtonB() { auto & i = RCKid::instance(); i->driverEvents_.send(ButtonIrq{i->btnB_, ! platform::gpio::read(PIN_BTN_B)}); }
-    static void isrButtonX() { auto & i = RCKid::instance(); i->driverEvents_.send(ButtonIrq{i->btnX_, ! platform::gpio::read(PIN_BTN_X)}); }
-    static void isrButtonY() { auto & i = RCKid::instance(); i->driverEvents_.send(ButtonIrq{i->btnY_, ! platform::gpio::read(PIN_BTN_Y)}); }
-    static void isrButtonDpadUp() { auto & i = RCKid::instance(); i->driverEvents_.send(ButtonIrq{i->btnDpadUp_, ! platform::gpio::read(PIN_BTN_DPAD_UP)}); }
-    static void isrButtonDpadDown() { auto & i = RCKid::instance(); i->driverEvents_.send(ButtonIrq{i->btnDpadDown_, ! platform::gpio::read(PIN_BTN_DPAD_DOWN)}); }
-    static void isrButtonDpadLeft() { auto & i = RCKid::instance(); i->driverEvents_.send(ButtonIrq{i->btnDpadLeft_, ! platform::gpio::read(PIN_BTN_DPAD_LEFT)}); }
-    static void isrButtonDpadRight() { auto & i = RCKid::instance(); i->driverEvents_.send(ButtonIrq{i->btnDpadRight_, ! platform::gpio::read(PIN_BTN_DPAD_RIGHT)}); }
-    static void isrButtonJoy() { auto & i = RCKid::instance(); i->driverEvents_.send(ButtonIrq{i->btnJoy_, ! platform::gpio::read(PIN_BTN_JOY)}); }
+    static void isrButtonA() { auto & i = RCKid::instance(); i->driverEvents_.send(ButtonIrq{i->btnA_, ! platform::gpio::read(PIN_BTN_A), LatencyClock::now()}); }
+    static void isrButtonB() { auto & i = RCKid::instance(); i->driverEvents_.send(ButtonIrq{i->btnB_, ! platform::gpio::read(PIN_BTN_B), LatencyClock::now()}); }
+    static void isrButtonX() { auto & i = RCKid::instance(); i->driverEvents_.send(ButtonIrq{i->btnX_, ! platform::gpio::read(PIN_BTN_X), LatencyClock::now()}); }
+    static void isrButtonY() { auto & i = RCKid::instance(); i->driverEvents_.send(ButtonIrq{i->btnY_, ! platform::gpio::read(PIN_BTN_Y), LatencyClock::now()}); }
+    static void isrButtonDpadUp() { auto & i = RCKid::instance(); i->driverEvents_.send(ButtonIrq{i->btnDpadUp_, ! platform::gpio::read(PIN_BTN_DPAD_UP), LatencyClock::now()}); }
+    static void isrButtonDpadDown() { auto & i = RCKid::instance(); i->driverEvents_.send(ButtonIrq{i->btnDpadDown_, ! platform::gpio::read(PIN_BTN_DPAD_DOWN), LatencyClock::now()}); }
+    static void isrButtonDpadLeft() { auto & i = RCKid::instance(); i->driverEvents_.send(ButtonIrq{i->btnDpadLeft_, ! platform::gpio::read(PIN_BTN_DPAD_LEFT), LatencyClock::now()}); }
+    static void isrButtonDpadRight() { auto & i = RCKid::instance(); i->driverEvents_.send(ButtonIrq{i->btnDpadRight_, ! platform::gpio::read(PIN_BTN_DPAD_RIGHT), LatencyClock::now()}); }
+    static void isrButtonJoy() { auto & i = RCKid::instance(); i->driverEvents_.send(ButtonIrq{i->btnJoy_, ! platform::gpio::read(PIN_BTN_JOY), LatencyClock::now()}); }
 
     void initializeLibevdev();
 
-    void buttonTick(ButtonState & btn) {
-        if (btn.debounceTimer > 0 && --btn.debounceTimer == 0)
-            if (btn.reportedState != btn.actualState)
-                buttonAction(btn);
-    }
+    /** Adds the button to the debounce active set and rearms the debounce timer if its window ends before all others. 
+     */
+    void scheduleDebounce(ButtonState & btn) DRIVER_THREAD;
+
+    /** Removes all buttons whose debounce window is over from the active set, reports their changes if any and rearms the timer for the next window to expire. 
+     */
+    void debounceExpired() DRIVER_THREAD;
+
+    /** Appends the driver event to the trace. Events are stored as their raw bytes, except for the button interrupts, which store the index of the button and its state. The interrupt timestamps are not stored, replayed events are timestamped when they are replayed. 
+     */
+    void traceEvent(DriverEvent const & e) DRIVER_THREAD;
+
+    /** Decodes the driver event from its trace record, returns nothing if the record is not a valid event. 
+     */
+    std::optional<DriverEvent> decodeEvent(std::vector<uint8_t> const & payload);
+
+    template<size_t... I>
+    static std::optional<DriverEvent> decodeRawEvent(uint8_t index, uint8_t const * data, size_t size, std::index_sequence<I...>);
+
+    static void traceI2C(uint8_t address, uint8_t const * rb, uint8_t rsize, bool result) { tracer_.load()->i2c(address, rb, rsize, result); }
+    static void traceSPI(uint8_t const * rx, size_t numBytes) { tracer_.load()->spi(rx, numBytes); }
 
     void buttonAction(ButtonState & btn, bool alreadyLocked = false) {
+        // changes reported by update() start the debounce window
+        if (btn.debouncing && !btn.debounceScheduled)
+            scheduleDebounce(btn);
         bool gamepadActive;
         {
             utils::cond_lock_guard g{mState_, alreadyLocked};
@@ -522,13 +945,35 @@ private:
         // send the event to libevdev, if required
         if (gamepadActive && btn.evdevId != KEY_RESERVED && gamepad_ != nullptr) {
             if (btn.reportValue == 0)
-                libevdev_uinput_write_event(gamepad_, EV_KEY, btn.evdevId, btn.actualState ? 1 : 0);
+                evdevEvent(EV_KEY, btn.evdevId, btn.actualState ? 1 : 0);
             else
-                libevdev_uinput_write_event(gamepad_, EV_ABS, btn.evdevId, btn.actualState ? btn.reportValue : 0);
-            libevdev_uinput_write_event(gamepad_, EV_SYN, SYN_REPORT, 0);
+                evdevEvent(EV_ABS, btn.evdevId, btn.actualState ? btn.reportValue : 0);
         }
         // send the event to the UI thread
-        uiEvents_.send(ButtonEvent{btn.btn, btn.reportedState});
+        uiEvents_.send(ButtonEvent{btn.btn, btn.reportedState, inputOrigin_});
+    }
+
+    auto evdevSink() {
+        return [this](uint16_t type, uint16_t code, int32_t value) {
+            libevdev_uinput_write_event(gamepad_, type, code, value);
+        };
+    }
+
+    /** Adds the event to the current input frame. The frame is flushed by the hw loop once all pending driver events have been processed. 
+     */
+    void evdevEvent(uint16_t type, uint16_t code, int32_t value) DRIVER_THREAD {
+        inputFrame_.add(type, code, value, evdevSink());
+        // the frame's latency is measured from the oldest interrupt that contributed to it
+        if (frameOrigin_ == LatencyClock::time_point{} || (inputOrigin_ != LatencyClock::time_point{} && inputOrigin_ < frameOrigin_))
+            frameOrigin_ = inputOrigin_;
+    }
+
+    void flushInputFrame() DRIVER_THREAD {
+        if (inputFrame_.empty())
+            return;
+        inputFrame_.flush(evdevSink());
+        inputLatency_.record(LatencyStats::Stage::Evdev, frameOrigin_);
+        frameOrigin_ = LatencyClock::time_point{};
     }
 
     void axisAction(AxisState & axis, bool alreadyLocked = false) {
@@ -539,10 +984,8 @@ private:
             gamepadActive = gamepadActive_;
         }
         // send the event to libevdev, if required
-        if (gamepadActive && axis.evdevId != KEY_RESERVED && gamepad_ != nullptr) {
-            libevdev_uinput_write_event(gamepad_, EV_ABS, axis.evdevId, axis.actualValue);
-            libevdev_uinput_write_event(gamepad_, EV_SYN, SYN_REPORT, 0);
-        }
+        if (gamepadActive && axis.evdevId != KEY_RESERVED && gamepad_ != nullptr)
+            evdevEvent(EV_ABS, axis.evdevId, axis.actualValue);
         // note we can't send the ui event since the ui events are handled differently (thumb vs accel)
     }
 
@@ -566,10 +1009,29 @@ private:
     }
 
     /** Hardware events sent to the driver's thread main loop from other threads. */
-    EventQueue<DriverEvent> driverEvents_;
-
-    /** Events sent from the  ISR and comm threads to the main thread. */
-    EventQueue<Event> uiEvents_;
+    EventQueue<DriverEvent, 256, DriverEventPriority> driverEvents_;
+    /** Class of the driver event processed last and the index of the last recording batch received (-1 when not recording). */
+    DriverLane lastLane_ = DriverLane::Housekeeping;
+    int lastRecBatch_ = -1;
+    /** Time of the last recording read with complete batches, valid when lastRecBatch_ is. */
+    LatencyClock::time_point lastRecRead_;
+    /** Number of batches the AVR accumulates before raising the interrupt and the number of complete batches left in the AVR after the last burst. */
+    uint8_t recBurst_ = 1;
+    uint8_t recPending_ = 0;
+    /** Encoding, sample resolution and sample rate of the recording, the decoded samples not yet sent to the UI and the batch index of the next recording event. */
+    comms::AudioEncoding recEncoding_ = comms::AudioEncoding::Raw;
+    uint8_t recBits_ = 8;
+    uint16_t recSampleRate_ = 8000;
+    int16_t recSamples_[32];
+    uint8_t recNumSamples_ = 0;
+    uint8_t recEventIndex_ = 0;
+    std::atomic<size_t> deadlineMisses_[DriverEventPriority::LANES] = {};
+
+    /** Events sent from the  ISR and comm threads to the main thread. 
+     
+        The queue is larger than the driver queue so that some 4 (8kHz) or 2 (16kHz) seconds worth of recording events survive a stalled UI thread (e.g. while loading a big asset) before they start to be dropped. State updates are coalesced so they do not take space in the queue while the UI is stalled.
+    */
+    UIEventQueue<1024> uiEvents_;
 
     /** Last known state of the AVR so that we can determine any changes and emit events. Protected by a mutex. */
     comms::ExtendedState state_;
@@ -585,9 +1047,33 @@ private:
 
     struct libevdev * gamepadDev_{nullptr};
     struct libevdev_uinput * gamepad_{nullptr};
+    InputFrame<> inputFrame_;
+
+    /** Input latency measurements. The input origin is the interrupt time of the driver event being processed (if it is an input event), the frame origin is the oldest input origin in the current input frame. */
+    LatencyStats inputLatency_;
+
+    /** Radio link statistics, UI thread only. */
+    LinkStats linkStats_;
+
+    /** Shares the I2C bus between the recording, AVR input and the periodic polls. */
+    I2CScheduler i2cBus_;
+    /** Executes the I2C transactions of the driver thread. */
+    AsyncI2C i2cAsync_;
+    /** True while an accelerometer read is in flight so that slow reads do not pile up. */
+    bool accelPending_ = false;
+    /** Ticks since the last accelerometer FIFO read. */
+    unsigned accelTicks_ = 0;
+    /** Seconds since the time and uptime were last read from the AVR. */
+    unsigned avrTimeSyncTicks_ = 0;
+    LatencyClock::time_point inputOrigin_;
+    LatencyClock::time_point frameOrigin_;
     bool gamepadActive_{false}; // protected by mState_
     bool joyAsButtons_{true}; 
     bool accelAsButtons_{false};
+    bool gesturesActive_{false}; // protected by mState_
+    /** True if the accelerometer has been found, and whether its FIFO is running. */
+    bool accelFound_ = false;
+    bool accelEnabled_ = false;
 
     ButtonState btnA_{Button::A, BTN_EAST};
     ButtonState btnB_{Button::B, BTN_SOUTH};
@@ -622,17 +1108,62 @@ private:
     AxisState accelY_{ABS_RY};
 
     platform::MPU6050 accel_;
+    Orientation orientation_{ACCEL_SAMPLE_RATE, platform::MPU6050::ACCEL_LSB_PER_G, platform::MPU6050::GYRO_LSB_PER_DPS};
+    Orientation::Config accelConfig_; // protected by mState_
+    bool accelConfigChanged_ = false; // protected by mState_
+    bool accelCalibrate_ = false; // protected by mState_
+
+    /** Depth of the NRF24L01's tx fifo. */
+    static constexpr size_t NRF_TX_FIFO_SIZE = 3;
 
     platform::NRF24L01 nrf_{PIN_NRF_CS, PIN_NRF_RXTX};
     bool nrfTx_{false};
+    /** Packets loaded to the tx fifo that have not been accounted by nrfTxFinished() yet. */
+    uint8_t nrfTxLoaded_ = 0;
     NRFState nrfState_{NRFState::PowerDown};
-    std::deque<NRFPacket> nrfTxQueue_;
+    /** Packets to transmit, filled in place by the UI thread and sent from the ring by the driver thread. */
+    utils::SpscRing<std::array<uint8_t, 32>, NRF_TX_QUEUE_SIZE> nrfTxQueue_;
     mutable std::mutex mRadio_;
+    std::atomic<size_t> nrfTxCount_{0};
+    std::atomic<uint64_t> nrfTxBlockedUs_{0};
+    std::atomic<uint32_t> nrfTxBlockedMaxUs_{0};
+    /** The channel scan, the sweeps left (0 if not scanning), the channel being measured, the radio's own channel and the results of the current sweep. */
+    TimerFd nrfScanTimer_;
+    uint8_t nrfScanSweeps_ = 0;
+    uint8_t nrfScanChannel_ = 0;
+    uint8_t nrfScanRestore_ = 0;
+    NRFScanEvent nrfScanResult_{};
+    /** Sweeps of the scan requested while transmitting, 0 if none. */
+    uint8_t nrfScanDeferred_ = 0;
+
+
+    /** All buttons, physical and virtual, in the order in which they are debounced. */
+    ButtonState * const buttons_[22] = {
+        & btnA_, & btnB_, & btnX_, & btnY_, & btnL_, & btnR_, & btnSelect_, & btnStart_, 
+        & btnDpadLeft_, & btnDpadRight_, & btnDpadUp_, & btnDpadDown_, & btnJoy_, & btnHome_,
+        & btnJoyUp_, & btnJoyDown_, & btnJoyLeft_, & btnJoyRight_, 
+        & btnAccelUp_, & btnAccelDown_, & btnAccelLeft_, & btnAccelRight_,
+    };
 
-
+    /** The hw loop thread waits on the reactor for the driver events, timers and gpio interrupts. 
+     
+        The tick timer is only armed when there is something to do in the tick (polling the accelerometer), the debounce timer is one-shot and armed for the earliest end of a debounce window, if any, and the second timer runs always. 
+     */
     std::thread tHwLoop_;
-    std::thread tTicks_;
-    std::thread tSeconds_;
+    Reactor reactor_;
+    TimerFd tickTimer_;
+    TimerFd debounceTimer_;
+    /** Buttons that are currently in their debounce window, in no particular order. */
+    ButtonState * debouncing_[22];
+    size_t numDebouncing_ = 0;
+    TimerFd secondTimer_;
+    size_t lastWakeups_ = 0;
+    std::atomic<size_t> wakeupsPerSecond_{0};
+    bool reportWakeups_ = false;
+    /** Driver trace, recorded when the RCKID_TRACE environment variable is set to the trace file. The bus observers are static functions and the bus is used before the singleton is fully constructed, so they get to the trace via the static pointer. */
+    Trace::Writer trace_;
+    bool tracing_ = false;
+    static inline std::atomic<Trace::Writer *> tracer_{nullptr};
     std::atomic<bool> shouldTerminate_{false};
 
     static inline std::unique_ptr<RCKid> & instance() {
@@ -645,10 +1176,28 @@ private:
     }
 
 #if (defined ARCH_MOCK)
-    volatile bool mockRecording_ = false;
-    volatile uint8_t mockRecBatch_ = 0;
+    /** The simulated AVR attached to the mock I2C bus. */
+    AvrSimulator avrSim_;
 
     void checkMockButtons();
+
+    /** Replays the trace given in the RCKID_REPLAY environment variable instead of running the hw loop. 
+     
+        Every recorded event is processed by the driver in the recorded order, at the original speed, or as fast as possible if RCKID_REPLAY_FAST is set, and the I2C and SPI transactions are answered with the recorded responses. Events sent to the driver by the UI during the replay are discarded, their recorded counterparts are replayed instead. When done, the replay statistics are logged and the input latency statistics are written next to the trace. 
+     */
+    void replayLoop() DRIVER_THREAD;
+
+    Trace replay_;
+    bool replaying_ = false;
+    bool replayFast_ = false;
+    /** Next I2C responses to be replayed for each device and the next SPI response, as indices of the trace's records. */
+    std::unordered_map<uint8_t, std::deque<size_t>> replayI2C_;
+    size_t replaySPI_ = 0;
+    /** Number of transactions and events that did not match the trace. */
+    std::atomic<size_t> replayDivergences_{0};
+    std::mutex mReplay_;
+    std::unordered_map<uint8_t, platform::i2c::Slave> replayI2CSlaves_;
+    platform::spi::Slave replaySPISlave_;
 #endif
 
 }; // RCKid
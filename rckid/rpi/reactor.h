@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstdint>
+#include <cerrno>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+/** A periodic or one-shot timer backed by a timerfd.
+
+    Periodic timers are rearmed by the kernel relative to the previous expiration so they do not drift regardless of how long it took to handle the previous expiration. The timer does nothing by itself, its fd() must be added to a Reactor.
+ */
+class TimerFd {
+public:
+
+    TimerFd():
+        fd_{timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)} {
+    }
+
+    ~TimerFd() {
+        close(fd_);
+    }
+
+    TimerFd(TimerFd const &) = delete;
+    TimerFd & operator = (TimerFd const &) = delete;
+
+    int fd() const { return fd_; }
+
+    bool running() const { return running_; }
+
+    /** Starts the timer so that it fires every periodUs microseconds.
+     */
+    void start(unsigned periodUs) {
+        arm(periodUs, periodUs);
+    }
+
+    /** Starts the timer so that it fires once after given delay.
+     */
+    void startOnce(unsigned delayUs) {
+        arm(delayUs, 0);
+    }
+
+    void stop() {
+        if (running_)
+            arm(0, 0);
+    }
+
+    /** Acknowledges the expiration and returns how many times the timer expired since the last call.
+     */
+    uint64_t expirations() {
+        uint64_t result = 0;
+        if (read(fd_, & result, sizeof(result)) != sizeof(result))
+            return 0;
+        if (period_ == 0)
+            running_ = false;
+        return result;
+    }
+
+private:
+
+    void arm(unsigned valueUs, unsigned periodUs) {
+        itimerspec t{
+            .it_interval = { .tv_sec = periodUs / 1000000, .tv_nsec = (periodUs % 1000000) * 1000l },
+            .it_value = { .tv_sec = valueUs / 1000000, .tv_nsec = (valueUs % 1000000) * 1000l },
+        };
+        timerfd_settime(fd_, 0, & t, nullptr);
+        running_ = valueUs != 0;
+        period_ = periodUs;
+    }
+
+    int fd_;
+    bool running_ = false;
+    unsigned period_ = 0;
+
+}; // TimerFd
+
+/** A minimal epoll based reactor.
+
+    Waits for any number of file descriptors (timers, eventfds, gpio interrupts, etc.) at once and calls their handlers from the thread that polls the reactor. Counts the wakeups so that the idle behavior of the poller can be monitored.
+ */
+class Reactor {
+public:
+
+    using Handler = std::function<void()>;
+
+    Reactor():
+        fd_{epoll_create1(EPOLL_CLOEXEC)} {
+    }
+
+    ~Reactor() {
+        close(fd_);
+    }
+
+    Reactor(Reactor const &) = delete;
+    Reactor & operator = (Reactor const &) = delete;
+
+    /** Adds the file descriptor and the handler to be called when the descriptor becomes ready for any of the given events. Returns false if the descriptor can't be polled.
+     */
+    bool add(int fd, Handler handler, uint32_t events = EPOLLIN) {
+        if (fd < 0)
+            return false;
+        handlers_.push_back(std::make_unique<Handler>(std::move(handler)));
+        epoll_event e{};
+        e.events = events;
+        e.data.ptr = handlers_.back().get();
+        if (epoll_ctl(fd_, EPOLL_CTL_ADD, fd, & e) != 0) {
+            handlers_.pop_back();
+            return false;
+        }
+        return true;
+    }
+
+    bool add(TimerFd & timer, Handler handler) {
+        return add(timer.fd(), std::move(handler));
+    }
+
+    /** Waits for at most timeoutMs milliseconds (-1 waits indefinitely, 0 does not wait at all) and calls the handlers of all ready descriptors. Returns the number of handlers called.
+     */
+    size_t poll(int timeoutMs) {
+        epoll_event events[MAX_EVENTS];
+        int n = epoll_wait(fd_, events, MAX_EVENTS, timeoutMs);
+        if (n <= 0)
+            return 0;
+        // only count the times we actually had to wait
+        if (timeoutMs != 0)
+            wakeups_.fetch_add(1, std::memory_order_relaxed);
+        for (int i = 0; i < n; ++i)
+            (*static_cast<Handler*>(events[i].data.ptr))();
+        return n;
+    }
+
+    /** Total number of wakeups so far.
+     */
+    size_t wakeups() const { return wakeups_.load(std::memory_order_relaxed); }
+
+private:
+
+    static constexpr int MAX_EVENTS = 16;
+
+    int fd_;
+    std::vector<std::unique_ptr<Handler>> handlers_;
+    std::atomic<size_t> wakeups_{0};
+
+}; // Reactor
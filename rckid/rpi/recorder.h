@@ -39,8 +39,8 @@ protected:
                 f_ = std::ofstream{"/rckid/recording.dat", std::ios::binary};
                 maxIndex_ = 0;
                 nextIndex_ = 0;
-                memset(max_, 128, 320);
-                memset(min_, 128, 320);
+                memset(max_, 0, sizeof(max_));
+                memset(min_, 0, sizeof(min_));
                 avis_.reset();
                 rckid().startAudioRecording();
             }
@@ -54,13 +54,14 @@ protected:
     void audioRecorded(RecordingEvent & e) override {
         while (e.status.batchIndex() != nextIndex_) {
             nextIndex_ = (nextIndex_ + 1) % 8;
-            f_.write(reinterpret_cast<char const *>(empty_), 32);
+            f_.write(reinterpret_cast<char const *>(empty_), sizeof(empty_));
         }
         nextIndex_ = (nextIndex_ + 1) % 8;
         //f_ << (int)e.status.batchIndex() << ":";
-        f_.write(reinterpret_cast<char const *>(e.data), 32);
-        uint8_t max = 0;
-        uint8_t min = 255;
+        // the recording is stored as 16bit signed samples at AUDIO_RECORDING_SAMPLE_RATE
+        f_.write(reinterpret_cast<char const *>(e.data), sizeof(e.data));
+        int16_t max = INT16_MIN;
+        int16_t min = INT16_MAX;
         for (size_t i = 0; i < 32; ++i) {
             //f_ <<  " " << (int)e.data[i];
             if (e.data[i] > max)
@@ -76,13 +77,13 @@ protected:
     }
 
     std::ofstream f_;
-    uint8_t min_[320];
-    uint8_t max_[320];
+    int16_t min_[320];
+    int16_t max_[320];
     size_t maxIndex_ = 0;
     uint8_t nextIndex_ = 0;
     bool recording_ = false;
-    uint8_t empty_[32] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
+    int16_t empty_[32] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
 
 
-    AudioVisualizer avis_{8000, 60, 1};
+    AudioVisualizer avis_{AUDIO_RECORDING_SAMPLE_RATE, 60, 1};
 }; // Recorder
\ No newline at end of file
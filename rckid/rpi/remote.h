@@ -151,6 +151,7 @@ protected:
                 DeviceInfo * msg = reinterpret_cast<DeviceInfo*>(e.packet);
                 std::cout << "Device info received: " << msg->name << ", id: " << msg->deviceId << " num channels: " << (int) msg->numChannels << std::endl;
                 RemoteDevice d{msg->name, msg->deviceId};
+                rckid().linkStats().peer(STR(d.name << " #" << d.id)).received();
                 auto i = devices_.find(d);
                 if (i == devices_.end())
                     devices_[d] = 1;
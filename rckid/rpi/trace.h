@@ -0,0 +1,171 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <mutex>
+#include <chrono>
+
+/** Binary trace of the driver's inputs.
+
+    The trace contains every driver event as it was dequeued by the driver's thread and the raw responses of every I2C and SPI transaction, in the order they happened, with monotonic timestamps. Replaying the events against the recorded responses reproduces the driver's (and therefore the UI's) behavior deterministically, which makes field stutters reproducible and real sessions usable as performance benchmarks.
+
+    The trace starts with a 4 byte magic and a version byte, followed by the records. Each record is a kind byte, the time since the previous record in microseconds as a varint, the payload size as a varint and the payload itself:
+
+    - Event: the event's index in the driver event variant followed by its encoded value
+    - I2C: address, read size, result (0 or 1) and the bytes read
+    - SPI: the bytes received
+    - I2CBatch: no payload, precedes the I2C records of transactions merged into a single ioctl
+    - I2CRetry: addresses of the devices whose transactions are executed again one by one after the merged ioctl since the last I2CBatch failed (see AsyncI2C), their I2C records in the failed ioctl are superseded
+
+    The trace does not know anything about the events themselves, their encoding is up to the driver.
+ */
+class Trace {
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr uint8_t VERSION = 1;
+
+    enum class Kind : uint8_t {
+        Event = 0,
+        I2C = 1,
+        SPI = 2,
+        I2CBatch = 3,
+        I2CRetry = 4,
+    };
+
+    struct Record {
+        Kind kind;
+        /** Time since the beginning of the trace in microseconds. */
+        uint64_t time;
+        std::vector<uint8_t> payload;
+    };
+
+    /** Writes the trace records to a file. The writer may be used from multiple threads.
+     */
+    class Writer {
+    public:
+
+        /** Creates the trace file, returns false if it can't be created.
+         */
+        bool open(std::string const & filename) {
+            std::lock_guard<std::mutex> g{m_};
+            f_.open(filename, std::ios::binary | std::ios::trunc);
+            if (!f_.good())
+                return false;
+            f_.write(MAGIC, 4);
+            f_.put(static_cast<char>(VERSION));
+            last_ = Clock::now();
+            records_ = 0;
+            return f_.good();
+        }
+
+        void close() {
+            std::lock_guard<std::mutex> g{m_};
+            f_.close();
+        }
+
+        void event(uint8_t index, void const * data, size_t size) {
+            write(Kind::Event, & index, 1, data, size);
+        }
+
+        void i2c(uint8_t address, uint8_t const * rb, uint8_t rsize, bool result) {
+            uint8_t header[] = { address, rsize, result };
+            write(Kind::I2C, header, sizeof(header), rb, rsize);
+        }
+
+        void spi(uint8_t const * rx, size_t numBytes) {
+            write(Kind::SPI, nullptr, 0, rx, numBytes);
+        }
+
+        void i2cBatch() { write(Kind::I2CBatch, nullptr, 0, nullptr, 0); }
+
+        void i2cRetry(uint8_t const * addresses, size_t n) { write(Kind::I2CRetry, nullptr, 0, addresses, n); }
+
+        size_t records() const { return records_; }
+
+    private:
+
+        void write(Kind kind, void const * header, size_t headerSize, void const * data, size_t size) {
+            std::lock_guard<std::mutex> g{m_};
+            if (!f_.is_open())
+                return;
+            Clock::time_point t = Clock::now();
+            f_.put(static_cast<char>(kind));
+            writeVarint(std::chrono::duration_cast<std::chrono::microseconds>(t - last_).count());
+            writeVarint(headerSize + size);
+            f_.write(static_cast<char const *>(header), headerSize);
+            f_.write(static_cast<char const *>(data), size);
+            last_ = t;
+            ++records_;
+        }
+
+        void writeVarint(uint64_t x) {
+            while (x >= 0x80) {
+                f_.put(static_cast<char>((x & 0x7f) | 0x80));
+                x >>= 7;
+            }
+            f_.put(static_cast<char>(x));
+        }
+
+        std::mutex m_;
+        std::ofstream f_;
+        Clock::time_point last_;
+        size_t records_ = 0;
+
+    }; // Trace::Writer
+
+    /** Reads the whole trace. Returns false if the file can't be read, or is not a valid trace, in which case the records read so far are kept.
+     */
+    bool load(std::string const & filename) {
+        records_.clear();
+        std::ifstream f{filename, std::ios::binary};
+        std::vector<uint8_t> data{std::istreambuf_iterator<char>{f}, std::istreambuf_iterator<char>{}};
+        if (data.size() < 5 || memcmp(data.data(), MAGIC, 4) != 0 || data[4] != VERSION)
+            return false;
+        size_t i = 5;
+        uint64_t t = 0;
+        while (i < data.size()) {
+            Record r;
+            r.kind = static_cast<Kind>(data[i++]);
+            uint64_t dt, size;
+            if (!readVarint(data, i, dt) || !readVarint(data, i, size) || i + size > data.size())
+                return false;
+            t += dt;
+            r.time = t;
+            r.payload.assign(data.begin() + i, data.begin() + i + size);
+            i += size;
+            records_.push_back(std::move(r));
+        }
+        return true;
+    }
+
+    std::vector<Record> const & records() const { return records_; }
+
+    /** Duration of the trace in microseconds.
+     */
+    uint64_t duration() const { return records_.empty() ? 0 : records_.back().time; }
+
+private:
+
+    static constexpr char MAGIC[4] = { 'R', 'C', 'K', 'T' };
+
+    static bool readVarint(std::vector<uint8_t> const & data, size_t & i, uint64_t & x) {
+        x = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (i >= data.size())
+                return false;
+            uint8_t b = data[i++];
+            x |= static_cast<uint64_t>(b & 0x7f) << shift;
+            if ((b & 0x80) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    std::vector<Record> records_;
+
+}; // Trace
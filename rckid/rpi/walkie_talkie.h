@@ -1,10 +1,11 @@
 #pragma once
 
-#include <unordered_map>
+#include <set>
 
 #include "widget.h"
 #include "window.h"
 #include "audio.h"
+#include "channel_survey.h"
 
 /** Walkie Talkie
  
@@ -38,6 +39,9 @@
 
     # Heartbeats
 
+    # Channel changes
+
+    Y surveys the channels (see RCKid::nrfScan()) and if there is a quieter channel than the current one, the device announces it with the CHANNEL command, which has the new channel and the sender's name. The announcement is repeated a few times as nothing is acked. The peers move to the new channel as soon as they receive it, the announcing device follows a bit later so that it does not leave before the repeats are sent. 
  */
 class WalkieTalkie : public Widget {
 public:
@@ -54,13 +58,17 @@ protected:
         Widget::setFooterHints();
         window().addFooterItem(FooterItem::A("Talk"));
         window().addFooterItem(FooterItem::X("Beep"));
+        window().addFooterItem(FooterItem::Y("Channel"));
         window().addFooterItem(FooterItem::UpDown("󰕾"));
     }
 
     void tick() override {
+        if (hopChannel_ != channel_ && asMillis(now() - tHop_) >= WALKIE_TALKIE_HOP_DELAY_MS)
+            switchChannel(hopChannel_);
         if (tHeartbeat_.update()) {
             tHeartbeat_.startRandom(WALKIE_TALKIE_HEARTBEAT_INTERVAL_MIN, WALKIE_TALKIE_HEARTBEAT_INTERVAL_MAX);
-            if (mode_ == Mode::Listening) {
+            // the heartbeat would stop the scan
+            if (mode_ == Mode::Listening && !scanning_) {
                 uint8_t packet[32];
                 new (packet) Heartbeat{heartbeatIndex_++, name_};
                 rckid().nrfTransmitImmediate(packet);
@@ -68,17 +76,25 @@ protected:
         }
     }
 
+    /** Ticked while waiting to follow the peers to the new channel. */
+    int tickInterval() const override { return hopChannel_ != channel_ ? UI_IDLE_TICK_MS : -1; }
+
     void draw(Canvas & c) override {
         c.drawTexture(0, 20, icon_);
         c.drawText(70, 25, name_, WHITE, c.titleFont());
         switch (mode_) {
             case Mode::Listening: {
+                c.blendAddColors();
+                if (scanning_)
+                    c.drawText(70, 60, STR("Ch: " << (int)channel_ << ", scanning " << survey_.sweeps() * 100 / WALKIE_TALKIE_SCAN_SWEEPS << "%"), LIGHTGRAY, c.helpFont());
+                else
+                    c.drawText(70, 60, STR("Ch: " << (int)channel_), LIGHTGRAY, c.helpFont());
                 c.drawTexture(25, 100, friends_);
                 int y = 105;
                 auto i = conns_.begin();
                 while (i != conns_.end()) {
                     c.blendAdditive();
-                    size_t q = i->second.quality();
+                    size_t q = quality(*i);
                     if (q == 0) {
                         i = conns_.erase(i);
                     } else {
@@ -92,7 +108,7 @@ protected:
                             c.drawText(70, y, "", c.accentColor());
                         }
                         c.blendAddColors();
-                        c.drawText(130, y, i->first, LIGHTGRAY);
+                        c.drawText(130, y, *i, LIGHTGRAY);
                         y += 20;
                         ++i;
                     }
@@ -107,8 +123,12 @@ protected:
                 c.drawTexture(225, 120, mic_);
                 size_t sec = asMillis(now() - tStart_) / 1000;
                 c.drawText(20, 105, STR("Recording... (" << sec << "s)"), WHITE, c.defaultFont());
-                c.drawText(20, 125, STR("Up: " << packetsTx_ << ", Qs: " << rckid().nrfTxQueueSize()), LIGHTGRAY, c.helpFont());
-                c.drawText(20, 140, STR("Sr: " << rawLength_ << ", Sc: " << compressedLength_), LIGHTGRAY, c.helpFont());
+                c.drawText(20, 125, STR("Up: " << packetsTx_ << ", Qs: " << rckid().nrfTxQueueSize() << "/" << rckid().nrfTxQueueMaxSize() << ", Drop: " << rckid().nrfTxQueueOverflows()), LIGHTGRAY, c.helpFont());
+                {
+                    // driver time per transmit, average and max
+                    RCKid::NRFTxStats tx{rckid().nrfTxStats()};
+                    c.drawText(20, 140, STR("Sr: " << rawLength_ << ", Sc: " << compressedLength_ << ", Tx: " << tx.avgUs << "/" << tx.maxUs << "us, Fail: " << rckid().linkStats().txFailures()), LIGHTGRAY, c.helpFont());
+                }
                 break;
             }
             case Mode::Playing: {
@@ -138,8 +158,10 @@ protected:
                 c.drawText(20, 105, STR("Playing... (" << sec << "s)"), WHITE, c.defaultFont());
                 c.drawText(20, 125, STR("Down: " << packetsRx_ << ", Qs: " << rxAudioBuffers_.size()), LIGHTGRAY, c.helpFont());
                 c.drawText(20, 140, STR("Pc: " << dec_.packets() <<  ", Pe: " << dec_.missingPackets()), LIGHTGRAY, c.helpFont());
+                if (LinkStats::Peer const * p = rckid().linkStats().find(pttLink(senderName_)))
+                    c.drawText(20, 155, STR("Loss: " << p->loss(16) << "/" << p->loss(128) << "%, Dup: " << p->duplicates() << ", J: " << p->jitterUs() / 1000 << "ms"), LIGHTGRAY, c.helpFont());
                 if (IsAudioStreamProcessed(pttRx_) && ! rxAudioBuffers_.empty()) {
-                    UpdateAudioStream(pttRx_, rxAudioBuffers_.front(), 960);
+                    UpdateAudioStream(pttRx_, rxAudioBuffers_.front(), RX_BUFFER_LENGTH);
                     delete [] rxAudioBuffers_.front();
                     rxAudioBuffers_.pop_front();
                 }
@@ -159,6 +181,8 @@ protected:
 
 
     void onFocus() override {
+        scanning_ = false;
+        hopChannel_ = channel_;
         rckid().nrfInitialize("RCKid", "RCKid", channel_);
         conns_.clear();
         rckid().nrfEnableReceiver();
@@ -184,6 +208,9 @@ protected:
      */
     void btnA(bool state) override {
         if (mode_ == Mode::Listening && state) {
+            // talking stops the scan, or the channel change
+            scanning_ = false;
+            hopChannel_ = channel_;
             mode_ = Mode::Recording;
             enc_.reset();
             rawLength_ = 0;
@@ -226,6 +253,37 @@ protected:
         }
     }
 
+    /** Surveys the channels to move to the quietest one. 
+     */
+    void btnY(bool state) override {
+        if (state && mode_ == Mode::Listening && !scanning_ && hopChannel_ == channel_) {
+            scanning_ = true;
+            survey_.reset();
+            rckid().nrfScan(WALKIE_TALKIE_SCAN_SWEEPS);
+            requestRedraw();
+        }
+    }
+
+    /** When the survey is done, the radio is back in the receiver mode on the current channel, from where the peers are told about the quieter one, if any. 
+     */
+    void nrfScanDone(NRFScanEvent & e) override {
+        if (!scanning_)
+            return;
+        survey_.add(e);
+        requestRedraw();
+        if (survey_.sweeps() < WALKIE_TALKIE_SCAN_SWEEPS)
+            return;
+        scanning_ = false;
+        uint8_t ch = survey_.quietest(channel_);
+        if (ch == channel_)
+            return;
+        ChannelHop msg{ch, name_};
+        for (int i = 0; i < WALKIE_TALKIE_HOP_REPEATS; ++i)
+            rckid().nrfTransmitImmediate(& msg, 32);
+        hopChannel_ = ch;
+        tHop_ = now();
+    }
+
     void dpadUp(bool state) override {
         if (state)
             rckid().setVolume(rckid().volume() + 10);
@@ -249,7 +307,7 @@ protected:
 
     void audioRecorded(RecordingEvent & e) override {
         avis_.addData(e.data, 32);
-        rawLength_ += 32;
+        rawLength_ += sizeof(e.data);
         if (enc_.encode(e.data, 32))
             compressedLength_ += enc_.currentFrameSize();
         if (enc_.currentFrameValid()) {
@@ -274,6 +332,9 @@ protected:
             case MSG_BEEP:
                 // TODO
                 break; 
+            case MSG_CHANNEL:
+                processChannelHop(*reinterpret_cast<ChannelHop*>(e.packet));
+                break;
             default:
                 // TODO if not playing, enter playing mode
                 processPTTData(e.packet);
@@ -282,9 +343,9 @@ protected:
     }
 
 
-    void nrfTxDone() override {
+    void nrfTxDone(NRFTxEvent & e) override {
         if (mode_ == Mode::Recording)
-            ++packetsTx_;
+            packetsTx_ += e.packets;
     }
 
 private:
@@ -294,6 +355,7 @@ private:
     static constexpr uint8_t MSG_PTT_START  = 0b11100001;
     static constexpr uint8_t MSG_PTT_END    = 0b11100010;
     static constexpr uint8_t MSG_BEEP       = 0b11100011; 
+    static constexpr uint8_t MSG_CHANNEL    = 0b11100100;
 
     struct CmdWithName {
         uint8_t const id;
@@ -328,56 +390,73 @@ private:
 
     static_assert(sizeof(Heartbeat) == 32);
 
-    /** For each device in range we keep the number of heartbeats we have received */
-    struct ConnectionInfo {
-        static constexpr size_t DEPTH = 16;
-        std::deque<bool> seen;
-        size_t valid = 0;
-        uint8_t lastIndex;
-        Timepoint lastUpdate;
-        
-        void addIndex(uint8_t index) {
-            lastUpdate = now();
-            ++lastIndex;
-            while (lastIndex != index) {
-                seen.push_back(false);
-                ++lastIndex;
-            }
-            seen.push_back(true);
-            ++valid;
-            while (seen.size() > DEPTH) {
-                if (seen.front())
-                    --valid;
-                seen.pop_front();
-            }
-        }
+    struct ChannelHop {
+        uint8_t const id = MSG_CHANNEL;
+        uint8_t channel;
+        char name[30];
 
-        size_t quality() {
-            Timepoint t = now();
-            size_t adj = asMillis(t - lastUpdate) / WALKIE_TALKIE_HEARTBEAT_INTERVAL_MAX;
-            if (adj > valid)
-                return 0;
-            return (valid - adj) * 100 / DEPTH;
+        ChannelHop(uint8_t channel, std::string const & name):
+            channel{channel} {
+            memcpy(this->name, name.c_str(), std::min(name.size() + 1, (size_t)30));
+            this->name[29] = 0; 
         }
-    }; 
+
+    } __attribute__((packed)); 
+
+    static_assert(sizeof(ChannelHop) == 32);
+
+    /** Link statistics key of the device's PTT audio, its heartbeats are keyed by its name. 
+     */
+    static std::string pttLink(std::string const & name) { return name + " ptt"; }
+
+    /** Percentage of the last 16 heartbeats received from the device. Each heartbeat interval since the last one counts as another missing heartbeat so that devices that went out of range fade away. 
+     */
+    static size_t quality(std::string const & name) {
+        static constexpr size_t DEPTH = 16;
+        LinkStats::Peer const * p = rckid().linkStats().find(name);
+        if (p == nullptr)
+            return 0;
+        size_t valid = p->receivedOf(DEPTH);
+        size_t adj = std::chrono::duration_cast<std::chrono::milliseconds>(LinkStats::Clock::now() - p->lastSeen()).count() / WALKIE_TALKIE_HEARTBEAT_INTERVAL_MAX;
+        if (adj > valid)
+            return 0;
+        return (valid - adj) * 100 / DEPTH;
+    }
 
     void processIncomingHeartbeat(Heartbeat const & msg) {
         std::string name{msg.name};
-        auto i = conns_.find(name);
-        if (i == conns_.end())
-            i = conns_.insert(std::make_pair(name, ConnectionInfo{})).first;
-        i->second.addIndex(msg.index);
+        conns_.insert(name);
+        rckid().linkStats().peer(name).received(msg.index);
+    }
+
+    /** Follows the peer to the announced channel. Repeated announcements arrive after the move and are ignored, as are those while talking, or listening to someone else. 
+     */
+    void processChannelHop(ChannelHop const & msg) {
+        if (mode_ != Mode::Listening || msg.channel == channel_ || msg.channel >= ChannelSurvey::NUM_CHANNELS)
+            return;
+        TraceLog(LOG_INFO, STR("Walkie-talkie moving to channel " << (int)msg.channel << " announced by " << msg.name));
+        scanning_ = false;
+        switchChannel(msg.channel);
+    }
+
+    void switchChannel(uint8_t channel) {
+        channel_ = channel;
+        hopChannel_ = channel;
+        rckid().nrfInitialize("RCKid", "RCKid", channel_);
+        rckid().nrfEnableReceiver();
+        requestRedraw();
     }
 
     void processPTTData(uint8_t * data) {
         ++packetsRx_;
+        rckid().linkStats().peer(pttLink(senderName_)).received(data[1]);
         size_t n = dec_.decodePacket(data);
         if (n != 0) {
             if (rxAudioBufferSize_ == 0)
-                rxAudioBuffer_ = new int16_t[960];
-            memcpy(rxAudioBuffer_ + rxAudioBufferSize_, dec_.buffer(), 320 * 2);
-            rxAudioBufferSize_ += 320;
-            if (rxAudioBufferSize_ == 960) {
+                rxAudioBuffer_ = new int16_t[RX_BUFFER_LENGTH];
+            memcpy(rxAudioBuffer_ + rxAudioBufferSize_, dec_.buffer(), n * sizeof(int16_t));
+            rxAudioBufferSize_ += n;
+            if (rxAudioBufferSize_ == RX_BUFFER_LENGTH) {
                 rxAudioBufferSize_ = 0;
                 rxAudioBuffers_.push_back(rxAudioBuffer_);
                 rxAudioBuffer_ = nullptr;
@@ -393,11 +472,13 @@ private:
         senderName_ = cmd.name;
         pttRxDone_ = false;
         // start audio playback
-        SetAudioStreamBufferSizeDefault(960); // 3 frames for 12.5 fps minimum 
-        pttRx_ = LoadAudioStream(8000, 16, 1);
+        SetAudioStreamBufferSizeDefault(RX_BUFFER_LENGTH); // 3 frames for 12.5 fps minimum 
+        pttRx_ = LoadAudioStream(AUDIO_RECORDING_SAMPLE_RATE, 16, 1);
         SetAudioStreamBufferSizeDefault(0); // reset
         PlayAudioStream(pttRx_);
         dec_.reset();
+        // the packet indices start over with each transmission
+        rckid().linkStats().peer(pttLink(senderName_)) = LinkStats::Peer{};
         rxAudioBuffers_.clear();
         tStart_ = now();
         packetsRx_ = 0;
@@ -422,12 +503,19 @@ private:
 
 
     uint8_t channel_{86};
+    // channel survey, and the channel announced to the peers and when, the device follows them after a delay
+    bool scanning_ = false;
+    ChannelSurvey survey_;
+    uint8_t hopChannel_{86};
+    Timepoint tHop_;
     std::string name_{"Ada"};
 
     // Name from which we are currently receiving. Only useful in playing mode 
     std::string senderName_{};
     bool pttRxDone_;
     AudioStream pttRx_;
+    /** Playback buffer length, 3 decoded 40ms frames. */
+    static constexpr size_t RX_BUFFER_LENGTH = AUDIO_RECORDING_SAMPLE_RATE / 25 * 3;
     int16_t * rxAudioBuffer_{nullptr};
     size_t rxAudioBufferSize_{0};
     std::deque<int16_t*> rxAudioBuffers_;
@@ -436,8 +524,8 @@ private:
     Timer tHeartbeat_;
     // heartbeat index so that we know how many we have out of how much
     uint8_t heartbeatIndex_ = 0;
-    // list of devices we have received heartbeat from
-    std::unordered_map<std::string, ConnectionInfo> conns_;
+    // devices we have received heartbeat from, their link quality is in the link statistics
+    std::set<std::string> conns_;
 
     Mode mode_{Mode::Listening};
     Timepoint tStart_;
@@ -447,7 +535,7 @@ private:
     size_t compressedLength_;
     size_t packetsTx_; 
     size_t packetsRx_ = 0; 
-    AudioVisualizer avis_{8000, 30, 0.5};
+    AudioVisualizer avis_{AUDIO_RECORDING_SAMPLE_RATE, 30, 0.5};
     opus::RawEncoder enc_;
     opus::RawDecoder dec_;
 
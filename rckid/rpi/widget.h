@@ -25,6 +25,18 @@ protected:
      */
     virtual void tick() {};
 
+    /** Returns the time in milliseconds after which the widget must be ticked again even though it does not request a redraw, or -1 if the widget does not need any ticks until it requests a redraw, or receives an event. 
+     
+        When nothing is animating the UI thread only wakes up for events, so widgets that poll something in their tick() must override this. 
+     */
+    virtual int tickInterval() const { return -1; }
+
+    /** Returns true if the widget wants the gesture() callbacks. 
+     
+        The accelerometer is only polled while someone uses it, so widgets that react to gestures must override this. The window reads the value when the widget gains focus.
+     */
+    virtual bool gestures() const { return false; }
+
     /** Override this to draw the widget.
      */
     virtual void draw(Canvas & canvas) = 0;
@@ -62,6 +74,7 @@ protected:
     virtual void dpadDown(bool state) {}
     virtual void joy(uint8_t h, uint8_t v) {}
     virtual void accel(uint8_t h, uint8_t v) {}
+    virtual void gesture(Gesture g) {}
     virtual void btnHome(bool state);
 
     /** Called when audio packet (32 bytes) has been recorded by the AVR. 
@@ -72,9 +85,13 @@ protected:
      */
     virtual void nrfPacketReceived(NRFPacketEvent & e) {}
     
-    /** Packet transmit callback. 
+    /** Packet transmit callback, called for one or more packets. 
+     */
+    virtual void nrfTxDone(NRFTxEvent & e) {}
+
+    /** Channel scan sweep callback, see RCKid::nrfScan(). 
      */
-    virtual void nrfTxDone() {}
+    virtual void nrfScanDone(NRFScanEvent & e) {}
 
 
     /** Updates the widget's footer shortcut information. 
@@ -55,7 +55,8 @@ Window & Window::create() {
 
 Window::Window() {
     InitWindow(320, 240, "RCKid");
-    SetTargetFPS(60);
+    // frames are paced by the event loop so that input events never wait for the frame to end
+    SetTargetFPS(0);
     canvas_ = std::make_unique<Canvas>(320, 240);
     if (! IsWindowReady())
         TraceLog(LOG_ERROR, "Unable to initialize window");
@@ -145,6 +146,7 @@ void Window::back(size_t numWidgets) {
         modal_->onNavigationPop();
         modal_->onNavStack_ = false;
         modal_ = nullptr;
+        rckid().setGesturesActive(nav_.back()->gestures());
         // force widget repaint 
         nav_.back()->redraw_ = true;
     }
@@ -176,6 +178,7 @@ void Window::showModal(Widget * widget) {
     modal_->onNavigationPush();
     modal_->onNavStack_ = true;
     modal_->onFocus();
+    rckid().setGesturesActive(modal_->gestures());
     modal_->setFooterHints();
     // force redraw of the modal window
     modal_->redraw_ = true;
@@ -188,6 +191,7 @@ void Window::enter(Widget * widget) {
         widget->onNavStack_ = true;
     }
     widget->onFocus();
+    rckid().setGesturesActive(widget->gestures());
     widget->setFooterHints();
     // set the swap transition to fade the widget in and require its redraw
     tSwap_ = Transition::FadeIn;
@@ -204,6 +208,7 @@ void Window::enter(Widget * widget) {
 
 void Window::leave(Widget * widget, bool navPop) {
     widget->onBlur();
+    rckid().setGesturesActive(false);
     if (navPop) {
         widget->onNavigationPop();
         widget->onNavStack_ = false;
@@ -222,6 +227,14 @@ void Window::loop() {
         if (WindowShouldClose())
             break;
 #endif
+        // wait for an event, or until the next frame is due. If nothing is animating, only events can wake us up
+        int timeout = nextFrameTimeout();
+        if (timeout != 0) {
+            rckid().waitForEvent(timeout);
+            // animations that start after the wait should not jump by the time we were idle
+            if (timeout < 0 || timeout > UI_FRAME_MS)
+                lastFrameTime_ = now() - std::chrono::milliseconds{UI_FRAME_MS};
+        }
         // process any RCkid's evenys
         while (true) {
             auto event = rckid().nextEvent();
@@ -306,6 +319,9 @@ void Window::loop() {
                                 w->btnJoy(eb.state);
                                 break;
                         }
+                        rckid().inputLatency().record(LatencyStats::Stage::UI, eb.origin);
+                        if (inputOrigin_ == LatencyClock::time_point{} || (eb.origin != LatencyClock::time_point{} && eb.origin < inputOrigin_))
+                            inputOrigin_ = eb.origin;
                     }, 
                     [this, w](JoyEvent et) {
                         w->joy(et.h, et.v);
@@ -324,14 +340,38 @@ void Window::loop() {
                         w->nrfPacketReceived(e);
                     },
                     [this, w](NRFTxEvent e) {
-                        w->nrfTxDone();
+                        w->nrfTxDone(e);
+                    },
+                    [this, w](GestureEvent e) {
+                        w->gesture(e.gesture);
+                    },
+                    [this, w](NRFScanEvent e) {
+                        w->nrfScanDone(e);
                     },
                 }, event.value());
             }    
         }
-        // when all rckid's events are processed, try drawing
-        draw();
+        // when all rckid's events are processed, draw right away, the time to first pixel is measured from the oldest input event in the frame. If the frame did not change, the input had no visible effect and there is nothing to measure
+        if (draw())
+            rckid().inputLatency().record(LatencyStats::Stage::Frame, inputOrigin_);
+        inputOrigin_ = LatencyClock::time_point{};
+    }
+}
+
+int Window::nextFrameTimeout() const {
+    bool animating = redrawBackground_ || redrawHeader_ || redrawFooter_ || FORCE_FULL_REDRAW;
+    animating = animating || tSwap_ != Transition::None || tHeader_ != Transition::None || tFooter_ != Transition::None;
+    int tickInterval = -1;
+    if (!nav_.empty()) {
+        Widget * w = nav_.back();
+        animating = animating || w->redraw_ || (modal_ != nullptr && modal_->redraw_);
+        tickInterval = w->tickInterval();
     }
+    if (animating) {
+        int64_t elapsed = asMillis(now() - lastFrameTime_);
+        return static_cast<int>(std::max<int64_t>(0, UI_FRAME_MS - elapsed));
+    }
+    return tickInterval;
 }
 
 struct RenderingStats {
@@ -350,7 +390,7 @@ RenderingStats frames_[320];
 size_t fti_ = 0;
 #endif
 
-void Window::draw() {
+bool Window::draw() {
     Timepoint t = now();
     redrawDelta_ = asMillis(t - lastFrameTime_);
     lastFrameTime_ = t;
@@ -545,9 +585,8 @@ void Window::draw() {
         frames_[fti_].total = asMillis(now() - t);
         fti_ = (fti_ + 1) % 320;
 #endif
-    } else {
-        platform::cpu::delayMs(16); // to maintain 60fps illusion
     }
+    return redraw;
 }
 
 
@@ -205,7 +205,13 @@ private:
      */
     Window();
 
-    void draw();
+    /** Draws the frame, if anything changed. Returns true if the screen has been updated. 
+     */
+    bool draw();
+
+    /** Returns how long the UI thread may wait for events before the next frame must be drawn, in milliseconds. Returns -1 if nothing is animating and the UI thread should only wake up for events. 
+     */
+    int nextFrameTimeout() const;
 
     void drawHeader();
     void drawBatteryGauge(int & x, uint16_t vbatt);
@@ -224,6 +230,9 @@ private:
     Timepoint lastFrameTime_;
     size_t redrawDelta_; 
 
+    /** Interrupt time of the oldest input event dispatched since the last frame, used to measure the time to first pixel. */
+    LatencyClock::time_point inputOrigin_;
+
 
     Animation aSwap_{WIDGET_FADE_TIME};
     Transition tSwap_ = Transition::None;